@@ -13,7 +13,11 @@ HEADER_TAG_FRAMEBUFFER EQU 5
 
 ; Constants for loading higher half kernel
 VM_BASE            EQU 0xC0000000
+%ifdef CONFIG_PAE
+PDE_INDEX          EQU (VM_BASE >> 21)   ; 2MB entries, four directories side by side
+%else
 PDE_INDEX          EQU (VM_BASE >> 22)
+%endif
 
 ; Multiboot Header Section
 section .multiboot align=8
@@ -53,6 +57,22 @@ multiboot_header_end:
 section .data
 align 4096
 global initial_page_dir
+%ifdef CONFIG_PAE
+; Same mappings with 2MB pages: the first 4MB identity mapped and at VM_BASE
+initial_page_dir:
+    DQ (0 << 21) | 10000011b       ; Present, Read/Write, Page Size (2MB)
+    DQ (1 << 21) | 10000011b
+    TIMES (PDE_INDEX - 2) DQ 0
+    DQ (0 << 21) | 10000011b       ; PDEs for higher half kernel
+    DQ (1 << 21) | 10000011b
+    TIMES (2048 - PDE_INDEX - 2) DQ 0
+align 32
+initial_pdpt:                      ; Only the present bit is valid in a PDPT entry
+    DD (initial_page_dir - VM_BASE + 0x0000 + 1), 0
+    DD (initial_page_dir - VM_BASE + 0x1000 + 1), 0
+    DD (initial_page_dir - VM_BASE + 0x2000 + 1), 0
+    DD (initial_page_dir - VM_BASE + 0x3000 + 1), 0
+%else
 initial_page_dir:
     DD 10000011b                  ; Present, Read/Write, Page Size bit set for 4MB pages
     TIMES (PDE_INDEX-1) DD 0       ; Identity map first 4MB (null entries)
@@ -61,6 +81,7 @@ initial_page_dir:
     DD (2 << 22) | 10000011b
     DD (3 << 22) | 10000011b
     TIMES (1024 - PDE_INDEX - 1) DD 0 ; Zero out unused PDEs
+%endif
 
 ; Stack Section
 section .bss
@@ -75,6 +96,16 @@ kernel_stack_top:
 section .boot
 global _start
 _start:
+%ifdef CONFIG_PAE
+    ; CR3 holds the PDPT, which is read when paging is turned on
+    MOV ecx, (initial_pdpt - 0xC0000000)
+    MOV cr3, ecx
+
+    ; Enable PAE (64-bit entries, 2MB large pages) before paging
+    MOV ecx, cr4
+    OR ecx, 0x30    ; Set PAE and PSE bits
+    MOV cr4, ecx
+%else
     ; Update the page directory address
     MOV ecx, (initial_page_dir - 0xC0000000)  ; Update for higher-half kernel
     MOV cr3, ecx    ; Load new page directory address into CR3
@@ -83,6 +114,7 @@ _start:
     MOV ecx, cr4
     OR ecx, 0x10    ; Set PSE (Page Size Extension) bit
     MOV cr4, ecx
+%endif
 
     ; Enable paging (set PG flag in CR0)
     MOV ecx, cr0
@@ -44,7 +44,8 @@ void ata_irq_handler(registers_t *regs) {
     inb(ATA_PRIMARY_BASE_PORT + ATA_REG_STATUS);
 }
 
-int ata_identify(uint16_t io_base, uint8_t drive) {
+// Probe a drive; on success stores its LBA28 size in sectors
+int ata_identify(uint16_t io_base, uint8_t drive, uint32_t *sectors) {
     if (ata_wait_busy(io_base) != 0) return -1;
     outb(io_base + ATA_REG_DEVICE, 0xA0 | (drive << 4));
 
@@ -73,6 +74,8 @@ int ata_identify(uint16_t io_base, uint8_t drive) {
     }
     ptr[40] = '\0';
     printf("ATA Device: %s\n", id->model_number);
+    *sectors = id->total_lba28_sectors[0] | ((uint32_t)id->total_lba28_sectors[1] << 16);
+    kfree(id);
     return ATA_SUCCESS;
 }
 
@@ -117,31 +120,46 @@ int ata_write_sector(uint16_t io_base, uint8_t drive, uint32_t lba, void *buffer
 }
 
 int ata_read_block(block_device_t *dev, uint32_t block, void *buf) {
-    return ata_read_sector((uint16_t)dev->device_data, ATA_MASTER, block, buf);
+    ata_drive_t *ata_drive = dev->device_data;
+    return ata_read_sector(ata_drive->io_base, ata_drive->drive, block, buf);
 }
 
 int ata_write_block(block_device_t *dev, uint32_t block, const void *buf) {
-    return ata_write_sector((uint16_t)dev->device_data, ATA_MASTER, block, buf);
+    ata_drive_t *ata_drive = dev->device_data;
+    return ata_write_sector(ata_drive->io_base, ata_drive->drive, block, (void *)buf);
 }
 
+static ata_drive_t primary_master = { ATA_PRIMARY_BASE_PORT, ATA_MASTER };
+static ata_drive_t primary_slave = { ATA_PRIMARY_BASE_PORT, ATA_SLAVE };
+
 block_device_t ata = {
     .name = "/dev/sda1",
     .read_block = ata_read_block,
     .write_block = ata_write_block,
-    .device_data = (void *)ATA_PRIMARY_BASE_PORT
+    .device_data = &primary_master
+};
+
+// Second disk on the primary channel; used as the swap area (see swap.h)
+block_device_t ata_slave = {
+    .name = "/dev/sdb",
+    .read_block = ata_read_block,
+    .write_block = ata_write_block,
+    .device_data = &primary_slave
 };
 
 void ata_init() {
     // Initialize the ATA devices
-    if (ata_identify(ATA_PRIMARY_BASE_PORT, ATA_MASTER) != ATA_SUCCESS) {
+    if (ata_identify(ATA_PRIMARY_BASE_PORT, ATA_MASTER, &ata.block_count) != ATA_SUCCESS) {
         printf("No primary master ATA device found\n");
     } else {
         register_block_device(&ata);
     }
 
-    // if (ata_identify(ATA_PRIMARY_BASE_PORT, ATA_SLAVE) != ATA_SUCCESS) {
-    //     printf("No primary slave ATA device found\n");
-    // }
+    if (ata_identify(ATA_PRIMARY_BASE_PORT, ATA_SLAVE, &ata_slave.block_count) != ATA_SUCCESS) {
+        printf("No primary slave ATA device found\n");
+    } else {
+        register_block_device(&ata_slave);
+    }
 
     // if (ata_identify(ATA_SECONDARY_BASE_PORT, ATA_MASTER) != ATA_SUCCESS) {
     //     printf("No secondary master ATA device found\n");
@@ -45,6 +45,7 @@
 #define SYSCALL_EXIT_GROUP 252
 #define SYSCALL_SET_TID_ADDRESS 258
 #define SYSCALL_WRITEV 146
+#define SYSCALL_MSYNC 144
 #define SYSCALL_KILL 37
 #define SYSCALL_SIGNAL 48
 #define SYSCALL_SIGRETURN 119
@@ -68,9 +69,23 @@
 #define F_SETFL   4
 #define FD_CLOEXEC 1
 
+#define PROT_NONE      0x0
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define PROT_EXEC      0x4
+
+#define MAP_SHARED     0x01  // writes reach the file and other sharers
 #define MAP_PRIVATE    0x02  // private mapping, changes not shared
 #define MAP_ANONYMOUS  0x20  // not file-backed
 #define MAP_FIXED      0x10  // must use exact address given
+#define MAP_HUGETLB    0x40000  // back with 4MB pages where possible
+
+#define MS_ASYNC       0x1   // msync: schedule the write-back
+#define MS_INVALIDATE  0x2   // msync: drop other cached copies
+#define MS_SYNC        0x4   // msync: write back before returning
+
+#define HUGE_PAGE_SIZE 0x400000  // size of one MAP_HUGETLB / SHM_HUGE page
+#define SHM_HUGE       0x1   // shm_create: one 4MB page instead of 1024 small ones
 
 typedef struct {
     uint32_t size;
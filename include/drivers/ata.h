@@ -46,6 +46,12 @@ typedef enum {
     ATA_ERR_READ = -3
 } ata_status_t;
 
+// device_data of an ATA block device: which drive on which channel
+typedef struct {
+    uint16_t io_base;
+    uint8_t drive;
+} ata_drive_t;
+
 typedef struct {
     uint16_t general_config;           // Word 0: General configuration
     uint16_t reserved_1;               // Word 1: Reserved
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * filemap.h — Pages of file-backed mmap regions.
+ *
+ * A file mapping is reserved like anonymous memory; the first touch of a
+ * page reads it from the file instead of zero-filling it.  Private mappings
+ * get a private copy (and COW on fork as usual).  Shared mappings are
+ * marked shared so fork keeps one frame, and pages the CPU has marked dirty
+ * are written back by msync(), munmap() and process exit.
+ *
+ * There is no page cache: two independent mappings of the same file each
+ * read their own copy and only see each other's writes after a write-back.
+ */
+
+#include <stdint.h>
+#include "kernel/paging.h"
+#include "kernel/vma.h"
+
+// Fill the reserved page at vaddr from the area's file
+int filemap_fault(vma_t *vma, uint32_t vaddr, page_table_entry_t *page);
+
+// Write dirty pages of the shared file areas within [start, end) back
+void filemap_sync(page_directory_t *dir, vma_tree_t *vmas, uint32_t start, uint32_t end);
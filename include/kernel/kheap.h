@@ -3,21 +3,39 @@
 #include <stdint.h>
 #include <stddef.h>
 
-// Kernel heap size = 48MB
+// The heap starts with KHEAP_MIN_SIZE mapped (one 4MB page) and grows in
+// KHEAP_GROW_SIZE steps, as far as the machine has RAM for, within the
+// 120MB window below the SHM kernel slots (see kheap_max_size)
 #define KHEAP_START 0xC0400000
-#define KHEAP_INITIAL_SIZE 48 * 0x100000
-// #define KHEAP_INITIAL_SIZE 0x100000 // debug
-
-#define KHEAP_MIN_SIZE 0x100000
+#define KHEAP_MAX_SIZE (120 * 0x100000)
+#define KHEAP_MIN_SIZE 0x400000
+#define KHEAP_GROW_SIZE 0x100000
 #define KHEAP_ALIGNMENT 8
 
 #define ALIGN_UP(addr, align) (((addr) + (align) - 1) & ~((align) - 1))
 
+// Size classes: bin i holds free blocks with size in [2^i, 2^(i+1))
+#define KHEAP_NUM_BINS 32
+#define KHEAP_MAGIC 0x4B48454D
+
+// Low bit of a size word marks the block as allocated (sizes are 8-aligned)
+#define KHEAP_USED 0x1
+#define KHEAP_SIZE(word) ((word) & ~(KHEAP_ALIGNMENT - 1))
+
+/*
+ * Every block carries a header and a footer (boundary tags) holding its
+ * total size, so kfree can find both physical neighbours in O(1).
+ * Free blocks additionally store their bin links in the payload.
+ */
 typedef struct kheap_block {
-    size_t size;
-    struct kheap_block *next;
+    size_t size;                    // total block size | KHEAP_USED
+    uint32_t magic;
+    struct kheap_block *next_free;  // valid only while free
+    struct kheap_block *prev_free;  // valid only while free
 } kheap_block_t;
 
+typedef size_t kheap_footer_t;
+
 
 // Aligns size to the nearest multiple of alignment
 static inline uint32_t align(uint32_t size) {
@@ -31,6 +49,13 @@ void kfree(void *ptr);
 void kfree_aligned(void *ptr);
 
 size_t kheap_used();
+size_t kheap_size();    // bytes currently mapped
+// How far this machine's heap may grow: its RAM, clamped to
+// [KHEAP_MIN_SIZE, KHEAP_MAX_SIZE]; needs the PMM
+size_t kheap_max_size();
+// Unmap up to max_frames free pages at the end of the heap, never going
+// below KHEAP_MIN_SIZE; returns the frames given back
+uint32_t kheap_trim(uint32_t max_frames);
 void print_kheap();
 void kheap_init();
 void *calloc(size_t num, size_t size);
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * ksm.h — Kernel same-page merging.
+ *
+ * The ksmd kernel thread walks the user page tables of every process a
+ * batch at a time, hashing private single-owner pages.  Pages with the
+ * same contents are merged into one frame mapped read-only and COW
+ * everywhere, so the first write takes a private copy again through
+ * cow_break.  Pages that are all zero go to the shared zero frame.
+ *
+ * Merged frames live in a stable table that holds a reference of its own,
+ * so a frame there can never be freed and reused behind its back.  Pages
+ * seen once wait in an unstable table, rebuilt on every pass, until a
+ * second copy turns up.  A page written since the last look (dirty bit
+ * set) is skipped for that pass.
+ *
+ * Shared mappings (SHM, MAP_SHARED files) are never merged: a COW share
+ * would hide one mapper's writes from the others.
+ */
+
+#include <stdint.h>
+#include "kernel/paging.h"
+
+#define KSM_PAGES_TO_SCAN 128       // PTEs visited per ksmd wakeup
+#define KSM_SLEEP_TICKS   20        // ticks between wakeups (200ms)
+#define KSM_HASH_BUCKETS  256
+#define KSM_UNSTABLE_MAX  1024      // candidates remembered per pass
+#define KSM_FORMAT_SIZE   160       // room for ksm_format_stats
+
+// pages_shared and pages_sharing are counted live from the stable table.
+// Zero-frame merges cannot be: the zero frame is pinned and also backs
+// demand-zero reads, so a later write or unmap goes unseen.
+typedef struct {
+    uint32_t pages_shared;      // merged frames in use
+    uint32_t pages_sharing;     // extra mappings of them: frames saved now
+    uint32_t zero_merges;       // pages sent to the zero frame, in total
+    uint32_t scanned;           // PTEs visited
+    uint32_t full_scans;        // passes over every process
+} ksm_stats_t;
+
+// Start the ksmd thread; needs the scheduler
+void ksm_init(void);
+
+// Merge what can be merged in [start, end) of dir right away, against the
+// stable table and the rest of the range; returns the frames freed
+uint32_t ksm_merge_range(page_directory_t *dir, uint32_t start, uint32_t end);
+
+void ksm_get_stats(ksm_stats_t *stats);
+// The stats as text, one "name value" per line, for /PROC/KSM; returns the length
+int ksm_format_stats(char *buf, size_t size);
@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * lz4.h — LZ4 block format compression.
+ *
+ * A greedy single-pass compressor with a 4K-entry hash table of recent
+ * positions, and a bounds-checked decompressor.  Output is standard LZ4
+ * block data (no frame header).  Inputs are limited to 64KB, which is
+ * plenty for the page-sized buffers this is used for.
+ */
+
+#include <stdint.h>
+
+#define LZ4_MAX_INPUT    0x10000
+#define LZ4_HASH_BITS    12
+// Scratch space the compressor needs, passed in by the caller
+#define LZ4_WORKMEM_SIZE ((1 << LZ4_HASH_BITS) * sizeof(uint16_t))
+
+// Compress len bytes into at most cap bytes.  Returns the compressed size,
+// or 0 if it does not fit (the data is then best stored as is).
+uint32_t lz4_compress(const void *src, uint32_t len, void *dst, uint32_t cap, void *wrkmem);
+
+// Decompress len bytes of block data into at most cap bytes.  Returns the
+// decompressed size, or -1 if the input is corrupt or does not fit.
+int lz4_decompress(const void *src, uint32_t len, void *dst, uint32_t cap);
@@ -5,17 +5,54 @@
 #include <stddef.h>
 #include "kernel/isr.h"
 
-#define UACCESS_TMP_DST  0xD0000000   // temp window for writes to user space
-#define UACCESS_TMP_SRC  0xD0001000   // temp window for reads from user space
+// Between the SHM kernel slots and the vmalloc window
+#define UACCESS_TMP_DST  0xD7C00000   // temp window for frames outside the direct map
+#define UACCESS_TMP_SRC  0xD7C01000
+#define SWAP_TMP         0xD7C02000   // swap I/O, which may run inside an allocation
+#define KSM_TMP          0xD7C03000   // ksmd compares two frames: this page and the next
+#define ZERO_TMP         0xD7C05000   // zeroing user frames, from faults and the idle loop
+
+// Permanent linear map of physical RAM: phys p is visible at PHYS_MAP_BASE + p
+#define PHYS_MAP_BASE    0xE0000000
+#define PHYS_MAP_MAX     0x10000000   // 256MB, up to 0xF0000000
 
 #define PAGE_SIZE       0x1000
-#define PAGE_ENTRIES     1024
 #define USER_HEAP_START 0x400000
 
+/*
+ * Built with CONFIG_PAE (make PAE=1), entries are 64 bits wide and frames can
+ * lie above 4GB.  The PDPT's four page directories are kept side by side, so
+ * the rest of the kernel still sees one flat directory indexed by
+ * PDE_INDEX(va), now with 2048 entries of 2MB each.
+ */
+#ifdef CONFIG_PAE
+#define PDE_SHIFT        21
+#define PAGE_ENTRIES     512        // PTEs per table, and frames per large page
+#define PDE_ENTRIES      2048       // four directories of 512 entries
+#define PDPT_ENTRIES     4
+#else
+#define PDE_SHIFT        22
+#define PAGE_ENTRIES     1024
+#define PDE_ENTRIES      1024
+#endif
+#define LARGE_PAGE_SIZE  (1u << PDE_SHIFT)   // one large-page directory entry (PSE/PAE)
+#define LARGE_PAGE_ORDER (PDE_SHIFT - 12)    // buddy order of one large page
+#define PDE_INDEX(va)    ((uint32_t)(va) >> PDE_SHIFT)
+#define PTE_INDEX(va)    (((uint32_t)(va) >> 12) & (PAGE_ENTRIES - 1))
+// First directory slot of the kernel half
+#define KERNEL_PDE_START PDE_INDEX(LOAD_MEMORY_ADDRESS)
+
 #define PAGE_PRESENT     0x1
 #define PAGE_RW          0x2
 #define PAGE_USER        0x4
 #define PAGE_SIZE_4MB    0x80
+#define PAGE_GLOBAL      0x100   // survives CR3 reloads; kernel half only
+// Write-combining.  PAT entry 1 is reprogrammed to WC, so the entry's PWT
+// bit alone selects it; ignored (normal caching) without PAT.
+#define PAGE_WC          0x8
+// Software flag for map_memory: set the PTE's shared bit, so fork and
+// mprotect never turn the mapping into a COW copy (device memory)
+#define PAGE_SHARED      0x200
 
 #define PF_ERR_PRESENT     0x1
 #define PF_ERR_RW          0x2
@@ -24,68 +61,155 @@
 #define PF_ERR_INST        0x10
 
 #define IS_ALIGN(addr) (((uint32_t)(addr) & (PAGE_SIZE - 1)) == 0)
+#define IS_LARGE_ALIGN(addr) (((uint32_t)(addr) & (LARGE_PAGE_SIZE - 1)) == 0)
 #define PAGE_ALIGN(addr) ((uint32_t)(addr) & ~(PAGE_SIZE - 1))
 #define PAGE_ALIGN_UP(addr) (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
 
+#ifdef CONFIG_PAE
+typedef uint64_t pte_word_t;
+#define FRAME_BITS 24       // 36-bit physical addresses
+#else
+typedef uint32_t pte_word_t;
+#define FRAME_BITS 20
+#endif
+
 typedef struct page_directory_entry {
-    uint32_t present    : 1;
-    uint32_t rw         : 1;
-    uint32_t user       : 1;
-    uint32_t accessed   : 1;
-    uint32_t reserved   : 1;
-    uint32_t unused     : 7;
-    uint32_t frame      : 20;
+    pte_word_t present        : 1;
+    pte_word_t rw             : 1;
+    pte_word_t user           : 1;
+    pte_word_t write_through  : 1;
+    pte_word_t cache_disable  : 1;
+    pte_word_t accessed       : 1;
+    pte_word_t dirty          : 1;    // large pages only
+    pte_word_t page_size      : 1;    // maps a large page directly, no page table
+    pte_word_t global         : 1;    // large pages only
+    pte_word_t shared         : 1;    // user large page: fork shares it instead of copying
+    pte_word_t available      : 2;
+    pte_word_t frame          : FRAME_BITS;   // large pages: address >> 12, low bits zero
+#ifdef CONFIG_PAE
+    pte_word_t reserved       : 28;   // up to MAXPHYADDR, and NX (unused)
+#endif
 } __attribute__((packed)) page_directory_entry_t;
 
 typedef struct page_table_entry {
-    uint32_t present    : 1;
-    uint32_t rw         : 1;
-    uint32_t user       : 1;
-    uint32_t accessed   : 1;
-    uint32_t dirty      : 1;
-    uint32_t unused     : 7;
-    uint32_t frame      : 20;
-} page_table_entry_t;
+    pte_word_t present        : 1;
+    pte_word_t rw             : 1;
+    pte_word_t user           : 1;
+    pte_word_t write_through  : 1;
+    pte_word_t cache_disable  : 1;
+    pte_word_t accessed       : 1;
+    pte_word_t dirty          : 1;
+    pte_word_t pat            : 1;
+    pte_word_t global         : 1;
+    pte_word_t cow            : 1;    // available bit: read-only copy-on-write share
+    pte_word_t shared         : 1;    // available bit: shared mapping, never COW
+    pte_word_t lazy           : 1;    // available bit: reserved, zero-filled on first touch
+    pte_word_t frame          : FRAME_BITS;
+#ifdef CONFIG_PAE
+    pte_word_t reserved       : 28;
+#endif
+} __attribute__((packed)) page_table_entry_t;
+
+_Static_assert(sizeof(page_table_entry_t) == sizeof(pte_word_t), "PTE must be one hardware word");
+_Static_assert(sizeof(page_directory_entry_t) == sizeof(pte_word_t), "PDE must be one hardware word");
 
 typedef struct page_table {
-    page_table_entry_t pages[1024];
+    page_table_entry_t pages[PAGE_ENTRIES];
 } __attribute__((packed)) page_table_t;
 
 typedef struct page_directory {
-    page_directory_entry_t tables[1024]; // Array of page directory entries
-    page_table_t *ref_tables[1024];      // Array of pointers to the virtual address page tables
+    page_directory_entry_t tables[PDE_ENTRIES]; // Array of page directory entries
+    page_table_t *ref_tables[PDE_ENTRIES];      // Array of pointers to the virtual address page tables
+#ifdef CONFIG_PAE
+    uint64_t pdpt[PDPT_ENTRIES];                // what CR3 points at; page aligned after the arrays
+#endif
 } __attribute__((packed)) page_directory_t;
 
+// Offset of the structure CR3 is loaded with
+#ifdef CONFIG_PAE
+#define DIR_CR3_OFFSET offsetof(page_directory_t, pdpt)
+#else
+#define DIR_CR3_OFFSET 0
+#endif
+
 
-extern page_directory_t * initial_page_dir;
+// boot.s directory entries (the four PAE directories side by side)
+extern page_directory_entry_t initial_page_dir[PDE_ENTRIES];
 extern const uint32_t _kernel_start;
 
 void paging_init();
+#ifdef CONFIG_PAE
+// Point a new directory's PDPT at its four directory pages
+void pdpt_init(page_directory_t *dir);
+#endif
 void switch_page_directory(page_directory_t *dir);
+// Directory currently loaded in CR3
+page_directory_t *get_active_page_directory(void);
 void enable_paging();
 void invalidate_page(uint32_t virtual);
 void get_cr3(uint32_t *cr3);
 
+// NULL if the address is covered by a 4MB page (there is no PTE to return)
 page_table_entry_t * get_page(uint32_t virtual, int make, page_directory_t *dir);
 bool alloc_page(page_table_entry_t *page, uint32_t flags);
 void free_page(page_table_entry_t *page);
 
+// Kernel address of a physical address covered by the direct map (NULL otherwise)
 void *phys_to_virt(uint32_t phys);
+// Same by frame number, which does not wrap for frames above 4GB (PAE)
+void *frame_to_virt(uint32_t frame);
+// Kernel address for any frame: the direct map, or 'window' (one of the
+// *_TMP addresses above) when the frame lies beyond it.  Pair with kunmap_frame.
+void *kmap_frame(uint32_t frame, uint32_t window);
+void kunmap_frame(uint32_t frame, uint32_t window);
 void * virtual2physical(page_directory_t *dir, void *virtual);
 
-// Copy from kernel buffer into user virtual address space
-// Returns 0 on success, -1 on failure
+// Copy from kernel buffer into user virtual address space.  The current
+// directory is accessed in place (see uaccess.h); any other goes through
+// the physical frames.  Returns 0 on success, negative on failure
 int copy_to_user(page_directory_t *dir, uint32_t user_vaddr, const void *src, size_t size);
 int copy_from_user(page_directory_t *dir, void *dst, uint32_t user_vaddr, size_t size);
 int strncpy_from_user(page_directory_t *dir, char *dst, uint32_t user_vaddr, size_t max);
+int clear_user(page_directory_t *dir, uint32_t user_vaddr, size_t size);
 
 // Copy a physical page into a new physical frame — returns new frame number
 // Used by fork's clone_page_directory
 uint32_t copy_page_frame(page_directory_t *src_dir, uint32_t src_vaddr);
 
+// Give 'page' (mapping vaddr in dir) a private writable frame if it is a COW share.
+// Returns 0 on success or if the page is not COW, -1 if out of memory.
+int cow_break(page_directory_t *dir, uint32_t vaddr, page_table_entry_t *page);
+
 void map_page_to_frame(page_table_entry_t *page, uint32_t frame, uint32_t flags);
+// Reserve [virtual_start, virtual_start + size) without backing frames; each
+// page gets a zeroed frame when first touched.  Already present pages are kept.
+void reserve_memory(page_directory_t *dir, uint32_t virtual_start, uint32_t size, uint32_t flags);
+// Back a lazily reserved page: reads map the shared zero frame, writes get a
+// zeroed frame of their own, and swapped out pages are read back in.
+// Returns 0 on success, -1 otherwise.
+int demand_page(uint32_t vaddr, page_table_entry_t *page, bool write);
 void map_memory(page_directory_t *dir, uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags);
 void kmap_memory(uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags);
+// Like kmap_memory, but 4MB-aligned stretches become single PSE entries when
+// the CPU supports it.  physical_start == -1 allocates 4MB blocks from the PMM.
+void kmap_large(uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags);
+
+// User 4MB pages.  virt must be 4MB-aligned with no page table behind it.
+// Every frame of the page is refcounted individually, so teardown and the
+// buddy allocator see the same thing as 1024 ordinary mappings.
+bool pse_supported(void);
+// PAT is present and entry 1 has been switched to write-combining
+bool pat_supported(void);
+// Map 4MB of existing frames shared (SHM); takes a reference on each frame
+bool map_huge_page(page_directory_t *dir, uint32_t virt, uint32_t phys, uint32_t flags);
+// Back virt with a freshly allocated, zeroed, private 4MB page
+bool alloc_huge_page(page_directory_t *dir, uint32_t virt, uint32_t flags);
+// Unmap the 4MB page at virt; false if virt is not covered by one
+bool free_huge_page(page_directory_t *dir, uint32_t virt);
+
+// Apply PAGE_RW / PAGE_USER to every mapped or reserved user page in
+// [start, end).  Pages still shared copy-on-write stay read-only until broken.
+void protect_memory(page_directory_t *dir, uint32_t start, uint32_t end, uint32_t flags);
 
 void debug_page_mapping(page_directory_t *dir, uint32_t virtual_address);
 void dump_page_directory(page_directory_t *dir);
@@ -0,0 +1,43 @@
+#pragma once
+
+/*
+ * pgtable.h — Frame allocator for paging structures.
+ *
+ * Page tables and page directories are built from whole PMM frames mapped
+ * into a dedicated kernel window, instead of being carved out of the kernel
+ * heap with kmalloc_aligned (which cost close to two pages per table).
+ * The window's own page tables are created at boot, so every address space
+ * shares them and a table allocated later is visible everywhere.
+ *
+ * Freed structures stay mapped on a small per-type pool so fork/exit churn
+ * recycles them without touching the PMM or the TLB.
+ */
+
+#include <stdint.h>
+#include "kernel/paging.h"
+
+#define PGTABLE_WINDOW_START 0xDC000000u
+#define PGTABLE_WINDOW_SIZE  (64 * 0x100000)
+#define PGTABLE_WINDOW_SLOTS (PGTABLE_WINDOW_SIZE / PAGE_SIZE)
+
+// Freed tables/directories kept mapped for reuse
+#define PGTABLE_POOL_MAX 64
+
+typedef struct {
+    uint32_t tables_in_use;
+    uint32_t dirs_in_use;
+    uint32_t pooled_tables;
+    uint32_t pooled_dirs;
+    uint32_t frames_mapped;     // window pages currently backed by a frame
+} pgtable_stats_t;
+
+// Create the window's page tables; must run before paging is enabled
+void pgtable_init(page_directory_t *kdir);
+
+// Zeroed page table / page directory, or NULL when out of frames or window space
+page_table_t *pgtable_alloc_table(void);
+void pgtable_free_table(page_table_t *table);
+page_directory_t *pgtable_alloc_dir(void);
+void pgtable_free_dir(page_directory_t *dir);
+
+void pgtable_get_stats(pgtable_stats_t *stats);
@@ -1,19 +1,51 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "kernel/multiboot.h"
 
 #define BLOCK_SIZE 4096
 #define BLOCKS_PER_BUCKET 8
-#define MAX_MEMORY (256 * 1024 * 1024) // Support up to 256MB of RAM
-#define MAX_FRAMES (MAX_MEMORY / BLOCK_SIZE) 
+// Frames are numbered across the physical address space the page tables can
+// reach (36 bits with PAE, else 32); RAM above it is ignored
+#ifdef CONFIG_PAE
+#define PMM_PHYS_LIMIT 0x1000000000ULL
+#else
+#define PMM_PHYS_LIMIT 0x100000000ULL
+#endif
+#define PMM_FRAMES_32BIT 0x100000   // first frame without a 32-bit address
+// For sizes in MB: byte counts of 4GB or more do not fit in 32 bits
+#define PMM_BLOCKS_PER_MB (0x100000 / BLOCK_SIZE)
+// Per-frame metadata is placed above the 4MB the boot page directory maps
+#define PMM_META_MIN_FRAME (0x400000 / BLOCK_SIZE)
 
 #define CEILDIV(a, b) ((a + b - 1) / b)
 
 #define SETBIT(i) bitmap[i / BLOCKS_PER_BUCKET] = bitmap[i / BLOCKS_PER_BUCKET] | (1 << (i % BLOCKS_PER_BUCKET))
 #define CLEARBIT(i) bitmap[i / BLOCKS_PER_BUCKET] = bitmap[i / BLOCKS_PER_BUCKET] & (~(1 << (i % BLOCKS_PER_BUCKET)))
 #define ISSET(i) ((bitmap[i / BLOCKS_PER_BUCKET] >> (i % BLOCKS_PER_BUCKET)) & 0x1)
-#define GET_BUCKET32(i) (*((uint32_t*) &bitmap[i / 32]))
+// The bitmap is also scanned a 32-frame word at a time
+#define FRAMES_PER_WORD 32
+
+// Buddy allocator: blocks of 2^order contiguous frames, up to 4MB
+#define PMM_MAX_ORDER 10
+#define PMM_NONE 0xFFFFFFFF
+#define PMM_NOT_FREE 0xFF
+// Refcount of a frame that is never freed, however many mappings drop it
+#define PMM_REF_PINNED 0xFFFF
+
+// Low: frames inside the kernel's direct map.  High: the rest below 4GB.
+// Highmem: above 4GB (PAE only), reachable through page tables alone.
+#define PMM_ZONE_LOW     0
+#define PMM_ZONE_HIGH    1
+#define PMM_ZONE_HIGHMEM 2
+#define PMM_ZONES        3
+
+// Free-frame watermarks, set from the free RAM at boot.  Below the low one
+// the pressure hook runs; background reclaim then works up to the high one.
+#define PMM_WMARK_LOW_SHARE 64      // low watermark: 1/64 of free RAM
+#define PMM_WMARK_MIN       32      // but never fewer frames than this
+#define PMM_RECLAIM_TRIES   4       // direct reclaim rounds before giving up
 
 #define BLOCK_ALIGN(addr) (((addr) & 0xFFFFF000) + 0x1000)
 
@@ -21,9 +53,44 @@ extern const uint32_t _kernel_start;
 extern const uint32_t _kernel_end;
 
 void pmm_mark_used(uint32_t base, uint32_t length);
-void pmm_init(struct multiboot_tag *mbd, uint32_t mem_size);
+// Size the allocator from the multiboot memory map; call before paging_init
+void pmm_init(struct multiboot_tag *mbd);
 uint32_t pmm_alloc_block();
+// Returns the first frame of 2^order physically contiguous frames, or 0
+uint32_t pmm_alloc_pages(uint32_t order);
+// Same, restricted to frames that phys_to_virt() can reach
+uint32_t pmm_alloc_low_pages(uint32_t order);
+uint32_t pmm_alloc_low_block(void);
+// Same, preferring frames above 4GB; for memory that is only ever reached
+// through PTEs (user pages), never by a 32-bit physical address
+uint32_t pmm_alloc_highmem_pages(uint32_t order);
+uint32_t pmm_alloc_highmem_block(void);
+// Any of the above by zone, without the out-of-memory message: for callers
+// that have a fallback (a smaller order, 4K pages) when it fails
+uint32_t pmm_try_alloc_pages(uint32_t zone, uint32_t order);
+void pmm_free_pages(uint32_t block, uint32_t order);
 uint32_t pmm_get_total_blocks(void);
+uint32_t pmm_get_free_blocks(void);
 void pmm_ref_frame(uint32_t block);
 void pmm_deref_frame(uint32_t block);
-void pmm_free_block(uint32_t block);
\ No newline at end of file
+void pmm_pin_frame(uint32_t block);
+void pmm_free_block(uint32_t block);
+uint16_t pmm_get_refcount(uint32_t block);
+// RAM the allocator hands out and refcounts.  Holes, reserved ranges and
+// device memory below the top of RAM (a framebuffer under 4GB with more
+// RAM above it) stay pinned and do not count.
+bool pmm_is_managed_frame(uint32_t block);
+
+// Called with no PMM lock held when an allocation of 'frames' frames finds
+// none free; returns how many frames it released.  The allocation is
+// retried after each round that freed something, PMM_RECLAIM_TRIES at most.
+typedef uint32_t (*pmm_reclaim_fn)(uint32_t frames);
+void pmm_set_reclaim_hook(pmm_reclaim_fn hook);
+
+// Called with no PMM lock held, possibly with interrupts off, after an
+// allocation leaves fewer free frames than the low watermark
+typedef void (*pmm_pressure_fn)(void);
+void pmm_set_pressure_hook(pmm_pressure_fn hook);
+void pmm_get_watermarks(uint32_t *low, uint32_t *high);
+// Free frames are below the low watermark
+bool pmm_memory_low(void);
\ No newline at end of file
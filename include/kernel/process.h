@@ -7,6 +7,7 @@
 #include "kernel/isr.h"
 #include "kernel/paging.h"
 #include "kernel/wait_queue.h"
+#include "kernel/vma.h"
 #include "common/signals.h"
 
 #define PROCESS_NAME_MAX_LEN 32
@@ -14,11 +15,14 @@
 #define MAX_OPEN_FILES 100
 
 #define PROCESS_STACK_SIZE 0x4000
-#define PROCESS_MAX_HEAP_SIZE 0x100000 // 1MB
+// Heap and user stacks are demand-zero, so large reservations only cost page tables
+#define PROCESS_MAX_HEAP_SIZE 0x10000000 // 256MB
+#define USER_STACK_SIZE 0x100000 // 1MB reserved per thread, lowest page left as a guard
 
 #define PROCESS_FLAG_USER 0x1
 #define PROCESS_FLAG_KERNEL 0x2
 #define MMAP_BASE 0x40000000
+#define MMAP_END  0x80000000    // SHM user window starts here
 #define NSIG 32
 
 typedef enum {
@@ -63,7 +67,7 @@ typedef struct process {
     
     void *heap_start;
     void *brk;
-    void *mmap_base;
+    vma_tree_t vmas;        // heap, stacks and mmap regions
     
     thread_t* main_thread;
     thread_t* thread_list;
@@ -78,6 +82,7 @@ typedef struct process {
     struct process* next;
 } process_t;
 
+void process_init();
 void scheduler_init();
 void schedule(registers_t* context);
 thread_t* pick_next_thread();
@@ -105,6 +110,8 @@ void jmp_to_kernel_thread(thread_t *context);
 void schedule_process_threads(process_t *process);
 
 thread_t* create_thread(process_t *proc, void (*entry_point)(), const char *thread_name);
+void thread_sleep(uint32_t ticks);
+void thread_wake_sleeper(thread_t *thread);
 void print_thread_list();
 
 void *sbrk(process_t *proc, int incr);
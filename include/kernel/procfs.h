@@ -0,0 +1,13 @@
+#pragma once
+
+/*
+ * procfs.h — Read-only process information, mounted at /PROC.
+ *
+ * /PROC/<pid>/MAPS lists the memory areas of a process, one per line,
+ * rendered fresh on every read.  /PROC/KSM holds the same-page merging
+ * counters, one "name value" pair per line.
+ */
+
+#include "kernel/vfs.h"
+
+vfs_superblock_t *procfs_mount(void);
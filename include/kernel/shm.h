@@ -26,11 +26,11 @@
  * Virtual-address slots.
  * Each slot is 4 MB wide, which fits a 1024×768×4-byte framebuffer (3 MB).
  *
- * Kernel backing:  0xC3400000 .. 0xD3400000  (just above the 48 MB heap)
+ * Kernel backing:  0xC7C00000 .. 0xD7C00000  (just above the 120 MB heap window)
  * User mapping:    0x80000000 .. 0x90000000  (well above heap, below stacks)
  */
 #define SHM_SLOT_SIZE     0x400000u         /* 4 MB per slot              */
-#define SHM_KERNEL_VBASE  0xC3400000u       /* kernel VA for SHM backing  */
+#define SHM_KERNEL_VBASE  0xC7C00000u       /* kernel VA for SHM backing  */
 #define SHM_USER_VBASE    0x80000000u       /* user   VA for SHM mappings */
 
 typedef struct {
@@ -40,13 +40,18 @@ typedef struct {
     uint32_t size;      /* byte size, page-aligned                       */
     int      ref_count; /* number of active shm_map() calls              */
     int      in_use;    /* 1 if this slot is allocated                   */
+    uint32_t huge_phys; /* base of a 4MB block (SHM_HUGE), else 0        */
 } shm_object_t;
 
 /* Initialise the SHM table – call once during kernel startup */
 void          shm_init(void);
 
-/* Allocate SHM backed by fresh physical pages; returns shm_id or -1 */
-int           shm_create(uint32_t size);
+/*
+ * Allocate SHM backed by fresh physical pages; returns shm_id or -1.
+ * SHM_HUGE asks for one physically contiguous 4MB page, mapped into users
+ * with a single PSE entry; it silently falls back to 4K pages.
+ */
+int           shm_create(uint32_t size, uint32_t flags);
 
 /*
  * Map SHM object into the *current* process's address space.
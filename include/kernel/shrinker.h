@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ * shrinker.h — Handing memory back when frames run low.
+ *
+ * A cache that holds frames it could do without registers a shrinker.
+ * When an allocation leaves fewer free frames than the PMM's low watermark,
+ * the kreclaimd thread is woken and calls the shrinkers, cheapest first,
+ * until free frames are back above the high watermark.  Allocations
+ * rarely find the PMM empty, so they rarely have to fail.
+ *
+ * An allocation that does find nothing free reclaims directly.  It may be
+ * made with any lock held (the heap's while it grows, a cache's while it
+ * adds a slab), so it only calls shrinkers flagged SHRINKER_DIRECT: the
+ * ones that take no lock an allocation might already hold.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SHRINKER_DIRECT  0x1    // safe to call from inside any allocation
+
+// Cost of getting frames back, lowest first
+#define SHRINK_COST_FREE 0      // frames sitting idle in a cache
+#define SHRINK_COST_IO   2      // contents must be written out first
+
+#define KRECLAIMD_INTERVAL 100  // ticks between checks when not woken (1s)
+#define KRECLAIMD_BACKOFF  50   // ticks to ignore wakeups after finding nothing
+
+typedef struct shrinker {
+    const char *name;
+    // Free up to 'frames' frames; returns how many it freed
+    uint32_t (*scan)(uint32_t frames);
+    uint32_t cost;
+    uint32_t flags;
+    uint32_t freed;             // frames given back in total
+    struct shrinker *next;
+} shrinker_t;
+
+typedef struct {
+    uint32_t wakeups;           // kreclaimd runs below the low watermark
+    uint32_t reclaimed;         // frames kreclaimd got back
+    uint32_t direct;            // direct reclaim rounds, run by allocations
+    uint32_t direct_reclaimed;  // frames those got back
+} reclaim_stats_t;
+
+// Add a shrinker; its cost decides where it goes in the calling order
+void register_shrinker(shrinker_t *shrinker);
+void unregister_shrinker(shrinker_t *shrinker);
+
+// Call shrinkers until 'frames' frames are freed or none has more to give;
+// with 'direct', only SHRINKER_DIRECT ones.  Returns the frames freed.
+uint32_t shrink_memory(uint32_t frames, bool direct);
+
+// Start kreclaimd and have the PMM wake it; needs the scheduler
+void reclaim_init(void);
+
+void reclaim_get_stats(reclaim_stats_t *stats);
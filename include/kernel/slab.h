@@ -0,0 +1,73 @@
+#pragma once
+
+/*
+ * slab.h — Object caches for fixed-size kernel structures.
+ *
+ * Each cache hands out objects of one size from "slabs": naturally aligned
+ * chunks of memory carved into equal slots, with the slab header stored at
+ * the start of the chunk.  Freeing an object finds its slab by masking the
+ * address, so both alloc and free are O(1) and never touch the kheap free
+ * list once a cache has warmed up.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel/locks.h"
+
+#define KMEM_CACHE_NAME_LEN 24
+#define KMEM_MIN_OBJS_PER_SLAB 8
+
+struct kmem_cache;
+
+typedef struct kmem_slab {
+    struct kmem_cache *cache;
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+    void *free_list;            // singly linked list threaded through free objects
+    uint32_t in_use;            // objects currently handed out from this slab
+} kmem_slab_t;
+
+typedef struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LEN];
+    size_t obj_size;            // slot size (object size rounded up to align)
+    size_t align;
+    size_t slab_size;           // bytes per slab, power of two >= PAGE_SIZE
+    uint32_t objs_per_slab;
+    void (*ctor)(void *obj);    // run on each object as it is handed out
+
+    kmem_slab_t *partial;       // slabs with free and used objects
+    kmem_slab_t *full;          // slabs with no free objects
+    kmem_slab_t *empty;         // at most one cached slab with every object free
+
+    uint32_t num_slabs;
+    uint32_t objs_in_use;
+    uint32_t total_allocs;
+
+    spinlock_t lock;
+    struct kmem_cache *next;    // global cache list (for stats)
+} kmem_cache_t;
+
+typedef struct {
+    const char *name;
+    uint32_t obj_size;
+    uint32_t objs_in_use;
+    uint32_t objs_total;        // capacity of all slabs
+    uint32_t num_slabs;
+    uint32_t slab_size;
+    uint32_t waste;             // bytes reserved by slabs but not holding live objects
+} kmem_cache_stats_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *));
+void kmem_cache_destroy(kmem_cache_t *cache);
+
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void *kmem_cache_zalloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// Release every cached empty slab back to the heap; returns bytes released
+size_t kmem_cache_shrink(kmem_cache_t *cache);
+// Same for every cache
+size_t kmem_cache_shrink_all(void);
+
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats);
+void print_slab_info(void);
@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * swap.h — Paging anonymous user memory out to a block device.
+ *
+ * When frames run low the reclaim code calls swap_reclaim().  A CLOCK hand
+ * sweeps the user page tables of every process: a page whose accessed bit
+ * is set has it cleared and gets a second chance, a page still unreferenced
+ * when the hand comes round again is written to a free swap slot and its
+ * frame freed.  The PTE stays non-present with lazy set and the swap entry
+ * in its frame field, so the next touch faults and swap_in() reads it back.
+ *
+ * Only private pages with a single owner are evicted: shared mappings, COW
+ * shares, the zero frame and large pages stay resident.
+ *
+ * Up to SWAP_MAX_AREAS devices prepared with mkswap (or swap_format) are
+ * used, filled in the order they were added: zram first, then the disk.
+ * A swap entry is area * SWAP_MAX_SLOTS + slot.  The first page of each
+ * area (the header) is never a slot, so an entry is never 0.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/paging.h"
+
+#define SWAP_DEVICE        "/dev/sdb"     // primary slave, see 'make run'
+#define SWAP_SECTOR_SIZE   512
+#define SWAP_PAGE_SECTORS  (PAGE_SIZE / SWAP_SECTOR_SIZE)
+#define SWAP_MAX_SLOTS     16384          // 64MB per area at most
+#define SWAP_MAX_AREAS     2
+#define SWAP_CLUSTER       16             // pages evicted per reclaim, at least
+#define SWAP_MAGIC         "SWAPSPACE2"   // mkswap signature at the end of page 0
+
+typedef struct {
+    uint32_t slots;         // usable slots in all areas
+    uint32_t used;          // slots holding a page
+    uint32_t swapped_out;   // pages written out
+    uint32_t swapped_in;    // pages read back
+    uint32_t scanned;       // PTEs visited by the clock hand
+} swap_stats_t;
+
+// A swap PTE: not present, lazy, and an entry in the frame field
+static inline bool pte_is_swap(const page_table_entry_t *page) {
+    return !page->present && page->lazy && page->frame != 0;
+}
+
+// Add 'device' (a block device name) as a swap area; false if it is
+// missing or has no swap signature
+bool swap_on(const char *device);
+// Write a swap signature to 'device', like mkswap
+bool swap_format(const char *device);
+bool swap_enabled(void);
+
+// Evict at least SWAP_CLUSTER cold user pages (or 'frames', if more) from
+// all processes; returns the number of frames freed.  swap_on registers it
+// as a shrinker.
+uint32_t swap_reclaim(uint32_t frames);
+
+// Write the page at vaddr in dir out now, whatever its accessed bit says.
+// 0 on success, -1 if it cannot be swapped (see above) or swap is full.
+int swap_out(page_directory_t *dir, uint32_t vaddr);
+
+// Read the page behind a swap entry into a new frame and map it again
+int swap_in(uint32_t vaddr, page_table_entry_t *page);
+
+// A swap entry was copied (fork) or dropped (unmap, exit)
+void swap_dup(page_table_entry_t *page);
+void swap_free(page_table_entry_t *page);
+
+void swap_get_stats(swap_stats_t *out);
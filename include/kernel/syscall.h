@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <common/syscall.h>
 
+#define EFAULT 14
 #define EINVAL 22
 
 typedef int (*syscall_t)(uint32_t, uint32_t, uint32_t);
@@ -13,4 +13,43 @@
         kprintf(ERROR, "ASSERT FAILED: %s in %s(), at %s:%d\n", #cond, __func__, __FILE__, __LINE__); \
         asm volatile ("cli; hlt"); \
     } \
-} while (0)
\ No newline at end of file
+} while (0)
+
+#define CPUID_EDX_PSE   (1 << 3)
+#define CPUID_EDX_PGE   (1 << 13)
+#define CPUID_EDX_PAT   (1 << 16)
+
+#define CR4_PSE         0x10
+#define CR4_PGE         0x80
+
+#define MSR_IA32_PAT    0x277
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf));
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint32_t cr4) {
+    asm volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
@@ -4,6 +4,23 @@
 
 void test_divide_by_zero();
 void test_heap();
+void test_heap_stress();
+void test_slab();
+void test_buddy();
+void test_pmm_zones();
+void test_pgtable();
+void test_uaccess_bench();
+void test_tlb_bench();
+void test_tlb_gather();
+void test_large_pages();
+void test_kheap_grow();
+void test_vmalloc();
+void test_fb_wc();
+void test_swap();
+void test_swap_cow();
+void test_zram();
+void test_ksm();
+void test_reclaim();
 void test_string();
 void test_printf();
 void test_scheduler();
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ * tlb.h — Batched TLB invalidation for range operations (mmu_gather).
+ *
+ * Code that tears down many mappings clears the entries, records each
+ * address and each frame here, and calls tlb_finish() once at the end.
+ * The flush is then a few invlpg instructions for small ranges or a single
+ * full flush for large ones, and frames go back to the allocator only after
+ * no stale TLB entry can still reach them.
+ *
+ * Entries of an address space that is not loaded are not in the TLB, so
+ * nothing is invalidated for them; kernel mappings are global and are
+ * always flushed.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/paging.h"
+
+#define TLB_GATHER_PAGES    32  // beyond this many pages a full flush is cheaper
+#define TLB_GATHER_FRAMES   256 // 4K frames held back before an early flush
+#define TLB_GATHER_HUGE     8   // large pages held back before an early flush
+
+typedef struct {
+    page_directory_t *dir;          // address space the entries belong to
+    bool global;                    // kernel half: survives CR3 reloads
+    bool flush_all;                 // too many pages to invlpg one by one
+    uint32_t nr_pages;
+    uint32_t pages[TLB_GATHER_PAGES];
+    uint32_t nr_frames;
+    uint32_t frames[TLB_GATHER_FRAMES];
+    uint32_t nr_huge;
+    uint32_t huge[TLB_GATHER_HUGE]; // first frame of each large page
+} tlb_gather_t;
+
+typedef struct {
+    uint32_t page_flushes;          // invlpg issued by gathers
+    uint32_t full_flushes;          // CR3 reloads / global flushes instead
+    uint32_t skipped;               // gathers on an address space not loaded
+} tlb_stats_t;
+
+void tlb_gather_init(tlb_gather_t *tlb, page_directory_t *dir);
+// A PTE/PDE for vaddr was changed or cleared
+void tlb_gather_page(tlb_gather_t *tlb, uint32_t vaddr);
+// Release a frame once the TLB no longer maps it
+void tlb_gather_frame(tlb_gather_t *tlb, uint32_t frame);
+// Flush what was gathered and free the held frames; the gather stays usable
+void tlb_finish(tlb_gather_t *tlb);
+
+// Clear a PTE (present or merely reserved) and queue its flush and frame
+void tlb_unmap_page(tlb_gather_t *tlb, uint32_t vaddr, page_table_entry_t *page);
+// Same for the user large page at virt in tlb->dir; false if there is none
+bool tlb_unmap_huge(tlb_gather_t *tlb, uint32_t virt);
+
+// Whole-TLB flushes: non-global entries, or everything including global ones
+void flush_tlb(void);
+void flush_tlb_global(void);
+
+void tlb_get_stats(tlb_stats_t *stats);
@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+ * uaccess.h — Direct, fault-tolerant access to the current process's memory.
+ *
+ * User pages are mapped in the active page directory, so syscalls can read
+ * and write user buffers in place instead of remapping each frame.  Every
+ * instruction that may touch a user address is listed in the __ex_table
+ * section together with a fixup address.  When such an instruction faults
+ * and the fault is not a demand-zero or COW fault that can be resolved,
+ * page_fault_handler resumes at the fixup, and the primitive returns
+ * -EFAULT instead of the kernel halting.
+ *
+ * These only work on the current address space.  Use copy_to_user() and
+ * friends with an explicit directory for any other (exec, ELF loading).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "kernel/system.h"
+#include "kernel/syscall.h"
+
+typedef struct {
+    uint32_t insn;      // instruction allowed to fault on a user address
+    uint32_t fixup;     // where execution resumes when it does
+} exception_table_entry_t;
+
+// Fixup address for a faulting kernel eip, or 0 if it has none
+uint32_t search_exception_table(uint32_t eip);
+
+// True if [uptr, uptr + size) lies entirely below the kernel
+static inline bool access_ok(const void *uptr, size_t size) {
+    uint32_t addr = (uint32_t)uptr;
+    return addr + size >= addr && addr + size <= LOAD_MEMORY_ADDRESS;
+}
+
+// Record the preceding "1:" label as allowed to fault, resuming at "3:"
+#define __UACCESS_FIXUP(fixup_code)                 \
+    "2:\n"                                          \
+    ".section .fixup, \"ax\"\n"                     \
+    "3: " fixup_code "\n"                           \
+    "   jmp 2b\n"                                   \
+    ".previous\n"                                   \
+    ".section __ex_table, \"a\"\n"                  \
+    "   .long 1b, 3b\n"                             \
+    ".previous\n"
+
+#define __get_user_asm(insn, val, uptr, err)                            \
+    asm volatile("1: " insn " %[mem], %[v]\n"                           \
+                 __UACCESS_FIXUP("movl %[efault], %[e]")                \
+                 : [e] "+r"(err), [v] "=r"(val)                         \
+                 : [mem] "m"(*(uptr)), [efault] "i"(-EFAULT))
+
+#define __put_user_asm(insn, val, uptr, err, cons)                      \
+    asm volatile("1: " insn " %[v], %[mem]\n"                           \
+                 __UACCESS_FIXUP("movl %[efault], %[e]")                \
+                 : [e] "+r"(err), [mem] "=m"(*(uptr))                   \
+                 : [v] cons(val), [efault] "i"(-EFAULT))
+
+/*
+ * Read/write one 1, 2 or 4 byte value at a user address without a range
+ * check.  Evaluate to 0 or -EFAULT; a failed read stores 0 in x.
+ */
+#define __get_user(x, ptr) ({                                                           \
+    int __gu_err = 0;                                                                   \
+    uint32_t __gu_val;                                                                  \
+    switch (sizeof(*(ptr))) {                                                           \
+    case 1: __get_user_asm("movzbl", __gu_val, (ptr), __gu_err); break;                 \
+    case 2: __get_user_asm("movzwl", __gu_val, (ptr), __gu_err); break;                 \
+    default: __get_user_asm("movl", __gu_val, (ptr), __gu_err); break;                  \
+    }                                                                                   \
+    (x) = (__typeof__(*(ptr)))(__gu_err ? 0 : __gu_val);                                \
+    __gu_err;                                                                           \
+})
+
+#define __put_user(x, ptr) ({                                                           \
+    int __pu_err = 0;                                                                   \
+    uint32_t __pu_val = (uint32_t)(x);                                                  \
+    switch (sizeof(*(ptr))) {                                                           \
+    case 1: __put_user_asm("movb", (uint8_t)__pu_val, (ptr), __pu_err, "q"); break;     \
+    case 2: __put_user_asm("movw", (uint16_t)__pu_val, (ptr), __pu_err, "r"); break;    \
+    default: __put_user_asm("movl", __pu_val, (ptr), __pu_err, "r"); break;             \
+    }                                                                                   \
+    __pu_err;                                                                           \
+})
+
+// Range-checked variants for pointers straight from a syscall
+#define get_user(x, ptr) \
+    (access_ok((ptr), sizeof(*(ptr))) ? __get_user(x, ptr) : ((x) = 0, -EFAULT))
+#define put_user(x, ptr) \
+    (access_ok((ptr), sizeof(*(ptr))) ? __put_user(x, ptr) : -EFAULT)
+
+// Bulk copies against the current address space: 0 or -EFAULT
+int __copy_to_user(void *udst, const void *src, size_t size);
+int __copy_from_user(void *dst, const void *usrc, size_t size);
+int __clear_user(void *udst, size_t size);
+
+// Length of the copied string (truncated to max - 1), or -EFAULT
+int __strncpy_from_user(char *dst, const char *usrc, size_t max);
+
+// Touch every page of a user buffer before handing it to code without
+// fixups (file ops), resolving demand-zero/COW faults up front
+int fault_in_user(void *uptr, size_t size, bool write);
@@ -108,6 +108,12 @@ typedef struct block_device {
     int (*read_block)(struct block_device *dev, uint32_t block, void *buf);
     int (*write_block)(struct block_device *dev, uint32_t block, const void *buf);
     void *device_data;  // Device-specific data (e.g., file descriptor or memory pointer)
+    uint32_t block_count;   // size in 512-byte blocks, 0 if unknown
+    // Optional, may be NULL: transfer 'count' consecutive blocks in one call,
+    // and drop blocks whose contents are no longer needed
+    int (*read_blocks)(struct block_device *dev, uint32_t block, uint32_t count, void *buf);
+    int (*write_blocks)(struct block_device *dev, uint32_t block, uint32_t count, const void *buf);
+    void (*discard)(struct block_device *dev, uint32_t block, uint32_t count);
 } block_device_t;
 
 typedef struct vfs_superblock {
@@ -128,6 +134,11 @@ typedef struct {
 } vfs_fs_type_t;
 
 
+vfs_inode_t *vfs_alloc_inode();
+void vfs_free_inode(vfs_inode_t *inode);
+vfs_file_t *vfs_alloc_file();
+void vfs_free_file(vfs_file_t *file);
+
 vfs_file_t *vfs_get_file(int fd);
 block_device_t *get_block_device(const char *path);
 int register_block_device(block_device_t *dev);
@@ -144,6 +155,9 @@ int vfs_close(vfs_file_t *file);
 
 int vfs_write(vfs_file_t *file, const void *buf, size_t count);
 int vfs_read(vfs_file_t *file, void *buf, size_t count);
+// Positional I/O on a regular file; leaves file->offset alone
+int vfs_pread(vfs_file_t *file, void *buf, size_t count, uint32_t offset);
+int vfs_pwrite(vfs_file_t *file, const void *buf, size_t count, uint32_t offset);
 
 int vfs_rename(const char *oldpath, const char *newpath);
 int vfs_seek(vfs_file_t *file, uint32_t offset, int whence);
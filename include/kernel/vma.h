@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+ * vma.h — Per-process virtual memory areas.
+ *
+ * Each process records the user ranges it has mapped (heap, stacks, mmap
+ * regions) as non-overlapping, page-aligned areas.  A file-backed area
+ * holds a reference on its open file for as long as it exists.  They are kept in an
+ * AVL tree keyed by start address for O(log n) lookups, and threaded on a
+ * sorted list so neighbours can be merged and gaps walked in order.
+ *
+ * The page tables stay the source of truth for what is resident; areas are
+ * what mmap searches for free space, what munmap/mprotect split, and what
+ * /PROC/<pid>/MAPS reports.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "kernel/vfs.h"
+
+#define VMA_HEAP    0x1     // the brk heap
+#define VMA_STACK   0x2     // a thread's user stack
+#define VMA_HUGE    0x4     // backed by 4MB pages where possible
+#define VMA_SHARED  0x8     // MAP_SHARED: writes go back to the file
+
+typedef struct vma {
+    uint32_t start;             // first address, page aligned
+    uint32_t end;               // one past the last address, page aligned
+    uint32_t prot;              // PROT_* bits
+    uint32_t flags;             // VMA_* bits
+    vfs_file_t *file;           // backing file, or NULL for anonymous memory
+    uint32_t offset;            // file offset of 'start'
+
+    int height;                 // AVL subtree height
+    struct vma *left, *right;
+    struct vma *prev, *next;    // address order
+} vma_t;
+
+typedef struct {
+    vma_t *root;
+    vma_t *first;
+    uint32_t count;
+} vma_tree_t;
+
+void vma_init(vma_tree_t *tree);
+void vma_destroy(vma_tree_t *tree);
+// Duplicate src into an empty tree (fork); -1 and dst left empty on failure
+int vma_copy(vma_tree_t *dst, const vma_tree_t *src);
+
+// The area containing addr, or NULL
+vma_t *vma_find(vma_tree_t *tree, uint32_t addr);
+bool vma_range_free(vma_tree_t *tree, uint32_t start, uint32_t end);
+
+// Record [start, end) as mapped; fails if any part already is.  Merges with
+// neighbours that have the same protection and flags (and continue the
+// same file).
+int vma_map(vma_tree_t *tree, uint32_t start, uint32_t end, uint32_t prot, uint32_t flags);
+// Same, backed by 'file' from 'offset' on; takes a reference on the file
+int vma_map_file(vma_tree_t *tree, uint32_t start, uint32_t end, uint32_t prot,
+                 uint32_t flags, vfs_file_t *file, uint32_t offset);
+// Forget [start, end), splitting areas that straddle its edges
+int vma_unmap(vma_tree_t *tree, uint32_t start, uint32_t end);
+// Change the protection of [start, end); -1 unless it is entirely mapped
+int vma_protect(vma_tree_t *tree, uint32_t start, uint32_t end, uint32_t prot);
+
+// Lowest 'align'-aligned start of a free 'size' byte gap in [low, high), or 0
+uint32_t vma_find_gap(vma_tree_t *tree, uint32_t size, uint32_t align, uint32_t low, uint32_t high);
+
+// Upper bound on one vma_format() line
+#define VMA_FORMAT_LINE 48
+
+// One line per area, /proc/<pid>/maps style; returns the length written
+int vma_format(vma_tree_t *tree, char *buf, size_t size);
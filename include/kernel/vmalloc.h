@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * vmalloc.h — Virtually contiguous kernel allocations.
+ *
+ * Large buffers (backbuffers, cluster and pipe buffers) are built from
+ * individually allocated PMM frames mapped into a dedicated kernel window,
+ * so they neither need nor fragment contiguous kernel heap.  Every area is
+ * followed by an unmapped guard page, and the page below the first area is
+ * unmapped too, so running off either end of a buffer faults instead of
+ * corrupting a neighbour.
+ *
+ * Like the pgtable window, the window's page tables are created at boot and
+ * shared by every address space.  The memory is not physically contiguous:
+ * do not hand it to a device as a DMA buffer.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "kernel/paging.h"
+
+#define VMALLOC_START 0xD8000000u
+#define VMALLOC_SIZE  (64 * 0x100000)
+#define VMALLOC_PAGES (VMALLOC_SIZE / PAGE_SIZE)
+
+// kvmalloc sends requests larger than this to vmalloc.  A single page gains
+// nothing from it and would cost a guard page, a TLB entry and a shootdown
+// on free, so one-page buffers (4KB clusters) stay in the heap.
+#define KVMALLOC_THRESHOLD PAGE_SIZE
+
+typedef struct {
+    uint32_t areas;             // live vmalloc areas
+    uint32_t pages_mapped;      // frames currently backing them
+    uint32_t failures;          // requests that found no window space or frames
+} vmalloc_stats_t;
+
+// Create the window's page tables; must run before any directory is cloned
+void vmalloc_init(page_directory_t *kdir);
+
+// Page-granular, zeroed allocation; NULL when out of window space or frames
+void *vmalloc(size_t size);
+void vfree(void *addr);
+
+static inline bool is_vmalloc_addr(const void *addr) {
+    return (uint32_t)addr >= VMALLOC_START && (uint32_t)addr < VMALLOC_START + VMALLOC_SIZE;
+}
+
+// vmalloc for large sizes, kmalloc for the rest; free either with kvfree
+void *kvmalloc(size_t size);
+void kvfree(void *addr);
+
+void vmalloc_get_stats(vmalloc_stats_t *stats);
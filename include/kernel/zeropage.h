@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * zeropage.h — Shared zero frame and a pool of pre-zeroed frames.
+ *
+ * A read of untouched anonymous memory maps the single, pinned zero frame
+ * read-only instead of allocating; the first write breaks it like a COW
+ * share.  Frames that must start out zeroed come from a small pool that
+ * the idle loop refills in the background, so a burst of faults does not
+ * pay for the memsets inline.
+ *
+ * Those frames back user memory, which is only reached through PTEs, so
+ * they come from highmem first and are zeroed through kmap_frame.  The
+ * direct-mapped low zone is left to callers that need phys_to_virt().
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ZERO_POOL_MAX   64      // pre-zeroed frames kept in reserve
+#define ZERO_POOL_BATCH 8       // frames zeroed per idle pass
+
+typedef struct {
+    uint32_t pooled;            // frames currently in the pool
+    uint32_t hits;              // allocations served from the pool
+    uint32_t misses;            // allocations that had to zero inline
+    uint32_t refilled;          // frames zeroed by the idle loop
+} zero_pool_stats_t;
+
+extern uint32_t zero_frame;
+
+// Allocate and pin the zero frame; needs the direct map
+void zero_page_init(void);
+
+static inline bool is_zero_frame(uint32_t frame) {
+    return frame == zero_frame;
+}
+
+// A zeroed frame (refcount 1), or 0 when out of memory
+uint32_t alloc_zeroed_frame(void);
+
+// Top the pool up by at most ZERO_POOL_BATCH frames; called when idle
+void zero_pool_refill(void);
+
+void zero_pool_get_stats(zero_pool_stats_t *stats);
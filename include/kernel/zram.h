@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * zram.h — Compressed RAM block device.
+ *
+ * /dev/zram0 stores each 4KB page written to it LZ4-compressed in a
+ * zsmalloc pool, and is used as the first swap area, so cold pages cost a
+ * fraction of a frame instead of a trip to the PIO disk.  Pages that are one
+ * 32-bit value repeated (zeroed memory, solid-colour pixel buffers) are
+ * kept as just that value.  Pages that do not compress below ZS_MAX_SIZE
+ * keep a frame of their own.
+ *
+ * Whole, page-aligned transfers (what swap issues) go straight through;
+ * single sectors are read-modify-write on the page that holds them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ZRAM_DEVICE     "/dev/zram0"
+#define ZRAM_RAM_SHARE  4       // disk size: a quarter of RAM, uncompressed
+
+typedef struct {
+    uint32_t disk_pages;        // capacity in pages
+    uint32_t pages_stored;      // pages holding data
+    uint32_t same_pages;        // kept as a single repeated value
+    uint32_t huge_pages;        // incompressible, kept uncompressed
+    uint32_t compr_bytes;       // compressed size of the rest
+    uint32_t pool_frames;       // frames used by the zsmalloc pool
+    uint32_t mem_used_frames;   // pool plus huge pages: the real RAM cost
+} zram_stats_t;
+
+// Create and register /dev/zram0 with room for 'pages' pages
+bool zram_init(uint32_t pages);
+
+void zram_get_stats(zram_stats_t *stats);
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * zsmalloc.h — Densely packed storage for variable-sized objects
+ * (compressed pages).
+ *
+ * Sizes are rounded up to a multiple of ZS_ALIGN and each size class packs
+ * its objects into "zspages": naturally aligned runs of 1 to
+ * 2^ZS_MAX_ZSPAGE_ORDER direct-mapped frames with a small header at the
+ * start.  Objects may straddle the frames of a zspage, and each class uses
+ * the zspage length that leaves the least slack, so a 1100-byte object
+ * costs 1120 bytes rather than the 2048 a power-of-two allocator would
+ * charge.  Empty zspages go straight back to the PMM.
+ *
+ * A handle is the object's physical address with the zspage's order in
+ * the low bits, which is enough to find the header again on free.
+ */
+
+#include <stdint.h>
+#include "kernel/paging.h"
+
+#define ZS_ALIGN            32
+#define ZS_MAX_SIZE         (PAGE_SIZE * 3 / 4)     // larger objects save too little to pack
+#define ZS_CLASSES          (ZS_MAX_SIZE / ZS_ALIGN)
+#define ZS_MAX_ZSPAGE_ORDER 2
+
+typedef uint32_t zs_handle_t;       // 0 is never a valid handle
+
+typedef struct {
+    uint32_t objects;       // live objects
+    uint32_t zspages;       // zspages holding them
+    uint32_t frames;        // frames those zspages take up
+} zs_stats_t;
+
+typedef struct zs_pool zs_pool_t;
+
+zs_pool_t *zs_create_pool(void);
+// Room for 'size' bytes (at most ZS_MAX_SIZE), or 0 when out of memory
+zs_handle_t zs_malloc(zs_pool_t *pool, uint32_t size);
+void zs_free(zs_pool_t *pool, zs_handle_t handle);
+// Kernel address of an object; valid until it is freed
+void *zs_map(zs_handle_t handle);
+
+void zs_get_stats(zs_pool_t *pool, zs_stats_t *stats);
@@ -40,9 +40,11 @@ int syscall_fstat(int fd, stat_t *buf);
 int syscall_stat(const char *path, stat_t *buf);
 void *syscall_mmap(void *addr, uint32_t length, int prot, int flags, int fd, uint32_t offset);
 void *syscall_munmap(void *addr, size_t length);
+int syscall_mprotect(void *addr, size_t length, int prot);
+int syscall_msync(void *addr, size_t length, int flags);
 
 /* --- Shared-memory & framebuffer (compositor clients) --- */
-int   syscall_shm_create(uint32_t size);
+int   syscall_shm_create(uint32_t size, uint32_t flags);
 void *syscall_shm_map(int shm_id);
 int   syscall_shm_unmap(int shm_id);
 int   syscall_shm_destroy(int shm_id);
@@ -14,11 +14,21 @@
 #include "kernel/kheap.h"
 #include "kernel/gdt.h"
 #include "kernel/signals.h"
+#include "kernel/uaccess.h"
+#include "kernel/filemap.h"
+#include "kernel/tlb.h"
 
 extern struct tss_entry tss_entry;
 extern thread_t *current_thread;
 static registers_t *interrupt_frame;
 
+// Copy a path argument into 'kpath' (256 bytes); 0 or -EFAULT
+static int get_user_path(const char *upath, char *kpath) {
+    if (!upath) return -EFAULT;
+    int len = __strncpy_from_user(kpath, upath, 256);
+    return len < 0 ? len : 0;
+}
+
 static char **copy_user_str_array(process_t *proc, char **u_arr, int *out_count) {
     if (out_count) *out_count = 0;
     if (!u_arr) return NULL;
@@ -26,7 +36,7 @@ static char **copy_user_str_array(process_t *proc, char **u_arr, int *out_count)
     int count = 0;
     while (1) {
         uint32_t uptr = 0;
-        copy_from_user(proc->root_page_table, &uptr, (uint32_t)(u_arr + count), sizeof(uint32_t));
+        if (copy_from_user(proc->root_page_table, &uptr, (uint32_t)(u_arr + count), sizeof(uint32_t)) < 0) return NULL;
         if (!uptr) break;
         count++;
         if (count > 256) return NULL;
@@ -44,7 +54,7 @@ static char **copy_user_str_array(process_t *proc, char **u_arr, int *out_count)
             kfree(k_arr);
             return NULL;
         }
-        strncpy_from_user(proc->root_page_table, s, uptr, 256);
+        if (strncpy_from_user(proc->root_page_table, s, uptr, 256) < 0) s[0] = '\0';
         k_arr[i] = s;
     }
     k_arr[count] = NULL;
@@ -53,12 +63,15 @@ static char **copy_user_str_array(process_t *proc, char **u_arr, int *out_count)
 }
 
 // --- File operations ---
+// File ops read and write the user buffer in place, without fixups, so
+// its pages are faulted in (or rejected) before the call
 int sys_read(int fd, void *buffer, size_t size) {
     if (!buffer) return -1;
     // printf("sys_read: fd=%d, size=%d\n", fd, size);
     process_t *proc = get_current_process();
     vfs_file_t* file = proc->fds[fd];
     if (!file || !file->file_ops) return -1;
+    if (fault_in_user(buffer, size, true) < 0) return -EFAULT;
     return file->file_ops->read(file, buffer, size);
 }
 
@@ -67,14 +80,16 @@ int sys_write(int fd, const char *buffer, size_t size) {
     process_t *proc = get_current_process();
     vfs_file_t* file = proc->fds[fd];
     if (!file) return -1;
+    if (fault_in_user((void *)buffer, size, false) < 0) return -EFAULT;
     return file->file_ops->write(file, buffer, size);
 }
 
 int sys_open(const char *path, int flags) {
-    if (!path) return -1;
+    char kpath[256];
+    if (get_user_path(path, kpath) < 0) return -EFAULT;
     process_t *proc = get_current_process();
     char resolved_path[256];
-    if (!vfs_relative_path(proc->cwd, path, resolved_path)) return -1;
+    if (!vfs_relative_path(proc->cwd, kpath, resolved_path)) return -1;
     
     vfs_file_t* file = vfs_open(resolved_path, flags);
     if (!file) return -1;
@@ -127,7 +142,7 @@ int sys_waitpid(int pid, int *status, int options) {
             child = find_zombie_child(proc);
         }
 
-        if (status) *status = child->exit_code;
+        if (status && put_user(child->exit_code, status) < 0) return -EFAULT;
         int child_pid = child->pid;
         cleanup_process(child);
         return child_pid;
@@ -150,7 +165,7 @@ int sys_waitpid(int pid, int *status, int options) {
     }
 
     kprintf(DEBUG, "[%d] Cleaning up child process %d...\n", proc->pid, pid);
-    if (status) *status = child->exit_code;
+    if (status && put_user(child->exit_code, status) < 0) return -EFAULT;
     cleanup_process(child);
     return pid;
 }
@@ -201,15 +216,18 @@ int sys_exec(const char *path, char **argv, char **envp) {
     return ret;
 }
 
-int sys_set_thread_area(user_desc_t *desc) {
-    if (!desc) return -1;
+int sys_set_thread_area(user_desc_t *udesc) {
+    if (!udesc) return -1;
+    user_desc_t desc;
+    if (__copy_from_user(&desc, udesc, sizeof(desc)) < 0) return -EFAULT;
 
     // musl passes entry_number = -1 to request allocation
-    if (desc->entry_number == -1) {
-        desc->entry_number = 6; // We only have one TLS segment, so just use that
+    if (desc.entry_number == -1) {
+        desc.entry_number = 6; // We only have one TLS segment, so just use that
+        if (put_user(desc.entry_number, &udesc->entry_number) < 0) return -EFAULT;
     }
 
-    gdt_set_tls(desc->base_addr, desc->limit);
+    gdt_set_tls(desc.base_addr, desc.limit);
     uint16_t selector = (GDT_TLS << 3) | 3;
     asm volatile("mov %0, %%gs" :: "r"(selector));
     current_thread->gs = selector;
@@ -222,12 +240,9 @@ int sys_set_tid_address(int *tidptr) {
     return current_thread->tid; // Return TID as syscall result for testing purposes
 }
 
-int sys_mprotect(void *addr, size_t len, int prot) {
-    return 0; // TODO: implement
-}
-
 // --- Directory and file system ---
 int sys_getdents(int fd, linux_dirent_t *dirp, int count) {
+    if (count > 0 && fault_in_user(dirp, count, true) < 0) return -EFAULT;
     return vfs_getdents(fd, dirp, count);
 }
 
@@ -238,6 +253,7 @@ int sys_getdents64(int fd, void *dirp, int count) {
     if (fd < 0 || fd >= MAX_OPEN_FILES || !file) return -1;
 
     if (file->inode->mode != VFS_MODE_DIR) return -1;
+    if (fault_in_user(dirp, count, true) < 0) return -EFAULT;
 
     int bytes_written = 0;
     uint32_t offset = file->offset;
@@ -379,47 +395,52 @@ int sys_readlink(const char *path, char *buf, size_t bufsiz) {
 }
 
 int sys_chdir(const char *path) {
-    if (!path) return -1;
+    char kpath[256];
+    if (get_user_path(path, kpath) < 0) return -EFAULT;
 
     process_t *proc = get_current_process();
     char resolved_path[256];
-    if (!vfs_relative_path(proc->cwd, path, resolved_path)) return -1;
+    if (!vfs_relative_path(proc->cwd, kpath, resolved_path)) return -1;
 
     strncpy(proc->cwd, resolved_path, sizeof(proc->cwd));
     return 0;
 }
 
 int sys_mkdir(const char *path, int mode) {
-    if (!path) return -1;
+    char kpath[256];
+    if (get_user_path(path, kpath) < 0) return -EFAULT;
     process_t *proc = get_current_process();
     char resolved_path[256];
-    if (!vfs_relative_path(proc->cwd, path, resolved_path)) return -1;
+    if (!vfs_relative_path(proc->cwd, kpath, resolved_path)) return -1;
     return vfs_create(resolved_path, VFS_MODE_DIR);
 }
 
 int sys_rmdir(const char *path) {
-    if (!path) return -1;
+    char kpath[256];
+    if (get_user_path(path, kpath) < 0) return -EFAULT;
     process_t *proc = get_current_process();
     char resolved_path[256];
-    if (!vfs_relative_path(proc->cwd, path, resolved_path)) return -1;
+    if (!vfs_relative_path(proc->cwd, kpath, resolved_path)) return -1;
     return vfs_unlink(resolved_path);
 }
 
 int sys_unlink(const char *path) {
-    if (!path) return -1;
+    char kpath[256];
+    if (get_user_path(path, kpath) < 0) return -EFAULT;
     process_t *proc = get_current_process();
     char resolved_path[256];
-    if (!vfs_relative_path(proc->cwd, path, resolved_path)) return -1;
+    if (!vfs_relative_path(proc->cwd, kpath, resolved_path)) return -1;
     return vfs_unlink(resolved_path);
 }
 
 int sys_rename(const char *oldpath, const char *newpath) {
-    if (!oldpath || !newpath) return -1;
+    char kold[256], knew[256];
+    if (get_user_path(oldpath, kold) < 0 || get_user_path(newpath, knew) < 0) return -EFAULT;
     process_t *proc = get_current_process();
 
     char resolved_old[256], resolved_new[256];
-    if (!vfs_relative_path(proc->cwd, oldpath, resolved_old)) return -1;
-    if (!vfs_relative_path(proc->cwd, newpath, resolved_new)) return -1;
+    if (!vfs_relative_path(proc->cwd, kold, resolved_old)) return -1;
+    if (!vfs_relative_path(proc->cwd, knew, resolved_new)) return -1;
 
     return vfs_rename(resolved_old, resolved_new);
 }
@@ -440,24 +461,22 @@ void *sys_brk(void *addr) {
     void *old_brk = proc->brk;
 
     if (new_brk > old_brk) {
-        for (void *p = old_brk; p < new_brk; p += PAGE_SIZE) {
-            page_table_entry_t *page = get_page((uintptr_t)p, 1, proc->root_page_table);
-            if (!page || !alloc_page(page, 0x7)) {
-                kprintf(ERROR, "sys_brk: alloc failed at %x (page=%x)\n", p, page);
-                // FIX: partial allocation — roll back everything we mapped
-                // so far to keep the heap in a consistent state
-                for (void *rb = old_brk; rb < p; rb += PAGE_SIZE) {
-                    page_table_entry_t *rp = get_page((uintptr_t)rb, 0, proc->root_page_table);
-                    if (rp && rp->present) free_page(rp);
-                }
-                return old_brk;  // signal failure by returning unchanged brk
-            }
+        // The heap cannot grow into an mmap region
+        if (vma_map(&proc->vmas, (uint32_t)old_brk, (uint32_t)new_brk,
+                    PROT_READ | PROT_WRITE, VMA_HEAP) != 0) {
+            return proc->brk;
         }
+        // Only reserve the range; pages are zero-filled on first touch
+        reserve_memory(proc->root_page_table, (uint32_t)old_brk,
+                       (uint32_t)(new_brk - old_brk), PAGE_RW | PAGE_USER);
     } else if (new_brk < old_brk) {
+        tlb_gather_t tlb;
+        tlb_gather_init(&tlb, proc->root_page_table);
         for (void *p = new_brk; p < old_brk; p += PAGE_SIZE) {
-            page_table_entry_t *page = get_page((uintptr_t)p, 0, proc->root_page_table);
-            if (page && page->present) free_page(page);
+            tlb_unmap_page(&tlb, (uintptr_t)p, get_page((uintptr_t)p, 0, proc->root_page_table));
         }
+        tlb_finish(&tlb);
+        vma_unmap(&proc->vmas, (uint32_t)new_brk, (uint32_t)old_brk);
     }
 
     proc->brk = new_brk;
@@ -483,22 +502,32 @@ void *sys_sbrk(int incr) {
 int sys_pipe(int fds[2]) {
     vfs_file_t *rf, *wf;
     process_t *proc = get_current_process();
+    if (!access_ok(fds, 2 * sizeof(int))) return -EFAULT;
     if (pipe_create(&rf, &wf, 4096) != 0) return -1;
 
-    fds[0] = proc_alloc_fd(proc, rf);
-    fds[1] = proc_alloc_fd(proc, wf);
+    int kfds[2];
+    kfds[0] = proc_alloc_fd(proc, rf);
+    kfds[1] = proc_alloc_fd(proc, wf);
+    if (__copy_to_user(fds, kfds, sizeof(kfds)) < 0) {
+        proc_close_fd(proc, kfds[0]);
+        proc_close_fd(proc, kfds[1]);
+        return -EFAULT;
+    }
     return 0;
 }
 
 int sys_stat(const char *path, stat_t *st) {
-    vfs_file_t *file = vfs_open(path, VFS_FLAG_READ);
+    char kpath[256];
+    if (get_user_path(path, kpath) < 0) return -EFAULT;
+    vfs_file_t *file = vfs_open(kpath, VFS_FLAG_READ);
     if (!file) return -1;
 
-    st->size = file->inode->size;
-    st->mode = file->inode->mode;
-
+    stat_t kst;
+    kst.size = file->inode->size;
+    kst.mode = file->inode->mode;
     vfs_close(file);
-    return 0;
+
+    return __copy_to_user(st, &kst, sizeof(kst));
 }
 
 int sys_fstat(int fd, stat_t *st) {
@@ -506,20 +535,23 @@ int sys_fstat(int fd, stat_t *st) {
     if (fd < 0 || fd >= MAX_OPEN_FILES || !proc->fds[fd]) return -1;
 
     vfs_file_t *file = proc->fds[fd];
-    st->size = file->inode->size;
-    st->mode = file->inode->mode;
-    return 0;
+    stat_t kst;
+    kst.size = file->inode->size;
+    kst.mode = file->inode->mode;
+    return __copy_to_user(st, &kst, sizeof(kst));
 }
 
 int sys_get_ticks() {
     return pit_get_ticks() * 10; // Convert ticks to milliseconds (assuming 100 Hz)
 }
 
-int sys_nanosleep(const timespec_t *req, timespec_t *rem) {
-    if (!req) return -1;
+int sys_nanosleep(const timespec_t *ureq, timespec_t *rem) {
+    if (!ureq) return -1;
+    timespec_t req;
+    if (__copy_from_user(&req, ureq, sizeof(req)) < 0) return -EFAULT;
 
     // Convert the request to milliseconds then to ticks
-    uint32_t ms = req->tv_sec * 1000 + req->tv_nsec / 1000000;
+    uint32_t ms = req.tv_sec * 1000 + req.tv_nsec / 1000000;
     uint32_t ticks_needed = (ms + 9) / 10;  // ceil, 10ms per tick at 100Hz
 
     if (ticks_needed == 0) return 0;  // sub-10ms sleep, just return
@@ -532,43 +564,119 @@ int sys_nanosleep(const timespec_t *req, timespec_t *rem) {
 
     // If we get here, we were woken up (either by tick or a signal later)
     if (rem) {
-        rem->tv_sec  = 0;
-        rem->tv_nsec = 0;
+        timespec_t zero = { 0, 0 };
+        if (__copy_to_user(rem, &zero, sizeof(zero)) < 0) return -EFAULT;
     }
 
     return 0;
 }
 
+// Page flags for a PROT_* combination.  Without NX, readable implies
+// executable; PROT_NONE keeps the pages but hides them from user mode.
+static uint32_t prot_page_flags(int prot) {
+    uint32_t flags = 0;
+    if (prot & PROT_WRITE) flags |= PAGE_RW;
+    if (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) flags |= PAGE_USER;
+    return flags;
+}
+
+// 4MB-backed areas can only be cut on 4MB boundaries
+static bool splits_huge_area(process_t *proc, uint32_t start, uint32_t end) {
+    if (IS_LARGE_ALIGN(start) && IS_LARGE_ALIGN(end)) return false;
+    vma_t *first = vma_find(&proc->vmas, start);
+    vma_t *last = vma_find(&proc->vmas, end - 1);
+    return (first && (first->flags & VMA_HUGE)) || (last && (last->flags & VMA_HUGE));
+}
+
+// Drop the pages and the areas of [virt, virt + size)
+static void unmap_user_range(process_t *proc, uint32_t virt, uint32_t size) {
+    // Shared file pages reach the file before their frames go
+    filemap_sync(proc->root_page_table, &proc->vmas, virt, virt + size);
+
+    // Free each page in the range; 4MB pages go only when fully covered.
+    // One flush at the end, and the frames are released after it.
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, proc->root_page_table);
+    for (uint32_t offset = 0; offset < size; ) {
+        uint32_t va = virt + offset;
+        if (IS_LARGE_ALIGN(va) && size - offset >= LARGE_PAGE_SIZE && tlb_unmap_huge(&tlb, va)) {
+            offset += LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        tlb_unmap_page(&tlb, va, get_page(va, 0, proc->root_page_table));
+        offset += PAGE_SIZE;
+    }
+    tlb_finish(&tlb);
+
+    vma_unmap(&proc->vmas, virt, virt + size);
+}
+
 // Matches the Linux i386 mmap2 argument struct
 void *sys_mmap(void *addr, uint32_t length, int prot, int flags, int fd, uint32_t offset) {
     process_t *proc = get_current_process();
 
-    // We only support anonymous private mappings for now
+    if (length == 0) return (void *)-1;
+    if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE)) return (void *)-1;
+
+    // File mappings: the offset comes in pages, as with Linux mmap2
+    vfs_file_t *file = NULL;
+    uint32_t file_offset = 0;
     if (!(flags & MAP_ANONYMOUS)) {
-        // File-backed mmap not implemented yet
-        return (void *)-1;
+        file = vfs_get_file(fd);
+        if (fd < 3 || !file || !file->inode || file->inode->mode != VFS_MODE_FILE) {
+            return (void *)-1;
+        }
+        // Writing through a shared mapping needs a file open for writing
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(file->flags & (O_WRONLY | O_RDWR))) {
+            return (void *)-1;
+        }
+        if (offset >= 0x100000) return (void *)-1;
+        file_offset = offset * PAGE_SIZE;
     }
 
-    if (length == 0) return (void *)-1;
+    // Round up to page boundary, or to whole 4MB pages for a huge mapping
+    bool huge = !file && (flags & MAP_HUGETLB) && pse_supported();
+    uint32_t align = huge ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    uint32_t size = (length + align - 1) & ~(align - 1);
+    if (!size) return (void *)-1;
 
-    // Round up to page boundary
-    uint32_t size = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    // MAP_FIXED replaces whatever is there; a plain hint is used only if that
+    // range of the mmap window is free, otherwise the lowest fitting gap is
+    uint32_t virt = (uint32_t)addr;
+    if (flags & MAP_FIXED) {
+        if ((virt & (align - 1)) || virt + size < virt || virt + size > LOAD_MEMORY_ADDRESS) {
+            return (void *)-1;
+        }
+        if (splits_huge_area(proc, virt, virt + size)) return (void *)-1;
+        unmap_user_range(proc, virt, size);
+    } else if (!virt || (virt & (align - 1)) || virt < MMAP_BASE || virt + size < virt ||
+               virt + size > MMAP_END || !vma_range_free(&proc->vmas, virt, virt + size)) {
+        virt = vma_find_gap(&proc->vmas, size, align, MMAP_BASE, MMAP_END);
+        if (!virt) return (void *)-1;
+    }
 
-    // If addr is NULL, allocate from our mmap bump region
-    // If addr is hinted, try to honor it but fall back to bump
-    uint32_t virt;
-    if (addr == NULL) {
-        virt = (uint32_t)proc->mmap_base;
-        proc->mmap_base += size;
-    } else {
-        virt = (uint32_t)addr;
+    uint32_t vma_flags = huge ? VMA_HUGE : 0;
+    if (file && (flags & MAP_SHARED)) vma_flags |= VMA_SHARED;
+    if (vma_map_file(&proc->vmas, virt, virt + size, prot, vma_flags, file, file_offset) != 0) {
+        return (void *)-1;
     }
 
-    // Map pages into the process's page directory
-    map_memory(proc->root_page_table, virt, (uint32_t)-1, size, 0x7);
+    uint32_t page_flags = prot_page_flags(prot);
+    if (!huge) {
+        // Reserve only; each page is zero-filled (or read from the file) on first touch
+        reserve_memory(proc->root_page_table, virt, size, page_flags);
+        return (void *)virt;
+    }
 
-    // Zero the region — anonymous mappings must be zeroed per POSIX
-    memset((void *)virt, 0, size);
+    // Huge pages are populated up front, one large-page entry at a time: a
+    // 4MB chunk is two 2MB entries under PAE.  An entry that cannot get a
+    // contiguous block falls back to ordinary demand-zero pages.
+    for (uint32_t va = virt; va < virt + size; va += LARGE_PAGE_SIZE) {
+        if (!alloc_huge_page(proc->root_page_table, va, page_flags)) {
+            reserve_memory(proc->root_page_table, va, LARGE_PAGE_SIZE, page_flags);
+        }
+    }
 
     return (void *)virt;
 }
@@ -576,22 +684,48 @@ void *sys_mmap(void *addr, uint32_t length, int prot, int flags, int fd, uint32_
 void *sys_munmap(void *addr, uint32_t length) {
     process_t *proc = get_current_process();
 
-    if (!addr || length == 0) return (void *)-1;
+    if (!addr || length == 0 || !IS_ALIGN(addr)) return (void *)-1;
 
     uint32_t size = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
     uint32_t virt = (uint32_t)addr;
+    if (virt + size < virt || virt + size > LOAD_MEMORY_ADDRESS) return (void *)-1;
+    if (splits_huge_area(proc, virt, virt + size)) return (void *)-1;
 
-    // Free each page in the range
-    for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE) {
-        page_table_entry_t *page = get_page(virt + offset, 0, proc->root_page_table);
-        if (page && page->present) {
-            free_page(page);
-        }
-    }
-
+    // The address range becomes free for the next mmap
+    unmap_user_range(proc, virt, size);
     return (void *)0;  // success
 }
 
+int sys_msync(void *addr, size_t len, int flags) {
+    process_t *proc = get_current_process();
+    uint32_t start = (uint32_t)addr;
+    if (!IS_ALIGN(start) || (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC))) return -1;
+    if ((flags & MS_ASYNC) && (flags & MS_SYNC)) return -1;
+
+    uint32_t end = PAGE_ALIGN_UP(start + len);
+    if (end < start || end > LOAD_MEMORY_ADDRESS) return -1;
+
+    // Write-back is always synchronous; there is no other cached copy to drop
+    filemap_sync(proc->root_page_table, &proc->vmas, start, end);
+    return 0;
+}
+
+int sys_mprotect(void *addr, size_t len, int prot) {
+    process_t *proc = get_current_process();
+    uint32_t start = (uint32_t)addr;
+    if (!IS_ALIGN(start)) return -1;
+    if (len == 0) return 0;
+
+    uint32_t end = PAGE_ALIGN_UP(start + len);
+    if (end <= start || end > LOAD_MEMORY_ADDRESS) return -1;
+    if (splits_huge_area(proc, start, end)) return -1;
+
+    // Every page must belong to an area (mmap, heap or stack)
+    if (vma_protect(&proc->vmas, start, end, prot) != 0) return -1;
+    protect_memory(proc->root_page_table, start, end, prot_page_flags(prot));
+    return 0;
+}
+
 int sys_ioctl(int fd, int request, void *arg) {
     vfs_file_t *file = vfs_get_file(fd);
     if (!file || !file->file_ops || !file->file_ops->ioctl) return -1;
@@ -613,8 +747,10 @@ int sys_writev(int fd, const iovec_t *iov, int iovcnt) {
     // return total_written;
     int total = 0;
     for (int i = 0; i < iovcnt; i++) {
-        if (!iov[i].iov_base || iov[i].iov_len == 0) continue;
-        int n = sys_write(fd, iov[i].iov_base, iov[i].iov_len);
+        iovec_t kiov;
+        if (__copy_from_user(&kiov, &iov[i], sizeof(kiov)) < 0) return -EFAULT;
+        if (!kiov.iov_base || kiov.iov_len == 0) continue;
+        int n = sys_write(fd, kiov.iov_base, kiov.iov_len);
         if (n < 0) return n;
         total += n;
     }
@@ -645,8 +781,8 @@ sighandler_t sys_signal(int sig, sighandler_t handler) {
 }
 
 /* --- Shared-memory syscalls --- */
-int sys_shm_create(uint32_t size) {
-    return shm_create(size);
+int sys_shm_create(uint32_t size, uint32_t flags) {
+    return shm_create(size, flags);
 }
 
 void *sys_shm_map(int shm_id) {
@@ -666,7 +802,8 @@ int sys_shm_destroy(int shm_id) {
  * address space.  Writes width, height, and pitch to the supplied
  * user-space pointers and returns the mapped virtual address.
  *
- * The framebuffer is always mapped at 0x90000000 in the process VA.
+ * The framebuffer is always mapped at 0x90000000 in the process VA,
+ * write-combining when the CPU has PAT.
  */
 #define FB_USER_VADDR 0x90000000u
 void *sys_fb_map(uint32_t *out_width, uint32_t *out_height, uint32_t *out_pitch) {
@@ -675,11 +812,12 @@ void *sys_fb_map(uint32_t *out_width, uint32_t *out_height, uint32_t *out_pitch)
 
     process_t *proc = get_current_process();
     uint32_t size = fb->pitch * fb->height;
-    map_memory(proc->root_page_table, FB_USER_VADDR, fb->addr, size, 0x7);
+    map_memory(proc->root_page_table, FB_USER_VADDR, fb->addr, size,
+               PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_WC | PAGE_SHARED);
 
-    if (out_width)  *out_width  = fb->width;
-    if (out_height) *out_height = fb->height;
-    if (out_pitch)  *out_pitch  = fb->pitch;
+    if (out_width  && put_user(fb->width, out_width) < 0)   return NULL;
+    if (out_height && put_user(fb->height, out_height) < 0) return NULL;
+    if (out_pitch  && put_user(fb->pitch, out_pitch) < 0)   return NULL;
     return (void *)FB_USER_VADDR;
 }
 
@@ -719,7 +857,7 @@ static int dispatch(uint32_t num, registers_t *regs) {
         case SYSCALL_STAT:     return sys_stat((const char *)regs->ebx, (stat_t *)regs->ecx);
         case SYSCALL_GET_TICKS: return sys_get_ticks();
         case SYSCALL_NANOSLEEP: return sys_nanosleep((const timespec_t *)regs->ebx, (timespec_t *)regs->ecx);
-        case SYSCALL_SHM_CREATE:  return sys_shm_create(regs->ebx);
+        case SYSCALL_SHM_CREATE:  return sys_shm_create(regs->ebx, regs->ecx);
         case SYSCALL_SHM_MAP:     return (int)sys_shm_map(regs->ebx);
         case SYSCALL_SHM_UNMAP:   return sys_shm_unmap(regs->ebx);
         case SYSCALL_SHM_DESTROY: return sys_shm_destroy(regs->ebx);
@@ -728,6 +866,7 @@ static int dispatch(uint32_t num, registers_t *regs) {
         case SYSCALL_MMAP2:        return (int)sys_mmap((void *)regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi, regs->ebp);
         case SYSCALL_MUNMAP:      return (int)sys_munmap((void *)regs->ebx, regs->ecx);
         case SYSCALL_MPROTECT:    return sys_mprotect((void *)regs->ebx, regs->ecx, regs->edx);
+        case SYSCALL_MSYNC:       return sys_msync((void *)regs->ebx, regs->ecx, regs->edx);
         case SYSCALL_EXIT_GROUP:    return sys_exit(regs->ebx);
         case SYSCALL_SET_THREAD_AREA: return sys_set_thread_area((user_desc_t *)regs->ebx);
         case SYSCALL_SET_TID_ADDRESS: return sys_set_tid_address((int *)regs->ebx);
@@ -15,7 +15,7 @@ static vfs_inode_t *devfs_lookup(vfs_inode_t *dir, const char *name) {
 
     for (int i = 0; i < device_count; i++) {
         if (strcmp(device_table[i].name, name) == 0) {
-            vfs_inode_t *inode = (vfs_inode_t*)kmalloc(sizeof(vfs_inode_t));
+            vfs_inode_t *inode = vfs_alloc_inode();
             memset(inode, 0, sizeof(vfs_inode_t));
             inode->mode = (device_table[i].type == DEVICE_TYPE_CHAR) ? VFS_MODE_FILE : VFS_MODE_DIR;
             inode->size = 0;
@@ -42,7 +42,7 @@ static int devfs_readdir(vfs_inode_t *dir, uint32_t offset, vfs_dir_entry_t *ent
 
 static int devfs_close(vfs_inode_t *inode) {
     if (!inode || inode == devfs_root) return -1;
-    kfree(inode);
+    vfs_free_inode(inode);
     return 0;
 }
 
@@ -103,7 +103,7 @@ vfs_superblock_t *devfs_mount(vfs_device_t *device) {
     vfs_superblock_t *sb = (vfs_superblock_t*)kmalloc(sizeof(vfs_superblock_t));
     memset(sb, 0, sizeof(vfs_superblock_t));
 
-    devfs_root = (vfs_inode_t*)kmalloc(sizeof(vfs_inode_t));
+    devfs_root = vfs_alloc_inode();
     memset(devfs_root, 0, sizeof(vfs_inode_t));
 
     devfs_root->mode = VFS_MODE_DIR;
@@ -43,11 +43,17 @@ elf_header_t *load_elf(vfs_file_t *file, page_directory_t *page_dir) {
 
         if (ph.type != PT_LOAD) continue;
 
-        // Map physical frames into the new process page dir
-        map_memory(page_dir, ph.vaddr, (uint32_t)-1, ph.mem_size, 0x7);
-        kprintf(DEBUG, "alloc_page: frame=%x for virt=%x\n", get_page(ph.vaddr, 0, page_dir)->frame, ph.vaddr);
-        page_table_entry_t *dbg = get_page(ph.vaddr, 0, page_dir);
-        
+        // File-backed pages are mapped now; pure BSS pages are demand-zero
+        uint32_t seg_start = PAGE_ALIGN(ph.vaddr);
+        uint32_t file_end  = PAGE_ALIGN_UP(ph.vaddr + ph.file_size);
+        uint32_t mem_end   = PAGE_ALIGN_UP(ph.vaddr + ph.mem_size);
+        if (file_end > seg_start) {
+            map_memory(page_dir, seg_start, (uint32_t)-1, file_end - seg_start, 0x7);
+        }
+        if (mem_end > file_end) {
+            reserve_memory(page_dir, file_end, mem_end - file_end, PAGE_RW | PAGE_USER);
+        }
+
         // Read segment data into kernel buffer
         uint8_t *tmp = kmalloc(ph.file_size);
         if (!tmp) {
@@ -70,22 +76,12 @@ elf_header_t *load_elf(vfs_file_t *file, page_directory_t *page_dir) {
         }
         kfree(tmp);
 
-        // Zero BSS region (mem_size > file_size)
-        if (ph.mem_size > ph.file_size) {
-            uint32_t bss_vaddr = ph.vaddr + ph.file_size;
-            uint32_t bss_size  = ph.mem_size - ph.file_size;
-            uint8_t *zeros = kmalloc(bss_size);
-            if (!zeros) {
-                kprintf(ERROR, "load_elf: failed to allocate BSS zero buffer\n");
-                goto fail;
-            }
-            memset(zeros, 0, bss_size);
-            if (copy_to_user(page_dir, bss_vaddr, zeros, bss_size) < 0) {
-                kprintf(ERROR, "load_elf: copy_to_user failed for BSS\n");
-                kfree(zeros);
-                goto fail;
-            }
-            kfree(zeros);
+        // Zero the BSS that shares the last file-backed page; the rest is demand-zero
+        uint32_t bss_vaddr = ph.vaddr + ph.file_size;
+        uint32_t bss_end = ph.vaddr + ph.mem_size < file_end ? ph.vaddr + ph.mem_size : file_end;
+        if (bss_end > bss_vaddr && clear_user(page_dir, bss_vaddr, bss_end - bss_vaddr) < 0) {
+            kprintf(ERROR, "load_elf: clear_user failed for BSS\n");
+            goto fail;
         }
     }
 
@@ -1,6 +1,7 @@
 #include "kernel/fat32.h"
 #include "kernel/vfs.h"
 #include "kernel/kheap.h"
+#include "kernel/vmalloc.h"
 #include "kernel/printf.h"
 #include "libc/string.h"
 
@@ -338,14 +339,14 @@ static vfs_inode_t *fat32_lookup(vfs_inode_t *dir, const char *name) {
     fat32_superblock_t *sb = (fat32_superblock_t*)dir->superblock->fs_data;
 
     uint32_t cluster = dir_inode->cluster;
-    uint8_t *buffer = kmalloc(sb->cluster_size);
+    uint8_t *buffer = kvmalloc(sb->cluster_size);
     char formatted_name[12];
     fat32_format_name(name, formatted_name);
 
     while (cluster < FAT32_CLUSTER_LAST) {
         if (cluster == FAT32_CLUSTER_BAD || cluster == FAT32_CLUSTER_FREE) return NULL;
         if (fat32_read_cluster(sb, cluster, buffer) != 0) {
-            kfree(buffer);
+            kvfree(buffer);
             return NULL;
         }
         
@@ -355,9 +356,9 @@ static vfs_inode_t *fat32_lookup(vfs_inode_t *dir, const char *name) {
             if (entry->filename[0] == FAT32_DELETED_ENTRY) continue;
 
             if (strncmp(entry->filename, formatted_name, 8) == 0 && strncmp(entry->ext, formatted_name + 8, 3) == 0) {
-                vfs_inode_t *inode = (vfs_inode_t*) kmalloc(sizeof(vfs_inode_t));
+                vfs_inode_t *inode = vfs_alloc_inode();
                 if (!inode) {
-                    kfree(buffer);
+                    kvfree(buffer);
                     return NULL;
                 }
 
@@ -368,8 +369,8 @@ static vfs_inode_t *fat32_lookup(vfs_inode_t *dir, const char *name) {
 
                 fat32_inode_t *inode_data = (fat32_inode_t*) kmalloc(sizeof(fat32_inode_t));
                 if (!inode_data) {
-                    kfree(inode);
-                    kfree(buffer);
+                    vfs_free_inode(inode);
+                    kvfree(buffer);
                     return NULL;
                 }
 
@@ -379,7 +380,7 @@ static vfs_inode_t *fat32_lookup(vfs_inode_t *dir, const char *name) {
                 inode_data->dir_cluster = cluster;
 
                 inode->fs_data = inode_data;
-                kfree(buffer);
+                kvfree(buffer);
                 return inode;
             }
         }
@@ -387,7 +388,7 @@ static vfs_inode_t *fat32_lookup(vfs_inode_t *dir, const char *name) {
         cluster = fat32_get_next_cluster(sb, cluster);
     }
 
-    kfree(buffer);
+    kvfree(buffer);
     return NULL;
 }
 
@@ -664,7 +665,7 @@ static uint32_t fat32_read(vfs_file_t *file, void *buf, size_t count) {
     }
     
     if (fat32_get_cluster_at_offset(sb, &cluster, offset) != 0) return read;
-    uint8_t *buffer = kmalloc(sb->cluster_size);
+    uint8_t *buffer = kvmalloc(sb->cluster_size);
     if (!buffer) {
         kprintf(ERROR, "fat32_read: failed to allocate cluster buffer\n");
         return 0;
@@ -679,7 +680,7 @@ static uint32_t fat32_read(vfs_file_t *file, void *buf, size_t count) {
 
         // kprintf(DEBUG, "fat32_read: cluster=%d fat_entry=%x offset=%d\n", cluster, buffer[cluster], offset);
         if (fat32_read_cluster(sb, cluster, buffer) != 0) {
-            kfree(buffer);
+            kvfree(buffer);
             return read;
         }
         memcpy((uint8_t*)buf + read, buffer + cluster_offset, to_read);
@@ -693,14 +694,14 @@ static uint32_t fat32_read(vfs_file_t *file, void *buf, size_t count) {
     }
 
     file->offset += read;
-    kfree(buffer);
+    kvfree(buffer);
     return read;
 }
 
 static int fat32_close(vfs_inode_t *inode) {
     if (!inode || inode == inode->superblock->root) return -1;
     kfree(inode->fs_data);
-    kfree(inode);
+    vfs_free_inode(inode);
     return 0;
 }
 
@@ -863,7 +864,7 @@ vfs_superblock_t * fat32_mount(const char *device) {
     vfs_sb->device = bd;
     vfs_sb->fs_data = sb;
 
-    vfs_sb->root = (vfs_inode_t*) kmalloc(sizeof(vfs_inode_t));
+    vfs_sb->root = vfs_alloc_inode();
     vfs_sb->root->mode = VFS_MODE_DIR;
     vfs_sb->root->size = 0;
     vfs_sb->root->superblock = vfs_sb;
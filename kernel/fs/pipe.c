@@ -1,10 +1,14 @@
 #include "kernel/pipe.h"
 #include "kernel/kheap.h"
+#include "kernel/vmalloc.h"
+#include "kernel/slab.h"
 #include "kernel/vfs.h"
 #include "kernel/printf.h"
 
 #define PIPE_SIZE 4096
 
+static kmem_cache_t *pipe_cache = NULL;
+
 static int pipe_read(vfs_file_t *file, void *buf, size_t count) {
     if (!file || !buf || count == 0) return -1;
     pipe_t *pipe = (pipe_t *)file->inode->fs_data;
@@ -63,9 +67,9 @@ static int pipe_close_write(vfs_file_t *file) {
     wait_queue_wake_all(&pipe->readers); // Wake all readers to unblock them
 
     if (pipe->data_len == 0) {
-        kfree(pipe->buffer);
-        kfree(file->inode);
-        kfree(pipe);
+        kvfree(pipe->buffer);
+        vfs_free_inode(file->inode);
+        kmem_cache_free(pipe_cache, pipe);
     }
     
     return 0;
@@ -88,7 +92,11 @@ static struct vfs_file_operations pipe_write_ops = {
 int pipe_create(vfs_file_t **read_end, vfs_file_t **write_end, size_t size) {
     if (size == 0) return -1;
 
-    pipe_t *pipe = (pipe_t *)kmalloc(sizeof(pipe_t));
+    if (!pipe_cache) {
+        pipe_cache = kmem_cache_create("pipe_t", sizeof(pipe_t), 0, NULL);
+    }
+
+    pipe_t *pipe = (pipe_t *)kmem_cache_alloc(pipe_cache);
     if (!pipe) return -1;
 
     pipe->size = size;
@@ -99,15 +107,16 @@ int pipe_create(vfs_file_t **read_end, vfs_file_t **write_end, size_t size) {
     wait_queue_init(&pipe->readers);
     wait_queue_init(&pipe->writers);
 
-    pipe->buffer = (char *)kmalloc(size);
+    pipe->buffer = (char *)kvmalloc(size);
     if (!pipe->buffer) {
-        kfree(pipe);
+        kmem_cache_free(pipe_cache, pipe);
         return -1;
     }
 
-    vfs_inode_t *inode = (vfs_inode_t *)kmalloc(sizeof(vfs_inode_t));
+    vfs_inode_t *inode = vfs_alloc_inode();
     if (!inode) {
-        kfree(pipe);
+        kvfree(pipe->buffer);
+        kmem_cache_free(pipe_cache, pipe);
         return -1;
     }
 
@@ -117,14 +126,14 @@ int pipe_create(vfs_file_t **read_end, vfs_file_t **write_end, size_t size) {
     inode->fs_data = pipe;
     inode->inode_ops = NULL;
 
-    *read_end = (vfs_file_t *)kmalloc(sizeof(vfs_file_t));
+    *read_end = vfs_alloc_file();
     (*read_end)->inode = inode;
     (*read_end)->flags = O_RDONLY;
     (*read_end)->offset = 0;
     (*read_end)->ref_count = 1;
     (*read_end)->file_ops = &pipe_read_ops;
 
-    *write_end = (vfs_file_t *)kmalloc(sizeof(vfs_file_t));
+    *write_end = vfs_alloc_file();
     (*write_end)->inode = inode;
     (*write_end)->flags = O_WRONLY;
     (*write_end)->offset = 0;
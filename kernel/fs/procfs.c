@@ -0,0 +1,155 @@
+#include "kernel/procfs.h"
+#include "kernel/process.h"
+#include "kernel/printf.h"
+#include "kernel/kheap.h"
+#include "kernel/ksm.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+extern process_t *process_list;
+
+// fs_data of /PROC/KSM; every other inode holds a pid there
+#define PROCFS_KSM ((size_t)-1)
+
+static vfs_inode_t *procfs_root = NULL;
+static struct vfs_inode_operations procfs_inode_ops;
+
+// Parse a decimal pid; -1 if name is not a plain number
+static int parse_pid(const char *name) {
+    if (!*name) return -1;
+    int pid = 0;
+    for (const char *c = name; *c; c++) {
+        if (*c < '0' || *c > '9') return -1;
+        pid = pid * 10 + (*c - '0');
+    }
+    return pid;
+}
+
+static vfs_inode_t *procfs_new_inode(uint32_t mode, size_t pid) {
+    vfs_inode_t *inode = vfs_alloc_inode();
+    if (!inode) return NULL;
+    memset(inode, 0, sizeof(vfs_inode_t));
+    inode->mode = mode;
+    inode->fs_data = (void *)pid;
+    inode->inode_ops = &procfs_inode_ops;
+    return inode;
+}
+
+static vfs_inode_t *procfs_lookup(vfs_inode_t *dir, const char *name) {
+    if (!dir || !name || dir->mode != VFS_MODE_DIR) return NULL;
+
+    if (dir == procfs_root) {
+        if (strcmp(name, "KSM") == 0) return procfs_new_inode(VFS_MODE_FILE, PROCFS_KSM);
+        int pid = parse_pid(name);
+        if (pid < 0 || !get_process(pid)) return NULL;
+        return procfs_new_inode(VFS_MODE_DIR, pid);
+    }
+
+    if (strcmp(name, "MAPS") == 0) {
+        return procfs_new_inode(VFS_MODE_FILE, (size_t)dir->fs_data);
+    }
+    return NULL;
+}
+
+static int procfs_readdir(vfs_inode_t *dir, uint32_t offset, vfs_dir_entry_t *entry) {
+    if (!dir || !entry) return -1;
+
+    if (dir != procfs_root) {
+        if (offset > 0) return 0;
+        strncpy(entry->name, "MAPS", sizeof(entry->name));
+        entry->type = 0;
+        entry->inode_number = 1;
+        return 1;
+    }
+
+    // KSM first, then one directory per process
+    if (offset == 0) {
+        strncpy(entry->name, "KSM", sizeof(entry->name));
+        entry->type = 0;
+        entry->inode_number = 1;
+        return 1;
+    }
+
+    process_t *proc = process_list;
+    for (uint32_t i = 1; proc && i < offset; i++) proc = proc->next;
+    if (!proc) return 0;
+
+    snprintf(entry->name, sizeof(entry->name), "%d", (int)proc->pid);
+    entry->type = 1;
+    entry->inode_number = proc->pid + 2;
+    return offset + 1;
+}
+
+// Render a file's whole contents into a kmalloc'd buffer; NULL if it is gone
+static char *procfs_render(vfs_inode_t *inode, uint32_t *len) {
+    if ((size_t)inode->fs_data == PROCFS_KSM) {
+        char *text = kmalloc(KSM_FORMAT_SIZE);
+        if (text) *len = ksm_format_stats(text, KSM_FORMAT_SIZE);
+        return text;
+    }
+
+    process_t *proc = get_process((size_t)inode->fs_data);
+    if (!proc) return NULL;
+    size_t size = proc->vmas.count * VMA_FORMAT_LINE + 1;
+    char *text = kmalloc(size);
+    if (text) *len = vma_format(&proc->vmas, text, size);
+    return text;
+}
+
+static uint32_t procfs_read(vfs_file_t *file, void *buf, size_t count) {
+    if (!file || !buf) return -1;
+
+    // Render the whole file, then hand out the part past the offset
+    uint32_t len = 0;
+    char *text = procfs_render(file->inode, &len);
+    if (!text) return -1;
+
+    uint32_t n = 0;
+    if (file->offset < len) {
+        n = len - file->offset;
+        if (n > count) n = count;
+        memcpy(buf, text + file->offset, n);
+        file->offset += n;
+    }
+    kfree(text);
+    return n;
+}
+
+static uint32_t procfs_write(vfs_file_t *file, const void *buf, size_t count) {
+    (void)file;
+    (void)buf;
+    (void)count;
+    return -1;  // read-only
+}
+
+static int procfs_close(vfs_inode_t *inode) {
+    if (!inode || inode == procfs_root) return -1;
+    vfs_free_inode(inode);
+    return 0;
+}
+
+static struct vfs_inode_operations procfs_inode_ops = {
+    .lookup = procfs_lookup,
+    .readdir = procfs_readdir,
+    .create = NULL,
+    .unlink = NULL,
+    .close = procfs_close,
+    .write = procfs_write,
+    .read = procfs_read,
+    .mkdir = NULL,
+    .rmdir = NULL
+};
+
+vfs_superblock_t *procfs_mount(void) {
+    vfs_superblock_t *sb = (vfs_superblock_t *)kmalloc(sizeof(vfs_superblock_t));
+    if (!sb) return NULL;
+    memset(sb, 0, sizeof(vfs_superblock_t));
+
+    procfs_root = vfs_alloc_inode();
+    memset(procfs_root, 0, sizeof(vfs_inode_t));
+    procfs_root->mode = VFS_MODE_DIR;
+    procfs_root->inode_ops = &procfs_inode_ops;
+
+    sb->root = procfs_root;
+    return sb;
+}
@@ -29,7 +29,7 @@ static vfs_inode_t* ramfs_lookup(vfs_inode_t *dir, const char *name) {
 
     if (!child) return NULL;
 
-    vfs_inode_t* inode = kmalloc(sizeof(vfs_inode_t));
+    vfs_inode_t* inode = vfs_alloc_inode();
     inode->mode = child->mode;
     inode->size = child->size;
     inode->fs_data = child;
@@ -93,7 +93,7 @@ static uint32_t ramfs_read(vfs_file_t *file, void *buf, size_t count) {
 
 static int ramfs_close(vfs_inode_t *inode) {
     kfree(inode->fs_data);
-    kfree(inode);
+    vfs_free_inode(inode);
     return 0;
 }
 
@@ -143,7 +143,7 @@ vfs_superblock_t *ramfs_mount(const char *device) {
         return NULL;
     }
 
-    sb->root = kmalloc(sizeof(vfs_inode_t));
+    sb->root = vfs_alloc_inode();
     sb->root->mode = VFS_MODE_DIR | ramfs_root->mode;
     sb->root->size = 0;
     sb->root->fs_data = ramfs_root;
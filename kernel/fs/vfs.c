@@ -1,8 +1,10 @@
 #include "kernel/vfs.h"
 #include "kernel/kheap.h"
+#include "kernel/slab.h"
 #include "kernel/ramfs.h"
 #include "kernel/fat32.h"
 #include "kernel/devfs.h"
+#include "kernel/procfs.h"
 #include "kernel/printf.h"
 #include "kernel/process.h"
 #include "common/dirent.h"
@@ -25,6 +27,9 @@ vfs_mount_t* vfs_mount_list = NULL;
 vfs_mount_t* root_mount = NULL;
 hash_table_t vfs_table = {0};
 
+static kmem_cache_t *inode_cache = NULL;
+static kmem_cache_t *file_cache = NULL;
+
 struct vfs_file_operations vfs_default_file_ops = {
     .read = vfs_read,
     .write = vfs_write,
@@ -337,19 +342,19 @@ struct vfs_file_operations vfs_console_ops = {
 };
 
 void console_init() {
-    console_fds[0] = (vfs_file_t*) kmalloc(sizeof(vfs_file_t));
+    console_fds[0] = vfs_alloc_file();
     console_fds[0]->fd = 0;
     console_fds[0]->file_ops = &vfs_console_ops;
     console_fds[0]->flags = O_RDONLY;
     console_fds[0]->ref_count = 1;
 
-    console_fds[1] = (vfs_file_t*) kmalloc(sizeof(vfs_file_t));
+    console_fds[1] = vfs_alloc_file();
     console_fds[1]->fd = 1;
     console_fds[1]->file_ops = &vfs_console_ops;
     console_fds[1]->flags = O_WRONLY;
     console_fds[1]->ref_count = 1;
 
-    console_fds[2] = (vfs_file_t*) kmalloc(sizeof(vfs_file_t));
+    console_fds[2] = vfs_alloc_file();
     console_fds[2]->fd = 2;
     console_fds[2]->file_ops = &vfs_console_ops;
     console_fds[2]->flags = O_WRONLY;
@@ -576,7 +581,7 @@ vfs_file_t *vfs_open(const char *path, int flags) {
         }
     }
 
-    vfs_file_t* file = (vfs_file_t *)kmalloc(sizeof(vfs_file_t));
+    vfs_file_t* file = vfs_alloc_file();
     if (!file) return NULL;
 
     file->fd = -1; //fd;
@@ -600,7 +605,7 @@ int vfs_close(vfs_file_t *file) {
         file->inode->inode_ops->close(file->inode);
     }
 
-    kfree(file);
+    vfs_free_file(file);
     return 0;
 }
 
@@ -705,6 +710,31 @@ int vfs_read(vfs_file_t *file, void* buf, size_t count) {
     return file->inode->inode_ops->read(file, buf, count);
 }
 
+// Devices and pipes have no file position to seek to
+static bool vfs_is_regular(vfs_file_t *file) {
+    return file && file->inode && file->inode->mode == VFS_MODE_FILE &&
+           file->file_ops == &vfs_default_file_ops;
+}
+
+int vfs_pread(vfs_file_t *file, void *buf, size_t count, uint32_t offset) {
+    if (!vfs_is_regular(file) || !file->inode->inode_ops->read) return -1;
+
+    // A private cursor, so the descriptor's offset is not disturbed
+    vfs_file_t cursor = *file;
+    cursor.offset = offset;
+    cursor.flags = O_RDONLY;
+    return file->inode->inode_ops->read(&cursor, buf, count);
+}
+
+int vfs_pwrite(vfs_file_t *file, const void *buf, size_t count, uint32_t offset) {
+    if (!vfs_is_regular(file) || !file->inode->inode_ops->write) return -1;
+
+    vfs_file_t cursor = *file;
+    cursor.offset = offset;
+    cursor.flags = O_RDWR;      // never O_TRUNC
+    return file->inode->inode_ops->write(&cursor, buf, count);
+}
+
 int vfs_seek(vfs_file_t *file, uint32_t offset, int whence) {
     if (!file) return -1;
 
@@ -808,7 +838,26 @@ void init_fs(vfs_fs_type_t *fs_type, const char *device, const char *mount_path)
     }
 }
 
+vfs_inode_t *vfs_alloc_inode() {
+    return (vfs_inode_t *)kmem_cache_zalloc(inode_cache);
+}
+
+void vfs_free_inode(vfs_inode_t *inode) {
+    kmem_cache_free(inode_cache, inode);
+}
+
+vfs_file_t *vfs_alloc_file() {
+    return (vfs_file_t *)kmem_cache_zalloc(file_cache);
+}
+
+void vfs_free_file(vfs_file_t *file) {
+    kmem_cache_free(file_cache, file);
+}
+
 void vfs_init() {
+    inode_cache = kmem_cache_create("vfs_inode_t", sizeof(vfs_inode_t), 0, NULL);
+    file_cache = kmem_cache_create("vfs_file_t", sizeof(vfs_file_t), 0, NULL);
+
     block_device_t *ata = get_block_device("/dev/sda1");
     if (!ata) {
         printf("ATA block device not found\n");
@@ -878,6 +927,11 @@ void vfs_init() {
         printf("Failed to create devfs superblock\n");
     }
 
+    /* Mount procfs at /PROC for /PROC/<pid>/MAPS */
+    vfs_superblock_t *procfs_sb = procfs_mount();
+    if (!procfs_sb || vfs_mount("/PROC", procfs_sb) != 0)
+        printf("Failed to mount procfs at /PROC\n");
+
     int fd;
     if (vfs_create("/home", VFS_MODE_DIR) != 0) {
         printf("Failed to create directory: /home\n");
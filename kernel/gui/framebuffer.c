@@ -2,6 +2,7 @@
 #include "kernel/printf.h"
 #include "kernel/kheap.h"
 #include "kernel/paging.h"
+#include "kernel/vmalloc.h"
 #include "libc/string.h"
 #include <stddef.h>
 
@@ -38,17 +39,26 @@ void init_framebuffer(framebuffer_t *fb_data) {
     }
 
     fb = fb_data;
-    kmap_memory(fb->addr, fb->addr, fb->pitch * fb->height, 0x7);
+    uint32_t fb_size = fb->pitch * fb->height;
+    // A PCI BAR is a naturally aligned power of two at least as large as the
+    // visible buffer, so a 4MB-aligned framebuffer can be covered by whole
+    // 4MB pages without touching anything else
+    if (fb_size > LARGE_PAGE_SIZE / 2 && IS_LARGE_ALIGN(fb->addr)) {
+        fb_size = ALIGN_UP(fb_size, LARGE_PAGE_SIZE);
+    }
+    // Write-combining: the CPU batches pixel stores into full bus bursts
+    kmap_large(fb->addr, fb->addr, fb_size, PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_WC | PAGE_SHARED);
 
     // Initialize backbuffer for double buffering
-    backbuffer = (uint32_t *)kmalloc(fb_data->width * fb_data->height * (fb_data->bpp / 8));
+    // Several MB: keep it out of the contiguous heap (vmalloc memory comes zeroed)
+    backbuffer = (uint32_t *)vmalloc(fb_data->width * fb_data->height * (fb_data->bpp / 8));
     if (!backbuffer) {
         printf("Error: Failed to allocate backbuffer memory\n");
         return;
     }
 
-    memset(backbuffer, 0, fb_data->width * fb_data->height * (fb_data->bpp / 8));
-    printf("Framebuffer initialized: %dx%d, pitch: %d, bpp: %d\n", fb->width, fb->height, fb->pitch, fb->bpp);
+    printf("Framebuffer initialized: %dx%d, pitch: %d, bpp: %d%s\n", fb->width, fb->height, fb->pitch, fb->bpp,
+           pat_supported() ? ", write-combining" : "");
 }
 
 framebuffer_t *get_framebuffer(void) {
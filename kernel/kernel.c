@@ -21,6 +21,10 @@
 #include "drivers/ata.h"
 #include "drivers/rtc.h"
 #include "kernel/shm.h"
+#include "kernel/swap.h"
+#include "kernel/zram.h"
+#include "kernel/ksm.h"
+#include "kernel/shrinker.h"
 #include "kernel/wm_dev.h"
 #include "drivers/mouse.h"
 
@@ -99,9 +103,7 @@ void kernel_main(uint32_t magic, struct multiboot_tag* mbd)
 
 	init_keyboard();
 
-	// Allocate 1096MB of memory
-	printf("Allocating %xMB of memory\n", MAX_MEMORY / (1024 * 1024));
-	pmm_init(mbd, MAX_MEMORY);
+	pmm_init(mbd);
 
 	paging_init();
 	kheap_init();
@@ -110,6 +112,11 @@ void kernel_main(uint32_t magic, struct multiboot_tag* mbd)
 	
 	pci_init();
 	ata_init();
+	// Compressed RAM takes swapped pages first, the disk what does not fit
+	if (zram_init(pmm_get_total_blocks() / ZRAM_RAM_SHARE) && swap_format(ZRAM_DEVICE)) {
+		swap_on(ZRAM_DEVICE);
+	}
+	swap_on(SWAP_DEVICE);
 	// acpi_init();
 	printf("\n");
 
@@ -127,6 +134,9 @@ void kernel_main(uint32_t magic, struct multiboot_tag* mbd)
 	process_t *test_proc = create_process("test", process_test, PROCESS_FLAG_KERNEL);
 
 	schedule_process_threads(init_proc);
+	// After init: the first thread scheduled is the one running now
+	ksm_init();
+	reclaim_init();
 	// schedule_process_threads(test_proc);
 
 
@@ -1,9 +1,12 @@
 #include "kernel/hashtable.h"
 #include "kernel/kheap.h"
+#include "kernel/slab.h"
 #include "kernel/string.h"
 #include "kernel/printf.h"
 #include "libc/string.h"
 
+static kmem_cache_t *hash_node_cache = NULL;
+
 static uint32_t hash_function(const char *str) {
     uint32_t hash = 5381;
     while (*str) {
@@ -22,7 +25,7 @@ void delete_hash_table(hash_table_t *table) {
             hash_node_t *temp = node;
             node = node->next;
             kfree(temp->key);
-            kfree(temp);
+            kmem_cache_free(hash_node_cache, temp);
         }
     }
 }
@@ -31,13 +34,17 @@ int hash_set(hash_table_t *table, const char *key, void *value) {
     if (!table || !key) return -1;
 
     uint32_t index = hash_function(key);
-    hash_node_t *new_node = kmalloc(sizeof(hash_node_t));
+    if (!hash_node_cache) {
+        hash_node_cache = kmem_cache_create("hash_node_t", sizeof(hash_node_t), 0, NULL);
+    }
+
+    hash_node_t *new_node = kmem_cache_alloc(hash_node_cache);
     if (!new_node) return -1;
 
     // Copy key string
     new_node->key = strdup(key);
     if (!new_node->key) {
-        kfree(new_node);
+        kmem_cache_free(hash_node_cache, new_node);
         return -1;
     }
 
@@ -78,7 +85,7 @@ int hash_remove(hash_table_t *table, const char *key) {
                 table->nodes[index] = current->next;
             }
             kfree(current->key);
-            kfree(current);
+            kmem_cache_free(hash_node_cache, current);
             return 0;  // Success
         }
         prev = current;
@@ -0,0 +1,145 @@
+#include "kernel/lz4.h"
+#include <stdbool.h>
+#include "libc/string.h"
+
+#define MIN_MATCH     4
+#define LAST_LITERALS 5     // a block always ends with this many literals
+#define MFLIMIT       12    // and its last match starts at least this far from the end
+#define RUN_MASK      15
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Room for a sequence of 'lit' literals followed by a 'match'-byte match
+static inline uint32_t sequence_size(uint32_t lit, uint32_t match) {
+    return 1 + lit / 255 + 1 + lit + 2 + match / 255 + 1;
+}
+
+static uint8_t *put_length(uint8_t *op, uint32_t n) {
+    for (; n >= 255; n -= 255) *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+// Token, literal run and, if match_len, the match; returns the new output end
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, uint32_t lit_len,
+                             uint32_t offset, uint32_t match_len) {
+    uint8_t *token = op++;
+    uint32_t ml = match_len ? match_len - MIN_MATCH : 0;
+    *token = (uint8_t)(((lit_len < RUN_MASK ? lit_len : RUN_MASK) << 4) |
+                       (ml < RUN_MASK ? ml : RUN_MASK));
+    if (lit_len >= RUN_MASK) op = put_length(op, lit_len - RUN_MASK);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!match_len) return op;
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    if (ml >= RUN_MASK) op = put_length(op, ml - RUN_MASK);
+    return op;
+}
+
+uint32_t lz4_compress(const void *source, uint32_t len, void *dest, uint32_t cap, void *wrkmem) {
+    const uint8_t *src = source;
+    uint8_t *op = dest;
+    uint8_t *oend = op + cap;
+    uint16_t *table = wrkmem;
+    if (len > LZ4_MAX_INPUT) return 0;
+
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + len;
+
+    if (len > MFLIMIT) {
+        const uint8_t *mflimit = iend - MFLIMIT;
+        const uint8_t *matchlimit = iend - LAST_LITERALS;
+        memset(table, 0, LZ4_WORKMEM_SIZE);
+
+        for (ip++; ip <= mflimit; ) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint16_t)(ip - src);
+            // Positions fit in 16 bits, so every candidate is within offset range
+            if (read32(ref) != seq || ref >= ip) {
+                ip++;
+                continue;
+            }
+
+            const uint8_t *end = ip + MIN_MATCH;
+            const uint8_t *rp = ref + MIN_MATCH;
+            while (end < matchlimit && *end == *rp) {
+                end++;
+                rp++;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            uint32_t lit_len = ip - anchor;
+            uint32_t match_len = end - ip;
+            if (sequence_size(lit_len, match_len) > (uint32_t)(oend - op)) return 0;
+            op = put_sequence(op, anchor, lit_len, ip - ref, match_len);
+            ip = anchor = end;
+        }
+    }
+
+    uint32_t lit_len = iend - anchor;
+    if (sequence_size(lit_len, 0) > (uint32_t)(oend - op)) return 0;
+    op = put_sequence(op, anchor, lit_len, 0, 0);
+    return op - (uint8_t *)dest;
+}
+
+// Add up a length's 255-continued extension bytes; false if it runs off the input
+static bool get_length(const uint8_t **ip, const uint8_t *iend, uint32_t *n) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return false;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz4_decompress(const void *source, uint32_t len, void *dest, uint32_t cap) {
+    const uint8_t *ip = source;
+    const uint8_t *iend = ip + len;
+    uint8_t *op = dest;
+    uint8_t *oend = op + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        uint32_t lit_len = token >> 4;
+        if (lit_len == RUN_MASK && !get_length(&ip, iend, &lit_len)) return -1;
+        if (lit_len > (uint32_t)(iend - ip) || lit_len > (uint32_t)(oend - op)) return -1;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        // The last sequence is literals only
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (uint32_t)(op - (uint8_t *)dest)) return -1;
+
+        uint32_t match_len = token & RUN_MASK;
+        if (match_len == RUN_MASK && !get_length(&ip, iend, &match_len)) return -1;
+        match_len += MIN_MATCH;
+        if (match_len > (uint32_t)(oend - op)) return -1;
+
+        // Byte by byte: a match may overlap the bytes it produces (runs)
+        const uint8_t *match = op - offset;
+        while (match_len--) *op++ = *match++;
+    }
+    return op - (uint8_t *)dest;
+}
@@ -0,0 +1,90 @@
+#include "kernel/filemap.h"
+#include "kernel/pmm.h"
+#include "kernel/kheap.h"
+#include "kernel/printf.h"
+#include "kernel/zeropage.h"
+#include "kernel/tlb.h"
+#include "libc/string.h"
+
+int filemap_fault(vma_t *vma, uint32_t vaddr, page_table_entry_t *page) {
+    uint32_t va = PAGE_ALIGN(vaddr);
+    if (page->present || !page->lazy || !vma->file) return -1;
+
+    // Zeroed first, so the tail past end of file reads as zero.  The frame
+    // may lie outside the direct map: the read then goes through a bounce
+    // buffer, since it can sleep and a temp window cannot be held across that.
+    uint32_t frame = alloc_zeroed_frame();
+    if (!frame) {
+        kprintf(ERROR, "filemap_fault: out of memory at %x\n", vaddr);
+        return -1;
+    }
+    uint8_t *kaddr = frame_to_virt(frame);
+    uint8_t *bounce = kaddr ? NULL : kmalloc(PAGE_SIZE);
+    if (!kaddr && !bounce) {
+        kprintf(ERROR, "filemap_fault: out of memory at %x\n", vaddr);
+        pmm_free_block(frame);
+        return -1;
+    }
+    if (bounce) memset(bounce, 0, PAGE_SIZE);
+
+    uint32_t offset = vma->offset + (va - vma->start);
+    if (vfs_pread(vma->file, kaddr ? kaddr : bounce, PAGE_SIZE, offset) < 0) {
+        kprintf(ERROR, "filemap_fault: read failed at offset %x\n", offset);
+        kfree(bounce);
+        pmm_free_block(frame);
+        return -1;
+    }
+    if (bounce) {
+        memcpy(kmap_frame(frame, UACCESS_TMP_DST), bounce, PAGE_SIZE);
+        kunmap_frame(frame, UACCESS_TMP_DST);
+        kfree(bounce);
+    }
+
+    page->frame = frame;
+    page->shared = (vma->flags & VMA_SHARED) != 0;
+    page->dirty = 0;
+    page->lazy = 0;
+    page->present = 1;
+    invalidate_page(va);
+    return 0;
+}
+
+void filemap_sync(page_directory_t *dir, vma_tree_t *vmas, uint32_t start, uint32_t end) {
+    uint8_t *bounce = NULL;
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, dir);
+
+    for (vma_t *v = vmas->first; v && v->start < end; v = v->next) {
+        if (v->end <= start || !v->file || !(v->flags & VMA_SHARED)) continue;
+
+        uint32_t file_size = v->file->inode->size;
+        uint32_t from = v->start > start ? v->start : start;
+        uint32_t to = v->end < end ? v->end : end;
+        for (uint32_t va = from; va < to; va += PAGE_SIZE) {
+            page_table_entry_t *page = get_page(va, 0, dir);
+            if (!page || !page->present || !page->dirty) continue;
+
+            // Writes never extend the file; bytes past its end are dropped
+            uint32_t offset = v->offset + (va - v->start);
+            if (offset >= file_size) continue;
+            uint32_t len = file_size - offset < PAGE_SIZE ? file_size - offset : PAGE_SIZE;
+
+            if (!bounce && !(bounce = kmalloc(PAGE_SIZE))) {
+                kprintf(ERROR, "filemap_sync: out of memory\n");
+                tlb_finish(&tlb);
+                return;
+            }
+            if (copy_from_user(dir, bounce, va, len) < 0 ||
+                vfs_pwrite(v->file, bounce, len, offset) != (int)len) {
+                kprintf(ERROR, "filemap_sync: write-back failed at %x\n", va);
+                continue;
+            }
+            // Flush the TLB entry, or later writes would not set dirty again
+            page->dirty = 0;
+            tlb_gather_page(&tlb, va);
+        }
+    }
+    tlb_finish(&tlb);
+
+    if (bounce) kfree(bounce);
+}
@@ -1,66 +1,244 @@
+#include <stdbool.h>
 #include "kernel/kheap.h"
 #include "kernel/printf.h"
 #include "kernel/process.h"
 #include "kernel/locks.h"
-
-#define MIN_BLOCK_SIZE (sizeof(kheap_block_t) + KHEAP_ALIGNMENT)
+#include "kernel/paging.h"
+#include "kernel/pmm.h"
+#include "kernel/slab.h"
+#include "kernel/shrinker.h"
+#include "libc/string.h"
+
+extern page_directory_t *kpage_dir;
+
+/*
+ * Segregated-fit kernel heap.
+ *
+ * Free blocks live in KHEAP_NUM_BINS power-of-two size classes; a bitmap of
+ * non-empty bins lets kmalloc find a fitting class with a single bsf.  Any
+ * block in a class strictly above the request's class is guaranteed to fit,
+ * so allocation never walks a list.  Header/footer boundary tags let kfree
+ * merge with both neighbours in O(1) without an address-sorted free list.
+ *
+ * The heap is bracketed by a used prologue footer and a zero-sized used
+ * epilogue header so coalescing never runs off either end.
+ *
+ * Only KHEAP_MIN_SIZE is backed at boot.  When no bin fits, kheap_grow maps
+ * more frames past the end; the old epilogue becomes the header of the new
+ * free block.  The window's page tables exist from boot (paging_init), so
+ * new heap pages are visible in every address space without any syncing.
+ */
+
+#define KHEAP_HEADER_SIZE   offsetof(kheap_block_t, next_free)
+#define KHEAP_OVERHEAD      (KHEAP_HEADER_SIZE + sizeof(kheap_footer_t))
+#define MIN_BLOCK_SIZE      ALIGN_UP(sizeof(kheap_block_t) + sizeof(kheap_footer_t), KHEAP_ALIGNMENT)
 
 uint8_t *kheap_start;
 uint8_t *kheap_end;
 uint8_t *kheap_curr;
 
-static kheap_block_t *free_list;
+static kheap_block_t *bins[KHEAP_NUM_BINS];
+static uint32_t bin_bitmap;
+static size_t kheap_free_bytes;
+static uint8_t *kheap_limit;    // KHEAP_START + kheap_max_size()
 static spinlock_t kheap_lock;
 
-void *kmalloc(size_t size) {
+static inline uint32_t bin_index(size_t size) {
+    return 31 - __builtin_clz(size);
+}
+
+static inline void *block_payload(kheap_block_t *block) {
+    return (uint8_t *)block + KHEAP_HEADER_SIZE;
+}
+
+static inline kheap_block_t *payload_block(void *ptr) {
+    return (kheap_block_t *)((uint8_t *)ptr - KHEAP_HEADER_SIZE);
+}
+
+static inline kheap_footer_t *block_footer(kheap_block_t *block) {
+    return (kheap_footer_t *)((uint8_t *)block + KHEAP_SIZE(block->size) - sizeof(kheap_footer_t));
+}
+
+static inline kheap_block_t *next_block(kheap_block_t *block) {
+    return (kheap_block_t *)((uint8_t *)block + KHEAP_SIZE(block->size));
+}
+
+// Returns the physically preceding block if it is free, NULL otherwise
+static inline kheap_block_t *prev_free_block(kheap_block_t *block) {
+    kheap_footer_t prev = *(kheap_footer_t *)((uint8_t *)block - sizeof(kheap_footer_t));
+    if (prev & KHEAP_USED) return NULL;
+    return (kheap_block_t *)((uint8_t *)block - KHEAP_SIZE(prev));
+}
+
+static inline void set_block(kheap_block_t *block, size_t size, bool used) {
+    block->size = size | (used ? KHEAP_USED : 0);
+    block->magic = KHEAP_MAGIC;
+    *block_footer(block) = block->size;
+}
+
+static void bin_insert(kheap_block_t *block) {
+    uint32_t idx = bin_index(KHEAP_SIZE(block->size));
+    block->prev_free = NULL;
+    block->next_free = bins[idx];
+    if (bins[idx]) bins[idx]->prev_free = block;
+    bins[idx] = block;
+    bin_bitmap |= (1u << idx);
+    kheap_free_bytes += KHEAP_SIZE(block->size);
+}
+
+static void bin_remove(kheap_block_t *block) {
+    uint32_t idx = bin_index(KHEAP_SIZE(block->size));
+    if (block->prev_free) block->prev_free->next_free = block->next_free;
+    else bins[idx] = block->next_free;
+    if (block->next_free) block->next_free->prev_free = block->prev_free;
+    if (!bins[idx]) bin_bitmap &= ~(1u << idx);
+    kheap_free_bytes -= KHEAP_SIZE(block->size);
+}
+
+// Find a free block of at least 'size' bytes in O(1)
+static kheap_block_t *find_block(size_t size) {
+    uint32_t idx = bin_index(size);
+
+    // The head of the request's own class may already be big enough
+    if (bins[idx] && KHEAP_SIZE(bins[idx]->size) >= size) return bins[idx];
+
+    // Otherwise every block in a higher class fits
+    uint32_t mask = (idx + 1 < KHEAP_NUM_BINS) ? bin_bitmap & ~((2u << idx) - 1) : 0;
+    if (!mask) return NULL;
+    return bins[__builtin_ctz(mask)];
+}
+
+// Mark a free block used, returning any tail beyond 'size' to the bins
+static void *take_block(kheap_block_t *block, size_t size) {
+    bin_remove(block);
+
+    size_t block_size = KHEAP_SIZE(block->size);
+    if (block_size >= size + MIN_BLOCK_SIZE) {
+        set_block(block, size, true);
+        kheap_block_t *rest = next_block(block);
+        set_block(rest, block_size - size, false);
+        bin_insert(rest);
+    } else {
+        set_block(block, block_size, true);
+    }
+
+    return block_payload(block);
+}
+
+// Map at least 'needed' more bytes at the end of the heap and free them into the bins
+static bool kheap_grow(size_t needed) {
+    size_t grow = ALIGN_UP(needed, KHEAP_GROW_SIZE);
+    if (grow > (size_t)(kheap_limit - kheap_end)) {
+        grow = kheap_limit - kheap_end;
+        if (grow < needed) return false;
+    }
+
+    for (size_t off = 0; off < grow; off += PAGE_SIZE) {
+        page_table_entry_t *page = get_page((uint32_t)kheap_end + off, 0, kpage_dir);
+        if (!page || !alloc_page(page, PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL)) {
+            // Out of frames: give back what this attempt mapped
+            while (off) {
+                off -= PAGE_SIZE;
+                free_page(get_page((uint32_t)kheap_end + off, 0, kpage_dir));
+                invalidate_page((uint32_t)kheap_end + off);
+            }
+            return false;
+        }
+    }
+
+    kheap_block_t *block = (kheap_block_t *)(kheap_end - KHEAP_HEADER_SIZE);
+    kheap_end += grow;
+
+    kheap_block_t *epilogue = (kheap_block_t *)(kheap_end - KHEAP_HEADER_SIZE);
+    epilogue->size = 0 | KHEAP_USED;
+    epilogue->magic = KHEAP_MAGIC;
+
+    size_t size = (uint8_t *)epilogue - (uint8_t *)block;
+    kheap_block_t *prev = prev_free_block(block);
+    if (prev) {
+        bin_remove(prev);
+        size += KHEAP_SIZE(prev->size);
+        block = prev;
+    }
+    set_block(block, size, false);
+    bin_insert(block);
+    return true;
+}
+
+uint32_t kheap_trim(uint32_t max_frames) {
     uint32_t flags;
     spinlock_acquire_irq(&kheap_lock, &flags);
 
-    if (size < KHEAP_ALIGNMENT) {
-        size = KHEAP_ALIGNMENT;
-    }
-
-    size = ALIGN_UP(size, KHEAP_ALIGNMENT);
-
-    kheap_block_t *cur_block = free_list;
-    kheap_block_t *prev_block = NULL;
-
-    while (cur_block) {
-        if (cur_block->size >= size) {
-            if (cur_block->size >= size + MIN_BLOCK_SIZE) {
-                // Split only if the remaining part is big enough for another block
-                kheap_block_t *new_block = (kheap_block_t *)((uint8_t *)cur_block + sizeof(kheap_block_t) + size);
-                new_block->size = cur_block->size - size - sizeof(kheap_block_t);
-                new_block->next = cur_block->next;
-
-                cur_block->size = size;
-
-                if (prev_block) {
-                    prev_block->next = new_block;
-                } else {
-                    free_list = new_block;
-                }
-            } else {
-                // Use the whole block
-                if (prev_block) {
-                    prev_block->next = cur_block->next;
-                } else {
-                    free_list = cur_block->next;
-                }
-            }
+    kheap_block_t *epilogue = (kheap_block_t *)(kheap_end - KHEAP_HEADER_SIZE);
+    kheap_block_t *last = prev_free_block(epilogue);
+    if (!last) {
+        spinlock_release_irq(&kheap_lock, flags);
+        return 0;
+    }
 
-            spinlock_release_irq(&kheap_lock, flags);
-            return (void *)((uint8_t *)cur_block + sizeof(kheap_block_t));
-        }
+    // The last free block stays, at least MIN_BLOCK_SIZE long, before the new epilogue
+    uint8_t *end = (uint8_t *)ALIGN_UP((uint32_t)last + MIN_BLOCK_SIZE + KHEAP_HEADER_SIZE, PAGE_SIZE);
+    if (end < kheap_start + KHEAP_MIN_SIZE) end = kheap_start + KHEAP_MIN_SIZE;
+    if ((uint32_t)(kheap_end - end) / PAGE_SIZE > max_frames) end = kheap_end - max_frames * PAGE_SIZE;
+    if (end >= kheap_end) {
+        spinlock_release_irq(&kheap_lock, flags);
+        return 0;
+    }
+
+    bin_remove(last);
+    uint32_t freed = 0;
+    for (uint8_t *addr = end; addr < kheap_end; addr += PAGE_SIZE, freed++) {
+        free_page(get_page((uint32_t)addr, 0, kpage_dir));
+        invalidate_page((uint32_t)addr);
+    }
+    kheap_end = end;
+
+    epilogue = (kheap_block_t *)(kheap_end - KHEAP_HEADER_SIZE);
+    epilogue->size = 0 | KHEAP_USED;
+    epilogue->magic = KHEAP_MAGIC;
+    set_block(last, (uint8_t *)epilogue - (uint8_t *)last, false);
+    bin_insert(last);
+
+    spinlock_release_irq(&kheap_lock, flags);
+    return freed;
+}
+
+// Empty slabs go back to the heap first, so more of its tail may be free
+static uint32_t kheap_shrink(uint32_t frames) {
+    kmem_cache_shrink_all();
+    return kheap_trim(frames);
+}
+
+// Takes kheap_lock, which kheap_grow holds while it allocates: background only
+static shrinker_t kheap_shrinker = {
+    .name = "kheap",
+    .scan = kheap_shrink,
+    .cost = SHRINK_COST_FREE,
+};
+
+static inline size_t request_size(size_t size) {
+    if (size < KHEAP_ALIGNMENT) size = KHEAP_ALIGNMENT;
+    size = ALIGN_UP(size + KHEAP_OVERHEAD, KHEAP_ALIGNMENT);
+    return size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size;
+}
 
-        prev_block = cur_block;
-        cur_block = cur_block->next;
+void *kmalloc(size_t size) {
+    uint32_t flags;
+    spinlock_acquire_irq(&kheap_lock, &flags);
+
+    size_t needed = request_size(size);
+    kheap_block_t *block = find_block(needed);
+    if (!block && kheap_grow(needed)) block = find_block(needed);
+    if (!block) {
+        printf("kmalloc: Out of memory, requested size: %x\n", size);
+        print_kheap();
+        spinlock_release_irq(&kheap_lock, flags);
+        return NULL; // Out of memory
     }
 
-    printf("kmalloc: Out of memory, requested size: %x\n", size);
-    print_kheap();
+    void *ptr = take_block(block, needed);
     spinlock_release_irq(&kheap_lock, flags);
-    return NULL; // Out of memory
+    return ptr;
 }
 
 void kfree(void *ptr) {
@@ -68,115 +246,154 @@ void kfree(void *ptr) {
 
     uint32_t flags;
     spinlock_acquire_irq(&kheap_lock, &flags);
-    kheap_block_t *block = (kheap_block_t *)((uint8_t *)ptr - sizeof(kheap_block_t));
+    kheap_block_t *block = payload_block(ptr);
+
+    if (block->magic != KHEAP_MAGIC || !(block->size & KHEAP_USED)) {
+        kprintf(WARNING, "kfree: invalid or double free of %x (caller=%x)\n",
+                ptr, (uint32_t)__builtin_return_address(0));
+        spinlock_release_irq(&kheap_lock, flags);
+        return;
+    }
 
-    // Insert back into the free list in sorted order
-    kheap_block_t *cur_block = free_list;
-    kheap_block_t *prev_block = NULL;
+    size_t size = KHEAP_SIZE(block->size);
 
-    while (cur_block && cur_block < block) {
-        prev_block = cur_block;
-        cur_block = cur_block->next;
+    // Coalesce with the following block
+    kheap_block_t *next = next_block(block);
+    if (!(next->size & KHEAP_USED)) {
+        bin_remove(next);
+        size += KHEAP_SIZE(next->size);
+        next->magic = 0;
     }
 
-    block->next = cur_block;
-    if (prev_block) {
-        prev_block->next = block;
-    } else {
-        free_list = block;
+    // Coalesce with the preceding block
+    kheap_block_t *prev = prev_free_block(block);
+    if (prev) {
+        bin_remove(prev);
+        size += KHEAP_SIZE(prev->size);
+        block->magic = 0;
+        block = prev;
     }
 
-    // Coalesce adjacent blocks
-    // cur_block = free_list;
-    // while (cur_block && cur_block->next) {
-    //     kheap_block_t *next_block = cur_block->next;
+    set_block(block, size, false);
+    bin_insert(block);
+
+    spinlock_release_irq(&kheap_lock, flags);
+}
+
+void *kmalloc_aligned(size_t size, size_t align) {
+    if (align <= KHEAP_ALIGNMENT) return kmalloc(size);
+
+    uint32_t flags;
+    spinlock_acquire_irq(&kheap_lock, &flags);
 
-    //     if ((uint8_t *)cur_block + cur_block->size + sizeof(kheap_block_t) == (uint8_t *)next_block) {
-    //         // Combine adjacent blocks
-    //         cur_block->size += next_block->size + sizeof(kheap_block_t);
-    //         cur_block->next = next_block->next;
-    //     } else {
-    //         cur_block = next_block;
-    //     }
-    // }
+    // Over-allocate so an aligned payload with a splittable lead-in always fits
+    size_t needed = request_size(size);
+    kheap_block_t *block = find_block(needed + align + MIN_BLOCK_SIZE);
+    if (!block && kheap_grow(needed + align + MIN_BLOCK_SIZE)) {
+        block = find_block(needed + align + MIN_BLOCK_SIZE);
+    }
+    if (!block) {
+        printf("kmalloc_aligned: Out of memory, requested size: %x align: %x\n", size, align);
+        spinlock_release_irq(&kheap_lock, flags);
+        return NULL;
+    }
 
-    if (block->next && (uint8_t *)block + block->size + sizeof(kheap_block_t) == (uint8_t *)block->next) {
-        block->size += block->next->size + sizeof(kheap_block_t);
-        block->next = block->next->next;
+    uintptr_t payload = (uintptr_t)block_payload(block);
+    uintptr_t aligned = ALIGN_UP(payload, align);
+    if (aligned != payload && aligned - payload < MIN_BLOCK_SIZE) {
+        // The lead-in must be big enough to stand as a free block of its own
+        aligned = ALIGN_UP(payload + MIN_BLOCK_SIZE, align);
     }
 
-    // Coalesce with previous
-    if (prev_block && (uint8_t *)prev_block + prev_block->size + sizeof(kheap_block_t) == (uint8_t *)block) {
-        prev_block->size += block->size + sizeof(kheap_block_t);
-        prev_block->next = block->next;
+    if (aligned != payload) {
+        // Give the lead-in back to the bins as its own free block
+        size_t lead = aligned - payload;
+        size_t block_size = KHEAP_SIZE(block->size);
+        bin_remove(block);
+        set_block(block, lead, false);
+        bin_insert(block);
+
+        block = payload_block((void *)aligned);
+        set_block(block, block_size - lead, false);
+        bin_insert(block);
     }
 
+    void *ptr = take_block(block, needed);
     spinlock_release_irq(&kheap_lock, flags);
+    return ptr;
 }
 
-void *kmalloc_aligned(size_t size, size_t align) {
-    uintptr_t raw_mem = (uintptr_t)kmalloc(size + align + sizeof(void*));
-    if (!raw_mem) return NULL;
+// Aligned blocks are ordinary heap blocks, so they free the same way
+void kfree_aligned(void *ptr) {
+    kfree(ptr);
+}
 
-    // Store the original pointer just before the aligned pointer
-    uintptr_t aligned = (raw_mem + sizeof(void*) + align - 1) & ~(align - 1);
-    ((void**)aligned)[-1] = (void*)raw_mem;
-    return (void*)aligned;
+size_t kheap_used() {
+    return (size_t)(kheap_end - kheap_start) - kheap_free_bytes;
 }
 
-void kfree_aligned(void *ptr) {
-    if (ptr) {
-        // Get the original pointer from just before the aligned pointer
-        void *raw_ptr = ((void**)ptr)[-1];
-        kfree(raw_ptr);
-    }
+size_t kheap_size() {
+    return (size_t)(kheap_end - kheap_start);
 }
 
-size_t kheap_used() {
-    size_t free = 0;
-    kheap_block_t *cur = free_list;
-    while (cur) {
-        free += cur->size + sizeof(kheap_block_t);
-        cur = cur->next;
-    }
-    return KHEAP_INITIAL_SIZE - free;
+size_t kheap_max_size() {
+    // In frames first: 4GB of RAM or more would wrap a byte count
+    uint32_t frames = pmm_get_total_blocks();
+    size_t max = frames < KHEAP_MAX_SIZE / PAGE_SIZE ? frames * PAGE_SIZE : KHEAP_MAX_SIZE;
+    max &= ~(KHEAP_GROW_SIZE - 1);
+    return max < KHEAP_MIN_SIZE ? KHEAP_MIN_SIZE : max;
 }
 
 void print_kheap() {
-    kheap_block_t *cur_block = free_list;
     uint32_t total_free = 0;
-    while (cur_block) {
-        printf("\nFree Blocks: %x, Size: %x", cur_block, cur_block->size);
-        total_free += cur_block->size;
-        cur_block = cur_block->next;
+    for (uint32_t i = 0; i < KHEAP_NUM_BINS; i++) {
+        uint32_t count = 0;
+        uint32_t bytes = 0;
+        for (kheap_block_t *b = bins[i]; b; b = b->next_free) {
+            count++;
+            bytes += KHEAP_SIZE(b->size);
+        }
+        if (count) {
+            printf("\nBin %d (>= %x): %d blocks, %x bytes", i, 1u << i, count, bytes);
+        }
+        total_free += bytes;
     }
-    printf("\nTotal Free: %x\n", total_free);
+    printf("\nTotal Free: %x of %x mapped (max %x)\n", total_free,
+           (uint32_t)(kheap_end - kheap_start), (uint32_t)(kheap_limit - kheap_start));
 }
 
 void *calloc(size_t num, size_t size) {
     size_t total_size = num * size;
     void *ptr = kmalloc(total_size);
-    
-    if (ptr) {
-        // Initialize allocated memory to 0
-        uint8_t *p = (uint8_t *)ptr;
-        for (size_t i = 0; i < total_size; i++) {
-            p[i] = 0;
-        }
-    }
-    
+
+    if (ptr) memset(ptr, 0, total_size);
+
     return ptr;
 }
 
 void kheap_init() {
-    // Allocate 48MB of memory for the kernel heap
+    // paging_init backed the first KHEAP_MIN_SIZE; the rest is mapped on demand
     kheap_start = (uint8_t *)KHEAP_START;
-    kheap_end = kheap_start + KHEAP_INITIAL_SIZE;
+    kheap_end = kheap_start + KHEAP_MIN_SIZE;
+    kheap_limit = kheap_start + kheap_max_size();
     kheap_curr = kheap_start;
 
-    free_list = (kheap_block_t *)kheap_start;
-    free_list->size = KHEAP_INITIAL_SIZE - sizeof(kheap_block_t);
-    free_list->next = NULL;
+    for (uint32_t i = 0; i < KHEAP_NUM_BINS; i++) bins[i] = NULL;
+    bin_bitmap = 0;
+    kheap_free_bytes = 0;
+
+    // Prologue: a used footer just before the first block
+    *(kheap_footer_t *)(kheap_start + KHEAP_ALIGNMENT - sizeof(kheap_footer_t)) = KHEAP_ALIGNMENT | KHEAP_USED;
+
+    // Epilogue: a zero-sized used header at the very end
+    kheap_block_t *epilogue = (kheap_block_t *)((uintptr_t)kheap_end - KHEAP_HEADER_SIZE);
+    epilogue->size = 0 | KHEAP_USED;
+    epilogue->magic = KHEAP_MAGIC;
+
+    kheap_block_t *first = (kheap_block_t *)(kheap_start + KHEAP_ALIGNMENT);
+    set_block(first, (uint8_t *)epilogue - (uint8_t *)first, false);
+    bin_insert(first);
 
     spinlock_init(&kheap_lock);
-}
\ No newline at end of file
+    register_shrinker(&kheap_shrinker);
+}
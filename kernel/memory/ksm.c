@@ -0,0 +1,346 @@
+#include "kernel/ksm.h"
+#include "kernel/pmm.h"
+#include "kernel/kheap.h"
+#include "kernel/process.h"
+#include "kernel/zeropage.h"
+#include "kernel/shrinker.h"
+#include "kernel/locks.h"
+#include "kernel/printf.h"
+#include "kernel/system.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+extern process_t *process_list;
+extern page_directory_t *kpage_dir;
+
+// A merged frame; the table holds one reference on it
+typedef struct ksm_stable {
+    uint32_t hash;
+    uint32_t frame;
+    struct ksm_stable *next;
+} ksm_stable_t;
+
+// A page seen once this pass.  pid 0: dir belongs to ksm_merge_range's caller.
+typedef struct ksm_unstable {
+    uint32_t hash;
+    uint32_t frame;             // 0 once merged
+    page_directory_t *dir;
+    size_t pid;
+    uint32_t vaddr;
+    struct ksm_unstable *next;
+} ksm_unstable_t;
+
+static ksm_stable_t *stable[KSM_HASH_BUCKETS];
+static ksm_unstable_t *unstable[KSM_HASH_BUCKETS];
+static ksm_unstable_t unstable_pool[KSM_UNSTABLE_MAX];
+static uint32_t nr_unstable;
+// Allocated with the lock dropped: kmalloc may reclaim, and reclaim may
+// evict the very PTEs a merge is looking at
+static ksm_stable_t *spare;
+
+static ksm_stats_t stats;
+// Held with interrupts off across each page, so no user code writes to a
+// page between comparing it and write-protecting it
+static spinlock_t ksm_lock;
+
+// ksmd's position: the process it points into and the next user address there
+static size_t cursor_pid;
+static uint32_t cursor_vaddr;
+
+static uint32_t page_hash(const uint32_t *words) {
+    uint32_t hash = 2166136261u;    // FNV-1a over words
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool page_is_zero(const uint32_t *words) {
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (words[i]) return false;
+    }
+    return true;
+}
+
+static bool same_frames(uint32_t a, uint32_t b) {
+    void *pa = kmap_frame(a, KSM_TMP);
+    void *pb = kmap_frame(b, KSM_TMP + PAGE_SIZE);
+    bool same = memcmp(pa, pb, PAGE_SIZE) == 0;
+    kunmap_frame(b, KSM_TMP + PAGE_SIZE);
+    kunmap_frame(a, KSM_TMP);
+    return same;
+}
+
+// Private, single-owner RAM: the only pages worth merging
+static bool mergeable(uint32_t vaddr, page_table_entry_t *page) {
+    if (!page->present || !page->user || page->shared) return false;
+    if (vaddr == SIGRETURN_TRAMPOLINE_ADDR) return false;
+    uint32_t frame = page->frame;
+    return frame < pmm_get_total_blocks() && !is_zero_frame(frame) &&
+           pmm_get_refcount(frame) == 1;
+}
+
+static bool scannable(process_t *proc) {
+    return !proc->is_kernel_process && proc->status != ZOMBIE &&
+           proc->root_page_table && proc->root_page_table != kpage_dir;
+}
+
+// Read-only from now on; a write takes a private copy in cow_break
+static void write_protect(page_directory_t *dir, uint32_t vaddr, page_table_entry_t *page) {
+    page->cow = page->cow || page->rw;
+    page->rw = 0;
+    if (dir == get_active_page_directory()) invalidate_page(vaddr);
+}
+
+// Point page at frame (a merged copy of its contents) and drop its own frame
+static void share_frame(page_directory_t *dir, uint32_t vaddr, page_table_entry_t *page, uint32_t frame) {
+    uint32_t old = page->frame;
+    pmm_ref_frame(frame);
+    page->frame = frame;
+    write_protect(dir, vaddr, page);
+    pmm_free_block(old);
+}
+
+// The PTE behind an unstable entry, if it still maps the same private frame
+static page_table_entry_t *unstable_pte(ksm_unstable_t *u) {
+    if (!u->frame) return NULL;
+    if (u->pid) {
+        process_t *proc = get_process(u->pid);
+        if (!proc || !scannable(proc) || proc->root_page_table != u->dir) return NULL;
+    }
+    page_table_entry_t *page = get_page(u->vaddr, 0, u->dir);
+    if (!page || !mergeable(u->vaddr, page) || page->frame != u->frame) return NULL;
+    return page;
+}
+
+static void unstable_add(page_directory_t *dir, size_t pid, uint32_t vaddr, uint32_t frame, uint32_t hash) {
+    if (nr_unstable == KSM_UNSTABLE_MAX) return;
+    ksm_unstable_t *u = &unstable_pool[nr_unstable++];
+    u->hash = hash;
+    u->frame = frame;
+    u->dir = dir;
+    u->pid = pid;
+    u->vaddr = vaddr;
+    u->next = unstable[hash % KSM_HASH_BUCKETS];
+    unstable[hash % KSM_HASH_BUCKETS] = u;
+}
+
+static void unstable_reset(void) {
+    memset(unstable, 0, sizeof(unstable));
+    nr_unstable = 0;
+}
+
+// Give back merged frames nobody maps any more; ksm_lock held
+static uint32_t stable_prune(void) {
+    uint32_t freed = 0;
+    for (uint32_t b = 0; b < KSM_HASH_BUCKETS; b++) {
+        ksm_stable_t **link = &stable[b];
+        while (*link) {
+            ksm_stable_t *node = *link;
+            if (pmm_get_refcount(node->frame) > 1) {
+                link = &node->next;
+                continue;
+            }
+            *link = node->next;
+            pmm_free_block(node->frame);
+            kfree(node);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+// Without waiting for ksmd's next pass.  Frees nodes into the heap under
+// ksm_lock, so background only.
+static uint32_t ksm_shrink(uint32_t frames) {
+    (void)frames;
+    uint32_t flags;
+    spinlock_acquire_irq(&ksm_lock, &flags);
+    uint32_t freed = stable_prune();
+    spinlock_release_irq(&ksm_lock, flags);
+    return freed;
+}
+
+static shrinker_t ksm_shrinker = {
+    .name = "ksm",
+    .scan = ksm_shrink,
+    .cost = SHRINK_COST_FREE,
+};
+
+// Look for a copy of the page at vaddr and merge with it; ksm_lock held.
+// Returns 1 if its frame was freed.
+static uint32_t scan_page(page_directory_t *dir, size_t pid, uint32_t vaddr, page_table_entry_t *page) {
+    stats.scanned++;
+    if (!mergeable(vaddr, page)) return 0;
+    if (page->dirty) {
+        // Written since the last look: too volatile to be worth sharing yet
+        page->dirty = 0;
+        if (dir == get_active_page_directory()) invalidate_page(vaddr);
+        return 0;
+    }
+
+    uint32_t frame = page->frame;
+    const uint32_t *words = kmap_frame(frame, KSM_TMP);
+    bool zero = page_is_zero(words);
+    uint32_t hash = zero ? 0 : page_hash(words);
+    kunmap_frame(frame, KSM_TMP);
+
+    if (zero && zero_frame) {
+        share_frame(dir, vaddr, page, zero_frame);
+        stats.zero_merges++;
+        return 1;
+    }
+
+    for (ksm_stable_t *node = stable[hash % KSM_HASH_BUCKETS]; node; node = node->next) {
+        if (node->hash != hash || !same_frames(frame, node->frame)) continue;
+        share_frame(dir, vaddr, page, node->frame);
+        return 1;
+    }
+
+    for (ksm_unstable_t *u = unstable[hash % KSM_HASH_BUCKETS]; u; u = u->next) {
+        if (u->hash != hash || u->frame == frame) continue;
+        page_table_entry_t *other = unstable_pte(u);
+        if (!other || !same_frames(frame, u->frame)) continue;
+        if (!spare) return 0;
+
+        // Second copy: the first one's frame becomes the merged frame
+        ksm_stable_t *node = spare;
+        spare = NULL;
+        node->hash = hash;
+        node->frame = u->frame;
+        node->next = stable[hash % KSM_HASH_BUCKETS];
+        stable[hash % KSM_HASH_BUCKETS] = node;
+        pmm_ref_frame(node->frame);
+        write_protect(u->dir, u->vaddr, other);
+        u->frame = 0;
+
+        share_frame(dir, vaddr, page, node->frame);
+        return 1;
+    }
+
+    unstable_add(dir, pid, vaddr, frame, hash);
+    return 0;
+}
+
+static void refill_spare(void) {
+    if (!spare) spare = kmalloc(sizeof(ksm_stable_t));
+}
+
+uint32_t ksm_merge_range(page_directory_t *dir, uint32_t start, uint32_t end) {
+    uint32_t freed = 0;
+    for (uint32_t vaddr = PAGE_ALIGN(start); vaddr < end; vaddr += PAGE_SIZE) {
+        page_table_entry_t *page = get_page(vaddr, 0, dir);
+        if (!page) continue;
+        refill_spare();
+
+        uint32_t flags;
+        spinlock_acquire_irq(&ksm_lock, &flags);
+        freed += scan_page(dir, 0, vaddr, page);
+        spinlock_release_irq(&ksm_lock, flags);
+    }
+
+    // dir is the caller's and may be gone by ksmd's next step: forget this
+    // range's candidates, along with those of ksmd's current pass
+    uint32_t flags;
+    spinlock_acquire_irq(&ksm_lock, &flags);
+    unstable_reset();
+    spinlock_release_irq(&ksm_lock, flags);
+    return freed;
+}
+
+// Move the cursor through proc's user PTEs for at most *budget of them;
+// false once it reaches the kernel half
+static bool scan_process(process_t *proc, uint32_t *budget) {
+    page_directory_t *dir = proc->root_page_table;
+
+    while (cursor_vaddr < LOAD_MEMORY_ADDRESS) {
+        if (!*budget) return true;
+        uint32_t pd = PDE_INDEX(cursor_vaddr);
+        page_table_t *table = dir->ref_tables[pd];
+        if (!dir->tables[pd].present || dir->tables[pd].page_size || !table) {
+            cursor_vaddr = (pd + 1) << PDE_SHIFT;
+            continue;
+        }
+
+        uint32_t vaddr = cursor_vaddr;
+        cursor_vaddr += PAGE_SIZE;
+        (*budget)--;
+        scan_page(dir, proc->pid, vaddr, &table->pages[PTE_INDEX(vaddr)]);
+    }
+    return false;
+}
+
+// One ksmd batch, ending early at the end of a pass.  The process is
+// found again by pid each time round, since it may exit in between.
+static void ksm_scan_batch(void) {
+    uint32_t budget = KSM_PAGES_TO_SCAN;
+    while (budget) {
+        refill_spare();
+
+        uint32_t flags;
+        spinlock_acquire_irq(&ksm_lock, &flags);
+        process_t *proc = process_list;
+        while (proc && proc->pid != cursor_pid) proc = proc->next;
+        if (!proc) {
+            // A new pass (or the process went away): start from the top
+            proc = process_list;
+            cursor_vaddr = 0;
+            unstable_reset();
+            stable_prune();
+        }
+
+        if (!proc || !scannable(proc) || !scan_process(proc, &budget)) {
+            cursor_vaddr = 0;
+            proc = proc ? proc->next : NULL;
+            if (!proc) stats.full_scans++;
+        }
+        cursor_pid = proc ? proc->pid : 0;
+        spinlock_release_irq(&ksm_lock, flags);
+
+        if (!proc) break;
+    }
+}
+
+static void ksmd_main(void) {
+    for (;;) {
+        ksm_scan_batch();
+        thread_sleep(KSM_SLEEP_TICKS);
+    }
+}
+
+void ksm_init(void) {
+    spinlock_init(&ksm_lock);
+    process_t *ksmd = create_process("ksmd", ksmd_main, PROCESS_FLAG_KERNEL);
+    if (!ksmd) {
+        kprintf(ERROR, "ksm: cannot start ksmd\n");
+        return;
+    }
+    schedule_process_threads(ksmd);
+    register_shrinker(&ksm_shrinker);
+}
+
+void ksm_get_stats(ksm_stats_t *out) {
+    uint32_t flags;
+    spinlock_acquire_irq(&ksm_lock, &flags);
+    *out = stats;
+    out->pages_shared = 0;
+    out->pages_sharing = 0;
+    for (uint32_t b = 0; b < KSM_HASH_BUCKETS; b++) {
+        for (ksm_stable_t *node = stable[b]; node; node = node->next) {
+            // One reference is the table's own
+            uint32_t mappings = pmm_get_refcount(node->frame) - 1;
+            if (!mappings) continue;
+            out->pages_shared++;
+            out->pages_sharing += mappings - 1;
+        }
+    }
+    spinlock_release_irq(&ksm_lock, flags);
+}
+
+int ksm_format_stats(char *buf, size_t size) {
+    ksm_stats_t st;
+    ksm_get_stats(&st);
+    return snprintf(buf, size,
+                    "pages_shared %d\npages_sharing %d\nzero_merges %d\nscanned %d\nfull_scans %d\n",
+                    st.pages_shared, st.pages_sharing, st.zero_merges, st.scanned, st.full_scans);
+}
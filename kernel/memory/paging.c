@@ -1,6 +1,8 @@
 #include "kernel/isr.h"
 #include "kernel/paging.h"
 #include "kernel/pmm.h"
+#include "kernel/pgtable.h"
+#include "kernel/vmalloc.h"
 #include "kernel/kheap.h"
 #include "kernel/printf.h"
 #include "libc/string.h"
@@ -9,10 +11,16 @@
 #include "kernel/system.h"
 #include "kernel/process.h"
 #include "kernel/exceptions.h"
+#include "kernel/uaccess.h"
+#include "kernel/zeropage.h"
+#include "kernel/filemap.h"
+#include "kernel/tlb.h"
+#include "kernel/swap.h"
 
 uint8_t * temp_mem;
 page_directory_t *kpage_dir; // Kernel page directory
 uint32_t kpage_dir_phys;
+static page_directory_t *current_dir;   // directory loaded in CR3
 
 extern uint8_t *bitmap;
 extern uint32_t bitmap_size;
@@ -39,8 +47,20 @@ void dumb_kmalloc_finalize() {
     temp_mem = NULL;
 }
 
+static uint32_t phys_map_size;   // bytes of RAM covered by the direct map
+static bool pse_enabled;         // CR4.PSE is set (boot.s) and CPUID reports it
+static bool pat_enabled;         // PAT entry 1 is write-combining (PAGE_WC)
+
+#define PAT_TYPE_WC 0x01
+
 void *phys_to_virt(uint32_t phys) {
-    return (void *)(phys + LOAD_MEMORY_ADDRESS);
+    if (phys >= phys_map_size) return NULL;
+    return (void *)(PHYS_MAP_BASE + phys);
+}
+
+void *frame_to_virt(uint32_t frame) {
+    if (frame >= phys_map_size / PAGE_SIZE) return NULL;
+    return (void *)(PHYS_MAP_BASE + frame * PAGE_SIZE);
 }
 
 void * virtual2physical(page_directory_t * dir, void * virtual) {
@@ -48,10 +68,15 @@ void * virtual2physical(page_directory_t * dir, void * virtual) {
         return virtual - LOAD_MEMORY_ADDRESS;
     }
 
-    uint32_t pd_index = (uint32_t)virtual >> 22;
-    uint32_t pt_index = ((uint32_t)virtual >> 12) & 0x3FF;
+    uint32_t pd_index = PDE_INDEX(virtual);
+    uint32_t pt_index = PTE_INDEX(virtual);
     uint32_t page_frame_offset = (uint32_t)virtual & 0xFFF;
 
+    page_directory_entry_t pde = dir->tables[pd_index];
+    if (pde.present && pde.page_size) {
+        return (void *)(((uint32_t)pde.frame << 12) | ((uint32_t)virtual & (LARGE_PAGE_SIZE - 1)));
+    }
+
     page_table_t * table = dir->ref_tables[pd_index];
     if(!table) {
         printf("virtual2phys: page dir entry does not exist\n");
@@ -64,15 +89,21 @@ void * virtual2physical(page_directory_t * dir, void * virtual) {
         return NULL;
     }
 
-    return (void *)((pt_entry.frame << 12) | page_frame_offset);
+    return (void *)(((uint32_t)pt_entry.frame << 12) | page_frame_offset);
 }
 
 void enable_paging() {
     uint32_t cr0;
     asm volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
+    // PG, plus WP so kernel writes to read-only (COW) user pages fault too
+    cr0 |= 0x80010000;
     asm volatile("mov %0, %%cr0" :: "r"(cr0));
 
+    // Kernel mappings are global, so CR3 reloads keep them in the TLB
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_EDX_PGE) write_cr4(read_cr4() | CR4_PGE);
+
     paging_enabled = 1;
 }
 
@@ -85,9 +116,7 @@ void get_cr3(uint32_t *cr3) {
 }
 
 page_directory_t *get_active_page_directory() {
-    uint32_t cr3;
-    asm volatile ("mov %%cr3, %0" : "=r"(cr3));
-    return (page_directory_t *)phys_to_virt(cr3);
+    return current_dir;
 }
 
 // Get a page table entry for a given virtual address
@@ -99,8 +128,16 @@ page_table_entry_t *get_page(uint32_t virtual, int make, page_directory_t *dir)
                 virtual, (uint32_t)__builtin_return_address(0));
         return NULL;
     }
-    uint32_t pd_index = virtual >> 22;
-    uint32_t pt_index = (virtual >> 12) & 0x3FF;
+    uint32_t pd_index = PDE_INDEX(virtual);
+    uint32_t pt_index = PTE_INDEX(virtual);
+
+    if (dir->tables[pd_index].page_size) {
+        if (make) {
+            kprintf(WARNING, "get_page: %x lies in a large page (caller=%x)\n",
+                    virtual, (uint32_t)__builtin_return_address(0));
+        }
+        return NULL;
+    }
 
     if (!dir->ref_tables[pd_index]) {
         if (!make) return NULL;
@@ -108,7 +145,7 @@ page_table_entry_t *get_page(uint32_t virtual, int make, page_directory_t *dir)
         if (!paging_enabled) {
             table = (page_table_t*) dumb_kmalloc(sizeof(page_table_t), 1);
         } else {
-            table = (page_table_t*) kmalloc_aligned(sizeof(page_table_t), PAGE_SIZE);
+            table = pgtable_alloc_table();
         }
         // TODO:
         if (!table) {
@@ -146,10 +183,18 @@ bool alloc_page(page_table_entry_t *page, uint32_t flags) {
     page->present = 1;
     page->rw = (flags & PAGE_RW) ? 1 : 0;
     page->user = (flags & PAGE_USER) ? 1 : 0;
+    page->global = (flags & PAGE_GLOBAL) ? 1 : 0;
     return true;
 }
 
 void free_page(page_table_entry_t *page) {
+    if (page && !page->present && page->lazy) {
+        // Reserved but never touched, or swapped out: no frame to give back
+        if (pte_is_swap(page)) swap_free(page);
+        memset(page, 0, sizeof(page_table_entry_t));
+        return;
+    }
+
     if (!page || !page->present) {
         printf("free_page: Page not present\n");
         return;
@@ -174,6 +219,7 @@ void map_page_to_frame(page_table_entry_t *page, uint32_t frame, uint32_t flags)
     page->present = 1;
     page->rw      = (flags & PAGE_RW)   ? 1 : 0;
     page->user    = (flags & PAGE_USER) ? 1 : 0;
+    page->global  = (flags & PAGE_GLOBAL) ? 1 : 0;
 }
 
 void map_memory(page_directory_t *dir, uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags) {
@@ -210,21 +256,100 @@ void map_memory(page_directory_t *dir, uint32_t virtual_start, uint32_t physical
             page->present = 1;
             page->rw = (flags & PAGE_RW) ? 1 : 0;
             page->user = (flags & PAGE_USER) ? 1 : 0;
+            page->global = (flags & PAGE_GLOBAL) ? 1 : 0;
+            page->write_through = (flags & PAGE_WC) && pat_enabled;
+            page->shared = (flags & PAGE_SHARED) ? 1 : 0;
+        }
+    }
+}
+
+void reserve_memory(page_directory_t *dir, uint32_t virtual_start, uint32_t size, uint32_t flags) {
+    uint32_t start = PAGE_ALIGN(virtual_start);
+    uint32_t end = PAGE_ALIGN_UP(virtual_start + size);
+
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        page_table_entry_t *page = get_page(addr, 1, dir);
+        if (!page) {
+            printf("reserve_memory: Failed to get page for %x\n", addr);
+            continue;
         }
+        if (page->present || pte_is_swap(page)) continue;
+
+        // A non-present PTE is ignored by the MMU, so its bits describe the reservation
+        memset(page, 0, sizeof(page_table_entry_t));
+        page->lazy = 1;
+        page->rw   = (flags & PAGE_RW)   ? 1 : 0;
+        page->user = (flags & PAGE_USER) ? 1 : 0;
     }
 }
 
 void kmap_memory(uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags) {
+    // The kernel half is identical in every directory, so keep it across CR3 loads
+    if (virtual_start >= LOAD_MEMORY_ADDRESS) flags |= PAGE_GLOBAL;
     map_memory(kpage_dir, virtual_start, physical_start, size, flags);
 }
 
+void kmap_large(uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags) {
+    bool should_alloc = (physical_start == (uint32_t)-1);
+    if (virtual_start >= LOAD_MEMORY_ADDRESS) flags |= PAGE_GLOBAL;
+
+    uint32_t offset = 0;
+    while (offset < size) {
+        uint32_t virt = virtual_start + offset;
+        uint32_t phys = should_alloc ? (uint32_t)-1 : physical_start + offset;
+        uint32_t pd_index = PDE_INDEX(virt);
+
+        bool large = pse_enabled && size - offset >= LARGE_PAGE_SIZE && IS_LARGE_ALIGN(virt) &&
+                     (should_alloc || IS_LARGE_ALIGN(phys)) &&
+                     !kpage_dir->tables[pd_index].present;
+        if (large && should_alloc) {
+            // A buddy block of LARGE_PAGE_ORDER is one naturally aligned large page
+            uint32_t block = pmm_try_alloc_pages(PMM_ZONE_HIGH, LARGE_PAGE_ORDER);
+            if (block) phys = block * PAGE_SIZE;
+            else large = false;
+        }
+
+        if (!large) {
+            // Fall back to 4K pages up to the next large-page boundary
+            uint32_t chunk = LARGE_PAGE_SIZE - (virt & (LARGE_PAGE_SIZE - 1));
+            if (chunk > size - offset) chunk = size - offset;
+            map_memory(kpage_dir, virt, phys, chunk, flags);
+            offset += chunk;
+            continue;
+        }
+
+        page_directory_entry_t *pde = &kpage_dir->tables[pd_index];
+        memset(pde, 0, sizeof(*pde));
+        pde->frame = phys >> 12;
+        pde->present = 1;
+        pde->rw = (flags & PAGE_RW) ? 1 : 0;
+        pde->user = (flags & PAGE_USER) ? 1 : 0;
+        pde->global = (flags & PAGE_GLOBAL) ? 1 : 0;
+        pde->write_through = (flags & PAGE_WC) && pat_enabled;
+        pde->shared = (flags & PAGE_SHARED) ? 1 : 0;
+        pde->page_size = 1;
+        if (paging_enabled) invalidate_page(virt);
+        offset += LARGE_PAGE_SIZE;
+    }
+}
+
+#ifdef CONFIG_PAE
+void pdpt_init(page_directory_t *dir) {
+    for (uint32_t i = 0; i < PDPT_ENTRIES; i++) {
+        // Only the present and cache bits are defined in a PAE PDPT entry
+        uint32_t phys = (uint32_t)virtual2physical(kpage_dir, &dir->tables[i * PAGE_ENTRIES]);
+        dir->pdpt[i] = phys | PAGE_PRESENT;
+    }
+}
+#endif
+
 void switch_page_directory(page_directory_t *dir) {
     // Set the CR3 register to the physical address of the page directory
     uint32_t phys;
     if (dir == kpage_dir) {
         phys = kpage_dir_phys;  // always known, no table walk needed
     } else {
-        phys = (uint32_t)virtual2physical(kpage_dir, dir);
+        phys = (uint32_t)virtual2physical(kpage_dir, (uint8_t *)dir + DIR_CR3_OFFSET);
     }
     if (!phys) {
         kprintf(ERROR, "switch_page_directory: failed to resolve %x\n", dir);
@@ -232,14 +357,15 @@ void switch_page_directory(page_directory_t *dir) {
     }
 
     asm volatile("mov %0, %%cr3" :: "r"(phys) : "memory");
+    current_dir = dir;
 }
 
 // Internal helper — map a physical frame into a kernel temp window
 static page_table_entry_t *map_tmp(uint32_t vaddr, uint32_t frame) {
     page_table_entry_t *page = get_page(vaddr, 1, kpage_dir);
     ASSERT(!page->present);
+    // Not-present entries are never cached, so there is nothing to invalidate
     map_page_to_frame(page, frame, PAGE_RW);
-    invalidate_page(vaddr);
     return page;
 }
 
@@ -247,14 +373,157 @@ static page_table_entry_t *map_tmp(uint32_t vaddr, uint32_t frame) {
 static void unmap_tmp(uint32_t vaddr, uint32_t frame) {
     page_table_entry_t *page = get_page(vaddr, 0, kpage_dir);
     if (!page || !page->present) return;
-    pmm_free_block(frame);   // decrement refcount from map_page_to_frame
     page->present = 0;
     page->frame   = 0;
     invalidate_page(vaddr);
+    pmm_free_block(frame);   // decrement refcount from map_page_to_frame, after the flush
+}
+
+// Kernel address for a frame: the direct map when it covers the frame,
+// otherwise a temp window (rare: device memory or RAM beyond PHYS_MAP_MAX)
+// (compared as frame numbers: under PAE a frame's address can exceed 32 bits)
+void *kmap_frame(uint32_t frame, uint32_t window) {
+    if (frame < phys_map_size / PAGE_SIZE) return (void *)(PHYS_MAP_BASE + frame * PAGE_SIZE);
+    map_tmp(window, frame);
+    return (void *)window;
+}
+
+void kunmap_frame(uint32_t frame, uint32_t window) {
+    if (frame < phys_map_size / PAGE_SIZE) return;
+    unmap_tmp(window, frame);
+}
+
+bool pse_supported(void) {
+    return pse_enabled;
+}
+
+bool pat_supported(void) {
+    return pat_enabled;
+}
+
+// Turn PAT entry 1 (PWT=1, PCD=0, PAT=0) from write-through into
+// write-combining.  Nothing is mapped with PWT before this runs.
+static void pat_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_PAT)) return;
+
+    uint64_t pat = rdmsr(MSR_IA32_PAT);
+    pat = (pat & ~(0xFFULL << 8)) | ((uint64_t)PAT_TYPE_WC << 8);
+    asm volatile ("wbinvd" ::: "memory");
+    wrmsr(MSR_IA32_PAT, pat);
+    pat_enabled = true;
+}
+
+static void set_huge_pde(page_directory_entry_t *pde, uint32_t frame, uint32_t flags) {
+    memset(pde, 0, sizeof(*pde));
+    pde->frame = frame;
+    pde->present = 1;
+    pde->rw = (flags & PAGE_RW) ? 1 : 0;
+    pde->user = (flags & PAGE_USER) ? 1 : 0;
+    pde->page_size = 1;
+}
+
+// A large user page can only replace an empty directory slot
+static bool huge_slot_free(page_directory_t *dir, uint32_t virt) {
+    uint32_t pd_index = PDE_INDEX(virt);
+    return pse_enabled && IS_LARGE_ALIGN(virt) && virt < LOAD_MEMORY_ADDRESS &&
+           !dir->tables[pd_index].present && !dir->ref_tables[pd_index];
+}
+
+bool map_huge_page(page_directory_t *dir, uint32_t virt, uint32_t phys, uint32_t flags) {
+    if (!huge_slot_free(dir, virt) || !IS_LARGE_ALIGN(phys)) return false;
+
+    uint32_t frame = phys >> 12;
+    for (uint32_t i = 0; i < PAGE_ENTRIES; i++) pmm_ref_frame(frame + i);
+
+    page_directory_entry_t *pde = &dir->tables[PDE_INDEX(virt)];
+    set_huge_pde(pde, frame, flags);
+    pde->shared = 1;
+    return true;
+}
+
+bool alloc_huge_page(page_directory_t *dir, uint32_t virt, uint32_t flags) {
+    if (!huge_slot_free(dir, virt)) return false;
+
+    // One naturally aligned large page; each frame starts at refcount 1.
+    // Only reached through kmap_frame, so it may come from above 4GB.
+    uint32_t frame = pmm_try_alloc_pages(PMM_ZONE_HIGHMEM, LARGE_PAGE_ORDER);
+    if (!frame) return false;
+    for (uint32_t i = 0; i < PAGE_ENTRIES; i++) {
+        void *addr = kmap_frame(frame + i, UACCESS_TMP_DST);
+        memset(addr, 0, PAGE_SIZE);
+        kunmap_frame(frame + i, UACCESS_TMP_DST);
+    }
+
+    set_huge_pde(&dir->tables[PDE_INDEX(virt)], frame, flags);
+    return true;
+}
+
+bool free_huge_page(page_directory_t *dir, uint32_t virt) {
+    page_directory_entry_t *pde = &dir->tables[PDE_INDEX(virt)];
+    if (virt >= LOAD_MEMORY_ADDRESS || !pde->present || !pde->page_size) return false;
+
+    uint32_t frame = pde->frame;
+    memset(pde, 0, sizeof(*pde));
+    if (dir == current_dir) invalidate_page(virt & ~(LARGE_PAGE_SIZE - 1));
+    for (uint32_t i = 0; i < PAGE_ENTRIES; i++) pmm_deref_frame(frame + i);
+    return true;
+}
+
+void protect_memory(page_directory_t *dir, uint32_t start, uint32_t end, uint32_t flags) {
+    bool rw = (flags & PAGE_RW) != 0;
+    bool user = (flags & PAGE_USER) != 0;
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, dir);
+
+    for (uint32_t addr = start; addr < end; ) {
+        page_directory_entry_t *pde = &dir->tables[PDE_INDEX(addr)];
+        if (pde->present && pde->page_size) {
+            uint32_t base = addr & ~(LARGE_PAGE_SIZE - 1);
+            pde->rw = rw;
+            pde->user = user;
+            tlb_gather_page(&tlb, base);
+            addr = base + LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        page_table_entry_t *page = get_page(addr, 0, dir);
+        if (page && (page->present || page->lazy)) {
+            page->user = user;
+            bool is_ram = pmm_is_managed_frame(page->frame) || is_zero_frame(page->frame);
+            if (!rw) {
+                page->rw = 0;
+                page->cow = 0;
+            } else if (page->present && !page->shared && is_ram &&
+                       (page->cow || is_zero_frame(page->frame) ||
+                        pmm_get_refcount(page->frame) > 1)) {
+                // Shared with another process or the zero page: break on write
+                page->rw = 0;
+                page->cow = 1;
+            } else {
+                page->rw = 1;
+                page->cow = 0;
+            }
+            if (page->present) tlb_gather_page(&tlb, addr);
+        }
+        addr += PAGE_SIZE;
+    }
+    tlb_finish(&tlb);
+}
+
+// Frame behind vaddr when it lies in a user large page, else 0
+static uint32_t huge_frame(page_directory_t *dir, uint32_t vaddr) {
+    page_directory_entry_t *pde = &dir->tables[PDE_INDEX(vaddr)];
+    if (!pde->present || !pde->page_size) return 0;
+    return pde->frame + PTE_INDEX(vaddr);
 }
 
 int copy_to_user(page_directory_t *dir, uint32_t user_vaddr,
                  const void *src, size_t size) {
+    // The live address space is reached directly; faults resolve or fix up
+    if (dir == current_dir) return __copy_to_user((void *)user_vaddr, src, size);
+
     const uint8_t *ksrc = (const uint8_t *)src;
     uint32_t remaining = size;
     uint32_t offset = 0;
@@ -265,18 +534,24 @@ int copy_to_user(page_directory_t *dir, uint32_t user_vaddr,
         if (chunk > remaining) chunk = remaining;
 
         // Find the physical frame backing this user virtual address
-        page_table_entry_t *user_page = get_page(user_vaddr + offset, 0, dir);
-        if (!user_page || !user_page->present) {
-            kprintf(ERROR, "copy_to_user: page not mapped at %x\n", 
-                    user_vaddr + offset);
-            return -1;
-        }
+        uint32_t frame = huge_frame(dir, user_vaddr + offset);
+        if (!frame) {
+            page_table_entry_t *user_page = get_page(user_vaddr + offset, 0, dir);
+            if (user_page && user_page->lazy) demand_page(user_vaddr + offset, user_page, true);
+            if (!user_page || !user_page->present) {
+                kprintf(ERROR, "copy_to_user: page not mapped at %x\n", 
+                        user_vaddr + offset);
+                return -1;
+            }
 
-        // Map the physical frame into kernel temp window
+            // Writing through the physical frame bypasses the COW fault, so break it here
+            if (cow_break(dir, user_vaddr + offset, user_page) < 0) return -1;
+            frame = user_page->frame;
+        }
 
-        map_tmp(UACCESS_TMP_DST + page_offset, user_page->frame);
-        memcpy((void *)(UACCESS_TMP_DST + page_offset), ksrc + offset, chunk);
-        unmap_tmp(UACCESS_TMP_DST + page_offset, user_page->frame);
+        uint8_t *kaddr = kmap_frame(frame, UACCESS_TMP_DST);
+        memcpy(kaddr + page_offset, ksrc + offset, chunk);
+        kunmap_frame(frame, UACCESS_TMP_DST);
 
         offset    += chunk;
         remaining -= chunk;
@@ -287,6 +562,8 @@ int copy_to_user(page_directory_t *dir, uint32_t user_vaddr,
 
 int copy_from_user(page_directory_t *dir, void *dst,
                    uint32_t user_vaddr, size_t size) {
+    if (dir == current_dir) return __copy_from_user(dst, (const void *)user_vaddr, size);
+
     uint8_t *kdst = (uint8_t *)dst;
     uint32_t remaining = size;
     uint32_t offset = 0;
@@ -296,16 +573,59 @@ int copy_from_user(page_directory_t *dir, void *dst,
         uint32_t chunk = PAGE_SIZE - page_offset;
         if (chunk > remaining) chunk = remaining;
 
-        page_table_entry_t *user_page = get_page(user_vaddr + offset, 0, dir);
-        if (!user_page || !user_page->present) {
-            kprintf(ERROR, "copy_from_user: page not mapped at %x\n",
-                    user_vaddr + offset);
-            return -1;
+        uint32_t frame = huge_frame(dir, user_vaddr + offset);
+        if (!frame) {
+            page_table_entry_t *user_page = get_page(user_vaddr + offset, 0, dir);
+            if (user_page && user_page->lazy) demand_page(user_vaddr + offset, user_page, false);
+            if (!user_page || !user_page->present) {
+                kprintf(ERROR, "copy_from_user: page not mapped at %x\n",
+                        user_vaddr + offset);
+                return -1;
+            }
+            frame = user_page->frame;
+        }
+
+        uint8_t *kaddr = kmap_frame(frame, UACCESS_TMP_SRC);
+        memcpy(kdst + offset, kaddr + page_offset, chunk);
+        kunmap_frame(frame, UACCESS_TMP_SRC);
+
+        offset    += chunk;
+        remaining -= chunk;
+    }
+    return 0;
+}
+
+int clear_user(page_directory_t *dir, uint32_t user_vaddr, size_t size) {
+    if (dir == current_dir) return __clear_user((void *)user_vaddr, size);
+
+    uint32_t remaining = size;
+    uint32_t offset = 0;
+    while (remaining > 0) {
+        uint32_t page_offset = (user_vaddr + offset) & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - page_offset;
+        if (chunk > remaining) chunk = remaining;
+
+        uint32_t frame = huge_frame(dir, user_vaddr + offset);
+        if (!frame) {
+            page_table_entry_t *user_page = get_page(user_vaddr + offset, 0, dir);
+            if (user_page && pte_is_swap(user_page)) swap_in(user_vaddr + offset, user_page);
+            if (user_page && user_page->lazy) {
+                // Still demand-zero: already reads as zero
+                offset    += chunk;
+                remaining -= chunk;
+                continue;
+            }
+            if (!user_page || !user_page->present) {
+                kprintf(ERROR, "clear_user: page not mapped at %x\n", user_vaddr + offset);
+                return -1;
+            }
+            if (cow_break(dir, user_vaddr + offset, user_page) < 0) return -1;
+            frame = user_page->frame;
         }
 
-        map_tmp(UACCESS_TMP_SRC, user_page->frame);
-        memcpy(kdst + offset, (void *)(UACCESS_TMP_SRC + page_offset), chunk);
-        unmap_tmp(UACCESS_TMP_SRC, user_page->frame);
+        uint8_t *kaddr = kmap_frame(frame, UACCESS_TMP_DST);
+        memset(kaddr + page_offset, 0, chunk);
+        kunmap_frame(frame, UACCESS_TMP_DST);
 
         offset    += chunk;
         remaining -= chunk;
@@ -317,124 +637,274 @@ uint32_t copy_page_frame(page_directory_t *src_dir, uint32_t src_vaddr) {
     page_table_entry_t *src_page = get_page(src_vaddr, 0, src_dir);
     if (!src_page || !src_page->present) return 0;
 
-    // Allocate a new frame for the copy
-    uint32_t new_frame = pmm_alloc_block();  // refcount = 1
+    // Allocate a new frame for the copy; only ever reached through kmap_frame
+    uint32_t new_frame = pmm_alloc_highmem_block();  // refcount = 1
     if (!new_frame) return 0;
 
-    // Map both src and dst into kernel temp windows
-    map_tmp(UACCESS_TMP_SRC, src_page->frame);
-    map_tmp(UACCESS_TMP_DST, new_frame);
-
-    memcpy((void *)UACCESS_TMP_DST, (void *)UACCESS_TMP_SRC, PAGE_SIZE);
-
-    unmap_tmp(UACCESS_TMP_SRC, src_page->frame);
-    unmap_tmp(UACCESS_TMP_DST, new_frame);
+    void *src = kmap_frame(src_page->frame, UACCESS_TMP_SRC);
+    void *dst = kmap_frame(new_frame, UACCESS_TMP_DST);
+    memcpy(dst, src, PAGE_SIZE);
+    kunmap_frame(src_page->frame, UACCESS_TMP_SRC);
+    kunmap_frame(new_frame, UACCESS_TMP_DST);
     // new_frame refcount is still 1 — caller owns it
 
     return new_frame;
 }
 
+int cow_break(page_directory_t *dir, uint32_t vaddr, page_table_entry_t *page) {
+    if (!page->cow) return 0;
+
+    uint32_t frame = page->frame;
+    if (is_zero_frame(frame)) {
+        // Nothing to copy out of the zero page: take a fresh zeroed frame
+        uint32_t new_frame = alloc_zeroed_frame();
+        if (!new_frame) {
+            kprintf(ERROR, "cow_break: out of memory at %x\n", vaddr);
+            return -1;
+        }
+        page->frame = new_frame;
+    } else if (pmm_get_refcount(frame) > 1) {
+        // Still shared: take a private copy and drop our reference
+        uint32_t new_frame = copy_page_frame(dir, PAGE_ALIGN(vaddr));
+        if (!new_frame) {
+            kprintf(ERROR, "cow_break: out of memory copying %x\n", vaddr);
+            return -1;
+        }
+        page->frame = new_frame;
+        pmm_free_block(frame);
+    }
+
+    // Last owner (or fresh copy): just make it writable again
+    page->cow = 0;
+    page->rw = 1;
+    invalidate_page(PAGE_ALIGN(vaddr));
+    return 0;
+}
+
+int demand_page(uint32_t vaddr, page_table_entry_t *page, bool write) {
+    if (page->present || !page->lazy) return -1;
+    if (pte_is_swap(page)) return swap_in(vaddr, page);
+
+    if (!write && zero_frame) {
+        // Reads share the zero frame; a writable reservation breaks it on first write
+        page->frame = zero_frame;
+        page->cow = page->rw;
+        page->rw = 0;
+        page->lazy = 0;
+        page->present = 1;
+        invalidate_page(PAGE_ALIGN(vaddr));
+        return 0;
+    }
+
+    uint32_t frame = alloc_zeroed_frame();
+    if (!frame) {
+        kprintf(ERROR, "demand_page: out of memory at %x\n", vaddr);
+        return -1;
+    }
+
+    page->frame = frame;
+    page->lazy = 0;
+    page->present = 1;
+    invalidate_page(PAGE_ALIGN(vaddr));
+    return 0;
+}
+
 // Copy a null-terminated string from user space into a kernel buffer
-// Returns length of string (excluding null) or -1 on fault
+// Returns length of string (excluding null) or negative on fault
 int strncpy_from_user(page_directory_t *dir, char *dst,
                       uint32_t user_vaddr, size_t max) {
-    for (size_t i = 0; i < max; i++) {
-        char c;
-        if (copy_from_user(dir, &c, user_vaddr + i, 1) < 0) return -1;
-        dst[i] = c;
-        if (c == '\0') return (int)i;
+    if (dir == current_dir) return __strncpy_from_user(dst, (const char *)user_vaddr, max);
+
+    size_t i = 0;
+    while (i < max) {
+        uint32_t vaddr = user_vaddr + i;
+        page_table_entry_t *user_page = get_page(vaddr, 0, dir);
+        if (user_page && user_page->lazy) demand_page(vaddr, user_page, false);
+        if (!user_page || !user_page->present) return -1;
+
+        // Scan the rest of this page in one go
+        uint32_t page_offset = vaddr & (PAGE_SIZE - 1);
+        const char *src = (const char *)kmap_frame(user_page->frame, UACCESS_TMP_SRC) + page_offset;
+        size_t chunk = PAGE_SIZE - page_offset;
+        if (chunk > max - i) chunk = max - i;
+
+        for (size_t j = 0; j < chunk; j++, i++) {
+            dst[i] = src[j];
+            if (src[j] == '\0') {
+                kunmap_frame(user_page->frame, UACCESS_TMP_SRC);
+                return (int)i;
+            }
+        }
+        kunmap_frame(user_page->frame, UACCESS_TMP_SRC);
     }
     dst[max - 1] = '\0';
     return (int)max - 1;
 }
 
 page_directory_t * clone_page_directory(page_directory_t *src) {
-    page_directory_t *new_dir = (page_directory_t*) kmalloc_aligned(sizeof(page_directory_t), PAGE_SIZE);
+    page_directory_t *new_dir = pgtable_alloc_dir();
     if (!new_dir) {
         printf("Failed to allocate new page directory\n");
         return NULL;
     }
 
-    memset(new_dir, 0, sizeof(page_directory_t));
-    for (uint32_t i = 0; i < 1024; i++) {
+    bool flush = false;   // set once any of src's PTEs lose write access
+    for (uint32_t i = 0; i < PDE_ENTRIES; i++) {
         if (!src->tables[i].present) continue;
 
+        // Kernel large pages have no table to share; the entry itself is the mapping
+        if (i >= KERNEL_PDE_START && src->tables[i].page_size) {
+            new_dir->tables[i] = src->tables[i];
+            continue;
+        }
+
+        // User large pages: shared ones are referenced, private ones copied now
+        // (a large copy-on-write break would stall the first writer far longer)
+        if (src->tables[i].page_size) {
+            uint32_t src_frame = src->tables[i].frame;
+            if (src->tables[i].shared) {
+                for (uint32_t j = 0; j < PAGE_ENTRIES; j++) pmm_ref_frame(src_frame + j);
+                new_dir->tables[i] = src->tables[i];
+                continue;
+            }
+
+            uint32_t frame = pmm_alloc_highmem_pages(LARGE_PAGE_ORDER);
+            if (!frame) {
+                kprintf(ERROR, "clone_page_directory: no large block to copy huge page %d\n", i);
+                goto fail;
+            }
+            for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+                void *dst = kmap_frame(frame + j, UACCESS_TMP_DST);
+                void *from = kmap_frame(src_frame + j, UACCESS_TMP_SRC);
+                memcpy(dst, from, PAGE_SIZE);
+                kunmap_frame(src_frame + j, UACCESS_TMP_SRC);
+                kunmap_frame(frame + j, UACCESS_TMP_DST);
+            }
+            new_dir->tables[i] = src->tables[i];
+            new_dir->tables[i].frame = frame;
+            continue;
+        }
+
         page_table_t *src_table = src->ref_tables[i];
 
         // Copy kernel mappings by reference
-        if (i >= 768 && src_table && kpage_dir->ref_tables[i] == src_table) {
+        if (i >= KERNEL_PDE_START && src_table && kpage_dir->ref_tables[i] == src_table) {
             new_dir->tables[i] = src->tables[i];
             new_dir->ref_tables[i] = src_table;
             pmm_ref_frame(src->tables[i].frame); // Increment refcount for shared kernel page table
             continue;
         }
 
-        page_table_t *new_table = (page_table_t*) kmalloc_aligned(sizeof(page_table_t), PAGE_SIZE);
-        memset(new_table, 0, sizeof(page_table_t));
+        page_table_t *new_table = pgtable_alloc_table();
+        if (!new_table) {
+            kprintf(ERROR, "clone_page_directory: failed to allocate page table %d\n", i);
+            goto fail;
+        }
+
+        // Hooked up before it is filled, so the fail path frees what it holds
+        uint32_t t = (uint32_t) virtual2physical(kpage_dir, new_table);
+        new_dir->tables[i].present = 1;
+        new_dir->tables[i].rw = src->tables[i].rw; // 0 for COW
+        new_dir->tables[i].user = src->tables[i].user;
+        new_dir->tables[i].frame = t >> 12;
+        new_dir->ref_tables[i] = new_table;
 
-        for (uint32_t j = 0; j < 1024; j++) {
-            if (!src_table->pages[j].present) continue;
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            page_table_entry_t *src_page = (page_table_entry_t *)src_table + j;
+            if (!src_page->present) {
+                // Untouched reservations are inherited as reservations,
+                // swapped out pages by sharing the slot
+                if (src_page->lazy) new_table->pages[j] = *src_page;
+                if (pte_is_swap(src_page)) swap_dup(src_page);
+                continue;
+            }
 
-            uint32_t virt_addr = i << 22 | j << 12;
+            uint32_t virt_addr = i << PDE_SHIFT | j << 12;
             if (virt_addr == SIGRETURN_TRAMPOLINE_ADDR) {
                 kprintf(DEBUG, "clone_page_directory: skipping copy of trampoline page at virt=%x\n", virt_addr);
                 continue; // Don't copy the signal trampoline page
             }
 
-            if (i == 832) {
-                kprintf(DEBUG, "clone: copying kernel tmp window pd[832] frame=%x ref=%x\n",
-                        src->tables[832].frame, src->ref_tables[832]);
+            if (i == PDE_INDEX(UACCESS_TMP_DST)) {
+                kprintf(DEBUG, "clone: copying kernel tmp window pd[%d] frame=%x ref=%x\n",
+                        i, (uint32_t)src->tables[i].frame, src->ref_tables[i]);
+            }
+
+            // Shared mappings (SHM, framebuffer and other device memory) stay shared
+            bool is_ram = pmm_is_managed_frame(src_page->frame) || is_zero_frame(src_page->frame);
+            if (src_page->shared || !is_ram) {
+                new_table->pages[j] = *src_page;
+                if (is_ram) pmm_ref_frame(src_page->frame);
+                continue;
+            }
+
+            // Private user pages are shared read-only; the first write copies them
+            if (src_page->user) {
+                if (src_page->rw) {
+                    src_page->rw = 0;
+                    src_page->cow = 1;
+                    flush = true;
+                }
+                new_table->pages[j] = *src_page;
+                pmm_ref_frame(src_page->frame);
+                continue;
             }
 
             uint32_t frame = copy_page_frame(src, virt_addr);
             if (!frame) {
-                int src_frame = src->ref_tables[i] ? src->ref_tables[i]->pages[j].frame : 0;
-                // int src_refcount = src_frame ? pmm_get_refcount(src_frame) : -1;
-                kprintf(ERROR, "clone_page_directory: FAILED to copy page at virt=%x src_frame=%x\n", virt_addr, src_frame);
-                continue;
+                kprintf(ERROR, "clone_page_directory: FAILED to copy page at virt=%x src_frame=%x\n", virt_addr, src_page->frame);
+                goto fail;
             }
 
             new_table->pages[j].frame = frame;
             new_table->pages[j].present = 1;
-            new_table->pages[j].rw = 1; // 0 for COW
-            new_table->pages[j].user = 1; // src_table->pages[j].user;
+            new_table->pages[j].rw = src_page->rw;
         }
-
-        uint32_t t = (uint32_t) virtual2physical(kpage_dir, new_table);
-        new_dir->tables[i].present = 1;
-        new_dir->tables[i].rw = src->tables[i].rw; // 0 for COW
-        new_dir->tables[i].user = src->tables[i].user;
-        new_dir->tables[i].frame = t >> 12;
-        new_dir->ref_tables[i] = new_table;
     }
 
+    // src is normally the running address space; drop its stale writable TLB entries
+    if (flush) flush_tlb();
+
     return new_dir;
+
+fail:
+    // A half-built copy would fault in the child later; fail the fork now.
+    // src's pages already marked COW stay correct, their refs just drop.
+    if (flush) flush_tlb();
+    free_page_directory(new_dir);
+    return NULL;
 }
 
 void free_page_directory(page_directory_t *dir) {
     if (!dir || dir == kpage_dir) return;
-    for (uint32_t i = 0; i < 1024; i++) {
+    // A kernel thread may still be running on it lazily; move off first
+    if (dir == current_dir) switch_page_directory(kpage_dir);
+    for (uint32_t i = 0; i < PDE_ENTRIES; i++) {
         if (!dir->tables[i].present) continue;
 
+        if (i < KERNEL_PDE_START && dir->tables[i].page_size) {
+            free_huge_page(dir, i << PDE_SHIFT);
+            continue;
+        }
+
         page_table_t *table = dir->ref_tables[i];
         if (!table) continue;
 
         // Shared kernel page tables are not freed here since they are owned by the kernel, not the process
-        if (i >= 768 && kpage_dir->ref_tables[i] == table) {
+        if (i >= KERNEL_PDE_START && kpage_dir->ref_tables[i] == table) {
             pmm_deref_frame(dir->tables[i].frame); // Decrement refcount for shared kernel page table
             continue;
         }
 
-        for (uint32_t j = 0; j < 1024; j++) {
-            if (!table->pages[j].present) continue;
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            if (!table->pages[j].present && !pte_is_swap(&table->pages[j])) continue;
             free_page(&table->pages[j]);
         }
 
-        uint32_t table_frame = dir->tables[i].frame;
-        kfree_aligned(table);
+        pgtable_free_table(table);
     }
 
-    kfree_aligned(dir);
+    pgtable_free_dir(dir);
 }
 
 void paging_init() {
@@ -442,21 +912,48 @@ void paging_init() {
 
     // Remove the temporary page directory in kernel's data section and install new one
     kpage_dir = (page_directory_t*) dumb_kmalloc(sizeof(page_directory_t), 1);
-    kpage_dir_phys = (uint32_t)kpage_dir - LOAD_MEMORY_ADDRESS;
+    kpage_dir_phys = (uint32_t)kpage_dir + DIR_CR3_OFFSET - LOAD_MEMORY_ADDRESS;
     memset(kpage_dir, 0, sizeof(page_directory_t));
+#ifdef CONFIG_PAE
+    pdpt_init(kpage_dir);
+#endif
 
     register_interrupt_handler(14, page_fault_handler);
 
+#ifdef CONFIG_PAE
+    // PAE directories take 2MB pages without CR4.PSE
+    pse_enabled = true;
+#else
+    // boot.s already turned on CR4.PSE for its 4MB boot mappings
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    pse_enabled = (edx & CPUID_EDX_PSE) && (read_cr4() & CR4_PSE);
+#endif
+    pat_init();
+
     // Map the first 4MB of memory to the first 4MB of physical memory
-    // 768 - 1024 is reserved for the kernel stack and other kernel data
-    kmap_memory(LOAD_MEMORY_ADDRESS, 0, 4 * 0x100000, PAGE_PRESENT | PAGE_RW);
-    // Map some memory for the kernel heap
-    kmap_memory(LOAD_MEMORY_ADDRESS + 4 * 0x100000, -1, KHEAP_INITIAL_SIZE, PAGE_PRESENT | PAGE_RW);
+    // Slots from KERNEL_PDE_START up are reserved for the kernel stack and other kernel data
+    kmap_large(LOAD_MEMORY_ADDRESS, 0, 4 * 0x100000, PAGE_PRESENT | PAGE_RW);
+    // Back the initial kernel heap; the rest of the room it may grow into only
+    // gets page tables now, so later growth shows up in every directory that shares them
+    kmap_large(KHEAP_START, -1, KHEAP_MIN_SIZE, PAGE_PRESENT | PAGE_RW);
+    for (uint32_t va = KHEAP_START + KHEAP_MIN_SIZE; va < KHEAP_START + kheap_max_size(); va += LARGE_PAGE_SIZE) {
+        get_page(va, 1, kpage_dir);
+    }
     // Setup a guard page for the kernel stack
     // free_page(get_page((uint32_t) &kernel_stack_bottom + BLOCK_SIZE, 0, kpage_dir));
 
+    // Linear map of RAM, so kernel code can reach any managed frame without remapping
+    // (in frames first: 4GB of RAM or more would wrap a byte count)
+    uint32_t total = pmm_get_total_blocks();
+    phys_map_size = total < PHYS_MAP_MAX / PAGE_SIZE ? total * PAGE_SIZE : PHYS_MAP_MAX;
+    // Whole large pages: the slack past the end of RAM is never handed out by phys_to_virt
+    kmap_large(PHYS_MAP_BASE, 0, ALIGN_UP(phys_map_size, LARGE_PAGE_SIZE), PAGE_PRESENT | PAGE_RW);
+
     get_page(UACCESS_TMP_DST, 1, kpage_dir);  // create=1 forces table allocation
     get_page(UACCESS_TMP_SRC, 1, kpage_dir);
+    pgtable_init(kpage_dir);
+    vmalloc_init(kpage_dir);
     
     // Switch to the new page directory
     switch_page_directory(kpage_dir);
@@ -464,15 +961,20 @@ void paging_init() {
 
     // Finalize dumb_kmalloc by marking its reserved physical memory as used in the PMM and poisoning the pointer to catch any future accidental usage
     dumb_kmalloc_finalize();
+    zero_page_init();
 }
 
 void debug_page_mapping(page_directory_t *dir, uint32_t virtual_address) {
-    uint32_t pd_index = virtual_address >> 22;
-    uint32_t pt_index = (virtual_address >> 12) & 0x3FF;
+    uint32_t pd_index = PDE_INDEX(virtual_address);
+    uint32_t pt_index = PTE_INDEX(virtual_address);
 
     page_table_t *pt = dir->ref_tables[pd_index];
-    if (pt) {
-        uint32_t frame = pt->pages[pt_index].frame << 12;
+    if (dir->tables[pd_index].page_size) {
+        printf("Large page for %x: Physical = %x, Present = %d, RW = %d, User = %d\n",
+               virtual_address, virtual2physical(dir, (void *)virtual_address),
+               dir->tables[pd_index].present, dir->tables[pd_index].rw, dir->tables[pd_index].user);
+    } else if (pt) {
+        uint32_t frame = (uint32_t)pt->pages[pt_index].frame << 12;
         printf("Page Table Entry for %x: Physical Frame = %x, Present = %d, RW = %d, User = %d\n",
                virtual_address, frame, pt->pages[pt_index].present,
                pt->pages[pt_index].rw, pt->pages[pt_index].user);
@@ -484,19 +986,20 @@ void debug_page_mapping(page_directory_t *dir, uint32_t virtual_address) {
 void dump_page_directory(page_directory_t *dir) {
     printf("=== Page Directory Dump (CR3 = %x) ===\n", dir);
 
-    for (uint32_t i = 0; i < 1024; i++) {
+    for (uint32_t i = 0; i < PDE_ENTRIES; i++) {
         if (!dir->tables[i].present) continue;  // Skip unmapped entries
 
-        printf("PDE[%d]: Frame: %x | Present: %d | RW: %d | User: %d\n",
-               i, dir->tables[i].frame << 12, dir->tables[i].present,
-               dir->tables[i].rw, dir->tables[i].user);
+        printf("PDE[%d]: Frame: %x | Present: %d | RW: %d | User: %d%s\n",
+               i, (uint32_t)dir->tables[i].frame << 12, dir->tables[i].present,
+               dir->tables[i].rw, dir->tables[i].user,
+               dir->tables[i].page_size ? " | large" : "");
 
         page_table_t *table = dir->ref_tables[i];
         if (!table) continue;
         // for (uint32_t j = 0; j < 1024; j++) {
         //     if (!table->pages[j].present) continue;
 
-        //     uint32_t virt_addr = (i << 22) | (j << 12);
+        //     uint32_t virt_addr = (i << PDE_SHIFT) | (j << 12);
         //     uint32_t phys_addr = table->pages[j].frame << 12;
 
         //     printf("  PTE[%d]: Virt: %x -> Phys: %x | RW: %d | User: %d\n",
@@ -506,18 +1009,60 @@ void dump_page_directory(page_directory_t *dir) {
     printf("=====================================\n");
 }
 
+// Resolve demand-zero and COW faults in the loaded address space; true if handled.
+// This is the faulting directory even when a kernel thread is borrowing it.
+static bool handle_user_fault(uint32_t addr, uint32_t err_code) {
+    if (addr >= LOAD_MEMORY_ADDRESS) return false;
+    if (!current_dir || current_dir == kpage_dir) return false;
+
+    page_table_entry_t *page = get_page(addr, 0, current_dir);
+    if (!page) return false;
+    // PROT_NONE: the page exists but user mode may not touch it
+    if ((err_code & PF_ERR_USER) && !page->user) return false;
+
+    if (!(err_code & PF_ERR_PRESENT)) {
+        if (!page->lazy) return false;
+        // Swapped out: read it back, whatever kind of mapping it is in.  A
+        // write to a COW page refaults once it is present and breaks there.
+        if (pte_is_swap(page)) return swap_in(addr, page) == 0;
+        // A write to a read-only reservation still has to fault below
+        if ((err_code & PF_ERR_RW) && !page->rw) return false;
+
+        // File mappings fill the page from the file instead of zeroing it
+        process_t *proc = get_current_process();
+        vma_t *vma = proc ? vma_find(&proc->vmas, addr) : NULL;
+        if (vma && vma->file) return filemap_fault(vma, addr, page) == 0;
+        return demand_page(addr, page, err_code & PF_ERR_RW) == 0;
+    }
+
+    if (!(err_code & PF_ERR_RW) || !page->cow) return false;
+    return cow_break(current_dir, addr, page) == 0;
+}
+
 void page_fault_handler(registers_t *regs) {
     if (!paging_enabled) {
         printf("Page fault occurred but paging is not enabled!\n");
         for (;;) ;
     }
+
+    uint32_t faulting_address;
+    asm volatile("mov %%cr2, %0" : "=r" (faulting_address) :: "memory");
+    if (handle_user_fault(faulting_address, regs->err_code)) return;
+
+    // A uaccess primitive hit a bad user address: resume at its fixup
+    if (!(regs->err_code & PF_ERR_USER)) {
+        uint32_t fixup = search_exception_table(regs->eip);
+        if (fixup) {
+            regs->eip = fixup;
+            return;
+        }
+    }
+
     if (page_fault_detected) {
         printf("Nested page fault detected! Halting system.\n");
         for (;;) ;
     }
     page_fault_detected = 1;
-    uint32_t faulting_address;
-    asm volatile("mov %%cr2, %0" : "=r" (faulting_address) :: "memory");
     
         kprintf(DEBUG, "page_fault: eip=%x esp=%x cr2=%x err=%x cs=%x\n",
                 regs->eip, regs->useresp, faulting_address, regs->err_code, regs->cs);
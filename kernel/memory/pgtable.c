@@ -0,0 +1,220 @@
+/*
+ * pgtable.c — Page-table and page-directory frame allocator.
+ *
+ * The window at PGTABLE_WINDOW_START is divided into page-sized slots.  A
+ * page table takes one slot; a page directory (entries + ref_tables shadow,
+ * plus the PDPT under PAE) takes DIR_SLOTS consecutive slots, each backed by
+ * its own frame.  A slot bitmap tracks which window pages are handed out.
+ * Frames come from below 4GB: CR3 and the PDPT hold 32-bit addresses.
+ *
+ * Freed objects are pushed onto a pool (linked through their first word)
+ * while it is below PGTABLE_POOL_MAX; past that the frames go back to the
+ * PMM and the slots are unmapped.
+ */
+
+#include "kernel/pgtable.h"
+#include "kernel/pmm.h"
+#include "kernel/tlb.h"
+#include "kernel/printf.h"
+#include "kernel/locks.h"
+#include "libc/string.h"
+
+extern page_directory_t *kpage_dir;
+
+#define DIR_SLOTS CEILDIV(sizeof(page_directory_t), PAGE_SIZE)
+
+static uint32_t slot_bitmap[PGTABLE_WINDOW_SLOTS / 32];
+static uint32_t slot_hint;
+static spinlock_t pgtable_lock;
+
+static void *table_pool;
+static void *dir_pool;
+static pgtable_stats_t stats;
+
+static inline uint32_t slot_vaddr(uint32_t slot) {
+    return PGTABLE_WINDOW_START + slot * PAGE_SIZE;
+}
+
+// Find 'count' (at most 32) free slots, aligned to 'count' rounded up to a power of two
+static int32_t slot_alloc(uint32_t count) {
+    uint32_t words = PGTABLE_WINDOW_SLOTS / 32;
+    uint32_t align = 1;
+    while (align < count) align <<= 1;
+    uint32_t mask = count == 32 ? 0xFFFFFFFF : (1u << count) - 1;
+
+    for (uint32_t n = 0; n < words; n++) {
+        uint32_t w = (slot_hint + n) % words;
+        uint32_t avail = ~slot_bitmap[w];
+        if (!avail) continue;
+
+        for (uint32_t bit = 0; bit < 32; bit += align) {
+            if (((avail >> bit) & mask) != mask) continue;
+            slot_bitmap[w] |= mask << bit;
+            slot_hint = w;
+            return w * 32 + bit;
+        }
+    }
+    return -1;
+}
+
+static void slot_free(uint32_t slot, uint32_t count) {
+    uint32_t mask = count == 32 ? 0xFFFFFFFF : (1u << count) - 1;
+    slot_bitmap[slot / 32] &= ~(mask << (slot % 32));
+}
+
+// Back 'count' slots with fresh frames; undoes itself on failure
+static void *window_map(uint32_t count) {
+    int32_t slot = slot_alloc(count);
+    if (slot < 0) {
+        kprintf(ERROR, "pgtable: window exhausted\n");
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t frame = pmm_alloc_block();
+        page_table_entry_t *pte = get_page(slot_vaddr(slot + i), 0, kpage_dir);
+        if (!frame || !pte) {
+            kprintf(ERROR, "pgtable: failed to back window slot %d\n", slot + i);
+            while (i--) {
+                pte = get_page(slot_vaddr(slot + i), 0, kpage_dir);
+                pmm_free_block(pte->frame);
+                memset(pte, 0, sizeof(page_table_entry_t));
+                invalidate_page(slot_vaddr(slot + i));
+                stats.frames_mapped--;
+            }
+            if (frame) pmm_free_block(frame);
+            slot_free(slot, count);
+            return NULL;
+        }
+
+        pte->frame = frame;
+        pte->present = 1;
+        pte->rw = 1;
+        pte->user = 0;
+        pte->global = 1;
+        // The slot was not present, so the TLB holds nothing to invalidate
+        stats.frames_mapped++;
+    }
+    return (void *)slot_vaddr(slot);
+}
+
+static void window_unmap(void *addr, uint32_t count) {
+    uint32_t slot = ((uint32_t)addr - PGTABLE_WINDOW_START) / PAGE_SIZE;
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, kpage_dir);
+    for (uint32_t i = 0; i < count; i++) {
+        tlb_unmap_page(&tlb, slot_vaddr(slot + i), get_page(slot_vaddr(slot + i), 0, kpage_dir));
+        stats.frames_mapped--;
+    }
+    tlb_finish(&tlb);
+    slot_free(slot, count);
+}
+
+static inline bool in_window(void *addr) {
+    return (uint32_t)addr >= PGTABLE_WINDOW_START &&
+           (uint32_t)addr < PGTABLE_WINDOW_START + PGTABLE_WINDOW_SIZE;
+}
+
+void pgtable_init(page_directory_t *kdir) {
+    memset(slot_bitmap, 0, sizeof(slot_bitmap));
+    memset(&stats, 0, sizeof(stats));
+    slot_hint = 0;
+    table_pool = NULL;
+    dir_pool = NULL;
+    spinlock_init(&pgtable_lock);
+
+    // Pre-create the window's page tables so clones share them by reference
+    for (uint32_t va = PGTABLE_WINDOW_START; va < PGTABLE_WINDOW_START + PGTABLE_WINDOW_SIZE; va += PAGE_ENTRIES * PAGE_SIZE) {
+        get_page(va, 1, kdir);
+    }
+}
+
+page_table_t *pgtable_alloc_table(void) {
+    uint32_t flags;
+    spinlock_acquire_irq(&pgtable_lock, &flags);
+
+    page_table_t *table = table_pool;
+    if (table) {
+        table_pool = *(void **)table;
+        stats.pooled_tables--;
+    } else {
+        table = window_map(1);
+    }
+    if (table) stats.tables_in_use++;
+
+    spinlock_release_irq(&pgtable_lock, flags);
+
+    if (table) memset(table, 0, sizeof(page_table_t));
+    return table;
+}
+
+void pgtable_free_table(page_table_t *table) {
+    if (!table) return;
+    if (!in_window(table)) {
+        kprintf(ERROR, "pgtable_free_table: %x is not a window page table\n", table);
+        return;
+    }
+
+    uint32_t flags;
+    spinlock_acquire_irq(&pgtable_lock, &flags);
+    stats.tables_in_use--;
+    if (stats.pooled_tables < PGTABLE_POOL_MAX) {
+        *(void **)table = table_pool;
+        table_pool = table;
+        stats.pooled_tables++;
+    } else {
+        window_unmap(table, 1);
+    }
+    spinlock_release_irq(&pgtable_lock, flags);
+}
+
+page_directory_t *pgtable_alloc_dir(void) {
+    uint32_t flags;
+    spinlock_acquire_irq(&pgtable_lock, &flags);
+
+    page_directory_t *dir = dir_pool;
+    if (dir) {
+        dir_pool = *(void **)dir;
+        stats.pooled_dirs--;
+    } else {
+        dir = window_map(DIR_SLOTS);
+    }
+    if (dir) stats.dirs_in_use++;
+
+    spinlock_release_irq(&pgtable_lock, flags);
+
+    if (dir) {
+        memset(dir, 0, sizeof(page_directory_t));
+#ifdef CONFIG_PAE
+        pdpt_init(dir);
+#endif
+    }
+    return dir;
+}
+
+void pgtable_free_dir(page_directory_t *dir) {
+    if (!dir) return;
+    if (!in_window(dir)) {
+        kprintf(ERROR, "pgtable_free_dir: %x is not a window page directory\n", dir);
+        return;
+    }
+
+    uint32_t flags;
+    spinlock_acquire_irq(&pgtable_lock, &flags);
+    stats.dirs_in_use--;
+    if (stats.pooled_dirs < PGTABLE_POOL_MAX) {
+        *(void **)dir = dir_pool;
+        dir_pool = dir;
+        stats.pooled_dirs++;
+    } else {
+        window_unmap(dir, DIR_SLOTS);
+    }
+    spinlock_release_irq(&pgtable_lock, flags);
+}
+
+void pgtable_get_stats(pgtable_stats_t *out) {
+    uint32_t flags;
+    spinlock_acquire_irq(&pgtable_lock, &flags);
+    *out = stats;
+    spinlock_release_irq(&pgtable_lock, flags);
+}
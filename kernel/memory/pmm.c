@@ -1,5 +1,7 @@
 #include "kernel/pmm.h"
 #include "kernel/multiboot.h"
+#include "kernel/paging.h"
+#include "kernel/tlb.h"
 #include "libc/string.h"
 #include "kernel/printf.h"
 #include "kernel/system.h"
@@ -7,18 +9,190 @@
 #include <stdbool.h>
  
 uint8_t *bitmap = (uint8_t *)(& _kernel_end);
-uint8_t *mem_start;
 uint32_t total_blocks;
 uint32_t bitmap_size;
 
 static spinlock_t pmm_lock;
-static uint16_t frame_refcount[MAX_FRAMES];
+static uint16_t *frame_refcount;
+
+/*
+ * Buddy allocator over the free frames.  A free block of order o is 2^o
+ * frames aligned to 2^o; free_order[] holds o at the block's first frame
+ * (PMM_NOT_FREE elsewhere) and the lists are threaded through side arrays,
+ * since most physical frames are not mapped into the kernel.  Split and
+ * merge walk at most PMM_MAX_ORDER levels.
+ *
+ * The bitmap remains the per-frame used map: boot-time region marking works
+ * on it before the buddy lists exist, and it catches double frees.  It is
+ * searched 32 frames a word at a time, through a summary with one bit per
+ * word set once all 32 frames are used, so finding the free runs skips
+ * 1024 used frames per summary bit and ends with one bsf per level.
+ *
+ * Frames are split into zones at the end of the direct map and at 4GB.
+ * Ordinary allocations come from the high zone first, keeping the low one
+ * for callers that need phys_to_virt().  Frames above 4GB (PAE builds)
+ * are only handed to callers that ask for highmem: they have no 32-bit
+ * physical address and are reached through PTEs alone.  Zone boundaries
+ * are 4MB aligned, so no buddy pair ever straddles them.
+ *
+ * The per-frame arrays are sized from the highest available address in
+ * the memory map and carved out of RAM at boot (see place_metadata).
+ */
+static uint32_t free_head[PMM_ZONES][PMM_MAX_ORDER + 1];
+static uint32_t *free_next;
+static uint32_t *free_prev;
+static uint8_t *free_order;
+static uint32_t *bitmap_words;  // the bitmap, 32 frames a word
+static uint32_t *summary;       // bit w set: bitmap word w is all used
+static uint32_t num_words;
+static uint32_t free_blocks;
+static uint32_t low_blocks;     // frames below this are direct mapped
+static uint32_t meta_phys;      // physical base of the per-frame arrays
+static uint32_t meta_size;
+static bool buddy_ready = false;
 
 bool out_of_memory = false;
+static pmm_reclaim_fn reclaim_hook;  // frees frames when an allocation finds none
+static pmm_pressure_fn pressure_hook; // wakes background reclaim below wmark_low
+static uint32_t wmark_low;
+static uint32_t wmark_high;
+
+static inline void frame_set_used(uint32_t i) {
+    if (ISSET(i)) return;
+    SETBIT(i);
+    free_blocks--;
+    uint32_t word = i / FRAMES_PER_WORD;
+    if (bitmap_words[word] == 0xFFFFFFFF) summary[word / 32] |= 1u << (word % 32);
+}
+
+static inline void frame_set_free(uint32_t i) {
+    if (!ISSET(i)) return;
+    CLEARBIT(i);
+    free_blocks++;
+    uint32_t word = i / FRAMES_PER_WORD;
+    summary[word / 32] &= ~(1u << (word % 32));
+}
+
+// First free frame at or after 'from', or PMM_NONE
+static uint32_t find_free_frame(uint32_t from) {
+    uint32_t word = from / FRAMES_PER_WORD;
+    if (word >= num_words) return PMM_NONE;
+
+    // Rest of the starting word, then whole words through the summary
+    uint32_t avail = ~bitmap_words[word] & (~0u << (from % FRAMES_PER_WORD));
+    if (avail) return word * FRAMES_PER_WORD + __builtin_ctz(avail);
+
+    word++;
+    while (word < num_words) {
+        uint32_t open = ~summary[word / 32] & (~0u << (word % 32));
+        if (!open) {
+            word = (word / 32 + 1) * 32;
+            continue;
+        }
+        word = (word & ~31u) + __builtin_ctz(open);
+        if (word >= num_words) break;
+        return word * FRAMES_PER_WORD + __builtin_ctz(~bitmap_words[word]);
+    }
+    return PMM_NONE;
+}
+
+// First used frame at or after 'from'; the padding past total_blocks is used
+static uint32_t find_used_frame(uint32_t from) {
+    uint32_t word = from / FRAMES_PER_WORD;
+    uint32_t used = bitmap_words[word] & (~0u << (from % FRAMES_PER_WORD));
+    while (!used && ++word < num_words) used = bitmap_words[word];
+    if (!used) return total_blocks;
+    return word * FRAMES_PER_WORD + __builtin_ctz(used);
+}
+
+static inline uint32_t *zone_heads(uint32_t block) {
+    if (block < low_blocks) return free_head[PMM_ZONE_LOW];
+    return free_head[block < PMM_FRAMES_32BIT ? PMM_ZONE_HIGH : PMM_ZONE_HIGHMEM];
+}
+
+static void buddy_list_add(uint32_t block, uint32_t order) {
+    uint32_t *head = zone_heads(block);
+    free_order[block] = order;
+    free_prev[block] = PMM_NONE;
+    free_next[block] = head[order];
+    if (head[order] != PMM_NONE) free_prev[head[order]] = block;
+    head[order] = block;
+}
+
+static void buddy_list_remove(uint32_t block, uint32_t order) {
+    if (free_prev[block] != PMM_NONE) free_next[free_prev[block]] = free_next[block];
+    else zone_heads(block)[order] = free_next[block];
+    if (free_next[block] != PMM_NONE) free_prev[free_next[block]] = free_prev[block];
+    free_order[block] = PMM_NOT_FREE;
+}
+
+// Return a block to the lists, merging with its buddy as far as possible
+static void buddy_free(uint32_t block, uint32_t order) {
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = block ^ (1u << order);
+        if (buddy >= total_blocks || free_order[buddy] != order) break;
+        buddy_list_remove(buddy, order);
+        block &= ~(1u << order);
+        order++;
+    }
+    buddy_list_add(block, order);
+}
+
+// Pop a block of exactly 'order' from one zone, splitting a larger one if needed
+static uint32_t buddy_alloc(uint32_t zone, uint32_t order) {
+    uint32_t o = order;
+    while (o <= PMM_MAX_ORDER && free_head[zone][o] == PMM_NONE) o++;
+    if (o > PMM_MAX_ORDER) return PMM_NONE;
+
+    uint32_t block = free_head[zone][o];
+    buddy_list_remove(block, o);
+    while (o > order) {
+        o--;
+        buddy_list_add(block + (1u << o), o);
+    }
+    return block;
+}
+
+// Pull a single free frame out of whichever free block contains it
+static void buddy_carve(uint32_t frame) {
+    uint32_t order = 0;
+    uint32_t block = frame;
+    while (order <= PMM_MAX_ORDER) {
+        block = frame & ~((1u << order) - 1);
+        if (free_order[block] == order) break;
+        order++;
+    }
+    if (order > PMM_MAX_ORDER) return;
+
+    buddy_list_remove(block, order);
+    while (order > 0) {
+        order--;
+        uint32_t half = block + (1u << order);
+        if (frame >= half) {
+            buddy_list_add(block, order);
+            block = half;
+        } else {
+            buddy_list_add(half, order);
+        }
+    }
+}
+
+// Hand a run of free frames to the lists as the largest aligned blocks that fit
+static void buddy_free_run(uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER && !(start & (1u << order)) &&
+               start + (2u << order) <= end) {
+            order++;
+        }
+        buddy_free(start, order);
+        start += 1u << order;
+    }
+}
 
 static void _mark_used(uint32_t base, uint32_t length) {
     uint32_t start_block = base / BLOCK_SIZE;
-    uint32_t end_block = (base + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t end_block = CEILDIV((uint64_t)base + length, BLOCK_SIZE);
 
     if (end_block > total_blocks) {
         printf("Warning: Memory region exceeds total memory size, truncating\n");
@@ -26,59 +200,150 @@ static void _mark_used(uint32_t base, uint32_t length) {
     }
 
     for (uint32_t i = start_block; i < end_block; i++) {
-        SETBIT(i);
+        // Whole used words have nothing to carve or count
+        uint32_t word = i / FRAMES_PER_WORD;
+        if (!(i % FRAMES_PER_WORD) && (summary[word / 32] >> (word % 32)) & 1) {
+            i += FRAMES_PER_WORD - 1;
+            continue;
+        }
+        if (buddy_ready && !ISSET(i)) buddy_carve(i);
+        frame_set_used(i);
         if (frame_refcount[i] == 0) {
             frame_refcount[i] = 1;
         }
     }
 }
 
-static void _mark_free(uint32_t base, uint32_t length) {
-    uint32_t start_block = base / BLOCK_SIZE;
-    uint32_t end_block = (base + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
-
-    if (end_block > total_blocks) {
-        printf("Warning: Memory region exceeds total memory size, truncating\n");
-        end_block = total_blocks;
-    }
-
+static void _mark_free(uint32_t start_block, uint32_t end_block) {
     for (uint32_t i = start_block; i < end_block; i++) {
-        CLEARBIT(i);
+        frame_set_free(i);
         frame_refcount[i] = 0;
     }
 }
 
 void pmm_mark_used(uint32_t base, uint32_t length) {
+    uint32_t flags;
+    spinlock_acquire_irq(&pmm_lock, &flags);
     _mark_used(base, length);
+    spinlock_release_irq(&pmm_lock, flags);
 }
 
-void pmm_init(struct multiboot_tag *mbd, uint32_t mem_size) {
-    total_blocks = mem_size / BLOCK_SIZE;
-    bitmap_size = CEILDIV(total_blocks, BLOCKS_PER_BUCKET);
+static struct multiboot_tag_mmap *find_mmap(struct multiboot_tag *mbd) {
+    for (struct multiboot_tag *tag = mbd; tag->type != MULTIBOOT_TAG_TYPE_END;
+         tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7))) {
+        if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) return (struct multiboot_tag_mmap *)tag;
+    }
+    return NULL;
+}
 
-    // Clear the bitmap
-    memset(bitmap, 0xFF, bitmap_size);
-    memset(frame_refcount, 0, sizeof(frame_refcount));
-    
-    mem_start = (uint8_t*)BLOCK_ALIGN((uint32_t) bitmap + bitmap_size);
-    // Parse the multiboot memory map and mark available regions as free
-    struct multiboot_tag *tag = mbd;
-    for (; tag->type != MULTIBOOT_TAG_TYPE_END;
-         tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7))) 
-    {
-        if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) {
-            struct multiboot_tag_mmap *mmap_tag = (struct multiboot_tag_mmap *)tag;
-            struct multiboot_mmap_entry *entry = mmap_tag->entries;
-
-            while ((uint32_t)entry < (uint32_t)mmap_tag + mmap_tag->size) {
-                if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
-                    _mark_free(entry->addr, entry->len);
-                }
-
-                entry = (struct multiboot_mmap_entry *)((uint32_t)entry + mmap_tag->entry_size);
-            }
+#define for_each_mmap_entry(mmap, entry)                                                \
+    for (entry = (mmap)->entries; (uint32_t)entry < (uint32_t)(mmap) + (mmap)->size;    \
+         entry = (struct multiboot_mmap_entry *)((uint32_t)entry + (mmap)->entry_size))
+
+// Whole frames of an available entry, clamped to the 32-bit physical space
+static bool avail_frames(struct multiboot_mmap_entry *entry, uint32_t *start, uint32_t *end) {
+    if (entry->type != MULTIBOOT_MEMORY_AVAILABLE || entry->addr >= PMM_PHYS_LIMIT) return false;
+
+    uint64_t last = entry->addr + entry->len;
+    if (last > PMM_PHYS_LIMIT) last = PMM_PHYS_LIMIT;
+    *start = CEILDIV(entry->addr, BLOCK_SIZE);
+    *end = last / BLOCK_SIZE;
+    return *start < *end;
+}
+
+/*
+ * Find room for the per-frame arrays: an available run above the boot
+ * mapping (which holds the kernel, the bitmap and dumb_kmalloc) and inside
+ * the direct map, so paging_init's linear map keeps them reachable.  Until
+ * then they are reached through large-page entries added to the boot directory at
+ * the same PHYS_MAP_BASE addresses.
+ */
+static bool place_metadata(struct multiboot_tag_mmap *mmap) {
+    uint32_t per_frame = sizeof(*free_next) + sizeof(*free_prev) +
+                         sizeof(*frame_refcount) + sizeof(*free_order);
+    uint32_t summary_size = CEILDIV(num_words, 32) * sizeof(*summary);
+    uint32_t frames = CEILDIV(total_blocks * per_frame + summary_size, BLOCK_SIZE);
+
+    struct multiboot_mmap_entry *entry;
+    meta_phys = 0;
+    for_each_mmap_entry(mmap, entry) {
+        uint32_t start, end;
+        if (!avail_frames(entry, &start, &end)) continue;
+        if (start < PMM_META_MIN_FRAME) start = PMM_META_MIN_FRAME;
+        if (end > low_blocks) end = low_blocks;
+        if (start < end && end - start >= frames) {
+            meta_phys = start * BLOCK_SIZE;
+            break;
         }
     }
+    if (!meta_phys) return false;
+    meta_size = frames * BLOCK_SIZE;
+
+    // Same entry format as paging.h, 4MB or (PAE) 2MB pages
+    page_directory_entry_t *boot_dir = initial_page_dir;
+    for (uint32_t p = meta_phys & ~(LARGE_PAGE_SIZE - 1); p < meta_phys + meta_size; p += LARGE_PAGE_SIZE) {
+        page_directory_entry_t *pde = &boot_dir[PDE_INDEX(PHYS_MAP_BASE + p)];
+        memset(pde, 0, sizeof(*pde));
+        pde->frame = p >> 12;
+        pde->page_size = 1;
+        pde->rw = 1;
+        pde->present = 1;
+    }
+    flush_tlb();
+
+    uint8_t *meta = (uint8_t *)(PHYS_MAP_BASE + meta_phys);
+    // The summary goes first: the byte-sized free_order leaves it unaligned
+    summary = (uint32_t *)meta;
+    free_next = (uint32_t *)(meta + summary_size);
+    free_prev = free_next + total_blocks;
+    frame_refcount = (uint16_t *)(free_prev + total_blocks);
+    free_order = (uint8_t *)(frame_refcount + total_blocks);
+    return true;
+}
+
+void pmm_init(struct multiboot_tag *mbd) {
+    struct multiboot_tag_mmap *mmap = find_mmap(mbd);
+    if (!mmap) {
+        kprintf(ERROR, "pmm_init: bootloader passed no memory map\n");
+        return;
+    }
+
+    // Size everything from the end of the highest available region
+    struct multiboot_mmap_entry *entry;
+    total_blocks = 0;
+    for_each_mmap_entry(mmap, entry) {
+        uint32_t start, end;
+        if (avail_frames(entry, &start, &end) && end > total_blocks) total_blocks = end;
+    }
+    low_blocks = total_blocks < PHYS_MAP_MAX / BLOCK_SIZE ? total_blocks : PHYS_MAP_MAX / BLOCK_SIZE;
+    // Whole words, so the padding bits past total_blocks read as used
+    num_words = CEILDIV(total_blocks, FRAMES_PER_WORD);
+    bitmap_size = num_words * sizeof(uint32_t);
+    bitmap_words = (uint32_t *)bitmap;
+
+    if (!place_metadata(mmap)) {
+        kprintf(ERROR, "pmm_init: no room below %dMB for metadata of %d frames\n",
+                low_blocks / PMM_BLOCKS_PER_MB, total_blocks);
+        total_blocks = 0;
+        return;
+    }
+
+    // Start with every frame used; available regions are cleared below.
+    // Frames in holes keep a pinned refcount, so mapping device memory
+    // that lies below the top of RAM never hands it to the free lists.
+    memset(bitmap, 0xFF, bitmap_size);
+    memset(summary, 0xFF, CEILDIV(num_words, 32) * sizeof(*summary));
+    memset(frame_refcount, 0xFF, total_blocks * sizeof(*frame_refcount));
+    memset(free_order, PMM_NOT_FREE, total_blocks);
+    for (uint32_t z = 0; z < PMM_ZONES; z++) {
+        for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++) free_head[z][o] = PMM_NONE;
+    }
+    free_blocks = 0;
+
+    for_each_mmap_entry(mmap, entry) {
+        uint32_t start, end;
+        if (avail_frames(entry, &start, &end)) _mark_free(start, end);
+    }
 
     // Reserve the entire low 1MB unconditionally.
     // This covers: IVT (0x0), BIOS data, VGA buffer (0xB8000), BIOS ROM.
@@ -88,51 +353,155 @@ void pmm_init(struct multiboot_tag *mbd, uint32_t mem_size) {
     uint32_t kernel_phys_start = (uint32_t)&_kernel_start;
     uint32_t kernel_phys_end = (uint32_t)bitmap + bitmap_size - LOAD_MEMORY_ADDRESS;
     _mark_used(kernel_phys_start, kernel_phys_end - kernel_phys_start);
-    printf("Kernel memory range: %x - %x\n", kernel_phys_start, kernel_phys_end);
+    _mark_used(meta_phys, meta_size);
+    printf("Kernel memory range: %x - %x, frame metadata: %x - %x\n",
+           kernel_phys_start, kernel_phys_end, meta_phys, meta_phys + meta_size);
 
-    spinlock_init(&pmm_lock);
-
-    uint32_t free_blocks = 0;
-    for (uint32_t i = 0; i < total_blocks; i++) {
-        if (!ISSET(i)) {
-            free_blocks++;
-        }
+    // Hand each run of free frames to the buddy lists in whole blocks.
+    // Holes and reserved ranges are skipped through the summary.
+    for (uint32_t run = find_free_frame(0); run != PMM_NONE;) {
+        uint32_t end = find_used_frame(run);
+        buddy_free_run(run, end);
+        run = find_free_frame(end);
     }
-    kprintf(INFO, "PMM initialized: %d/%d free blocks (%d MB)\n", free_blocks, total_blocks, (free_blocks * BLOCK_SIZE) / (1024 * 1024));
-}
+    buddy_ready = true;
 
-static uint32_t first_free_block() {
-    for (uint32_t i = 0; i < total_blocks; i++) {
-        if (!ISSET(i)) return i;
-    }
-    return (uint32_t)-1;
+    wmark_low = free_blocks / PMM_WMARK_LOW_SHARE;
+    if (wmark_low < PMM_WMARK_MIN) wmark_low = PMM_WMARK_MIN;
+    wmark_high = wmark_low * 2;
+
+    spinlock_init(&pmm_lock);
+    kprintf(INFO, "PMM initialized: %d/%d free blocks (%d MB, %d MB direct mapped)\n",
+            free_blocks, total_blocks, free_blocks / PMM_BLOCKS_PER_MB, low_blocks / PMM_BLOCKS_PER_MB);
+    kprintf(INFO, "PMM watermarks: low %d, high %d frames\n", wmark_low, wmark_high);
 }
 
-// 
 uint32_t pmm_alloc_block() {
+    return pmm_alloc_pages(0);
+}
+
+// Take 2^order frames from 'zone' or, failing that, any zone below it
+static uint32_t take_pages(uint32_t zone, uint32_t order) {
     uint32_t flags;
     spinlock_acquire_irq(&pmm_lock, &flags);
 
-    uint32_t block = first_free_block();
-    if (block == (uint32_t)-1) {
-        out_of_memory = true;
-        printf("Error: Out of memory\n");
+    uint32_t block = buddy_alloc(zone, order);
+    while (block == PMM_NONE && zone-- > PMM_ZONE_LOW) block = buddy_alloc(zone, order);
+    if (block == PMM_NONE) {
         spinlock_release_irq(&pmm_lock, flags);
         return 0;
     }
 
-    SETBIT(block);
-    frame_refcount[block] = 1;
-    out_of_memory = false;
+    for (uint32_t i = block; i < block + (1u << order); i++) {
+        frame_set_used(i);
+        frame_refcount[i] = 1;
+    }
 
     spinlock_release_irq(&pmm_lock, flags);
     return block;
 }
 
+static uint32_t alloc_pages(uint32_t zone, uint32_t order, bool warn) {
+    if (order > PMM_MAX_ORDER) {
+        kprintf(WARNING, "pmm_alloc_pages: order %d exceeds max order %d\n", order, PMM_MAX_ORDER);
+        return 0;
+    }
+
+    uint32_t block = take_pages(zone, order);
+    // Out of frames: have the shrinkers free some, without the lock held, and
+    // retry for as long as they make progress.  Freed frames need not be
+    // contiguous, so a large block may take a few rounds.
+    for (uint32_t tries = 0; !block && reclaim_hook && tries < PMM_RECLAIM_TRIES; tries++) {
+        if (!reclaim_hook(1u << order)) break;
+        block = take_pages(zone, order);
+    }
+    if (!block) {
+        out_of_memory = true;
+        if (warn) printf("Error: Out of memory (order %d)\n", order);
+        if (pressure_hook) pressure_hook();
+        return 0;
+    }
+
+    out_of_memory = false;
+    if (free_blocks < wmark_low && pressure_hook) pressure_hook();
+    return block;
+}
+
+void pmm_set_reclaim_hook(pmm_reclaim_fn hook) {
+    reclaim_hook = hook;
+}
+
+void pmm_set_pressure_hook(pmm_pressure_fn hook) {
+    pressure_hook = hook;
+}
+
+void pmm_get_watermarks(uint32_t *low, uint32_t *high) {
+    *low = wmark_low;
+    *high = wmark_high;
+}
+
+bool pmm_memory_low(void) {
+    return free_blocks < wmark_low;
+}
+
+uint32_t pmm_alloc_pages(uint32_t order) {
+    return alloc_pages(PMM_ZONE_HIGH, order, true);
+}
+
+uint32_t pmm_alloc_low_pages(uint32_t order) {
+    return alloc_pages(PMM_ZONE_LOW, order, true);
+}
+
+uint32_t pmm_alloc_low_block(void) {
+    return alloc_pages(PMM_ZONE_LOW, 0, true);
+}
+
+uint32_t pmm_alloc_highmem_pages(uint32_t order) {
+    return alloc_pages(PMM_ZONE_HIGHMEM, order, true);
+}
+
+uint32_t pmm_alloc_highmem_block(void) {
+    return alloc_pages(PMM_ZONE_HIGHMEM, 0, true);
+}
+
+uint32_t pmm_try_alloc_pages(uint32_t zone, uint32_t order) {
+    return alloc_pages(zone, order, false);
+}
+
+void pmm_free_pages(uint32_t block, uint32_t order) {
+    if (order > PMM_MAX_ORDER || block == 0 || block + (1u << order) > total_blocks ||
+        (block & ((1u << order) - 1))) {
+        kprintf(WARNING, "pmm_free_pages: invalid block %x order %d\n", block, order);
+        return;
+    }
+
+    uint32_t flags;
+    spinlock_acquire_irq(&pmm_lock, &flags);
+    for (uint32_t i = block; i < block + (1u << order); i++) {
+        if (frame_refcount[i] != 1) {
+            kprintf(WARNING, "pmm_free_pages: frame %x has refcount %d, not freeing block %x\n",
+                    i, frame_refcount[i], block);
+            spinlock_release_irq(&pmm_lock, flags);
+            return;
+        }
+    }
+
+    for (uint32_t i = block; i < block + (1u << order); i++) {
+        frame_refcount[i] = 0;
+        frame_set_free(i);
+    }
+    buddy_free(block, order);
+    spinlock_release_irq(&pmm_lock, flags);
+}
+
 uint32_t pmm_get_total_blocks(void) {
     return total_blocks;
 }
 
+uint32_t pmm_get_free_blocks(void) {
+    return free_blocks;
+}
+
 void pmm_ref_frame(uint32_t block) {
     if (block == 0 || block >= total_blocks) {
         kprintf(WARNING, "[pmm] pmm_ref_frame: invalid block %d\n", block);
@@ -140,7 +509,18 @@ void pmm_ref_frame(uint32_t block) {
     }
     uint32_t eflags;
     spinlock_acquire_irq(&pmm_lock, &eflags);
-    frame_refcount[block]++;
+    if (frame_refcount[block] != PMM_REF_PINNED) frame_refcount[block]++;
+    spinlock_release_irq(&pmm_lock, eflags);
+}
+
+void pmm_pin_frame(uint32_t block) {
+    if (block == 0 || block >= total_blocks) {
+        kprintf(WARNING, "[pmm] pmm_pin_frame: invalid block %d\n", block);
+        return;
+    }
+    uint32_t eflags;
+    spinlock_acquire_irq(&pmm_lock, &eflags);
+    frame_refcount[block] = PMM_REF_PINNED;
     spinlock_release_irq(&pmm_lock, eflags);
 }
 
@@ -153,10 +533,11 @@ void pmm_deref_frame(uint32_t block) {
     spinlock_acquire_irq(&pmm_lock, &eflags);
     if (frame_refcount[block] == 0) {
         kprintf(WARNING, "[pmm] pmm_deref_frame: attempt to deref zero-refcount block %d\n", block);
-    } else {
+    } else if (frame_refcount[block] != PMM_REF_PINNED) {
         frame_refcount[block]--;
         if (frame_refcount[block] == 0) {
-            CLEARBIT(block);
+            frame_set_free(block);
+            buddy_free(block, 0);
         }
     }
     spinlock_release_irq(&pmm_lock, eflags);
@@ -180,16 +561,21 @@ void pmm_free_block(uint32_t frame) {
     spinlock_acquire_irq(&pmm_lock, &flags);
     if (frame_refcount[frame] == 0) {
         kprintf(WARNING, "pmm_free_block: double free of frame %x\n", frame);
-    } else {
+    } else if (frame_refcount[frame] != PMM_REF_PINNED) {
         frame_refcount[frame]--;
         if (frame_refcount[frame] == 0) {
-            CLEARBIT(frame);
+            frame_set_free(frame);
+            buddy_free(frame, 0);
         }
     }
 
     spinlock_release_irq(&pmm_lock, flags);
 }
 
+bool pmm_is_managed_frame(uint32_t block) {
+    return block != 0 && block < total_blocks && frame_refcount[block] != PMM_REF_PINNED;
+}
+
 uint16_t pmm_get_refcount(uint32_t block) {
     if (block == 0 || block >= total_blocks) {
         kprintf(WARNING, "[pmm] pmm_get_refcount: invalid block %d\n", block);
@@ -31,6 +31,9 @@
 #include "kernel/kheap.h"
 #include "kernel/printf.h"
 #include "kernel/process.h"
+#include "kernel/pmm.h"
+#include "kernel/tlb.h"
+#include "common/syscall.h"
 #include "libc/string.h"
 
 extern page_directory_t *kpage_dir;
@@ -48,11 +51,44 @@ void shm_init(void) {
             SHM_MAX_OBJECTS, SHM_USER_VBASE);
 }
 
-int shm_create(uint32_t size) {
+/*
+ * Map a huge object into 'dir' as large pages (one 4MB entry, or two 2MB
+ * ones under PAE).  All or nothing: false if any entry is taken.
+ */
+static bool shm_map_huge(page_directory_t *dir, uint32_t user_base, uint32_t phys) {
+    for (uint32_t off = 0; off < SHM_SLOT_SIZE; off += LARGE_PAGE_SIZE) {
+        if (map_huge_page(dir, user_base + off, phys + off, PAGE_RW | PAGE_USER)) continue;
+        while (off) {
+            off -= LARGE_PAGE_SIZE;
+            free_huge_page(dir, user_base + off);
+        }
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Back a whole slot with one 4MB buddy block.  The kernel window still
+ * uses 4K PTEs (its page tables are shared by every directory); only user
+ * mappings get the PSE entry.  Returns the block's physical base or 0.
+ */
+static uint32_t shm_alloc_huge(uint32_t kvaddr) {
+    if (!pse_supported()) return 0;
+
+    uint32_t frame = pmm_alloc_pages(PMM_MAX_ORDER);
+    if (!frame) return 0;
+
+    kmap_memory(kvaddr, frame * PAGE_SIZE, SHM_SLOT_SIZE, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+    memset((void *)kvaddr, 0, SHM_SLOT_SIZE);
+    return frame * PAGE_SIZE;
+}
+
+int shm_create(uint32_t size, uint32_t flags) {
     if (size == 0) return -1;
 
     /* Round up to page boundary */
     size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if ((flags & SHM_HUGE) && size > SHM_SLOT_SIZE) flags &= ~SHM_HUGE;
 
     /* Find a free table slot */
     for (int i = 0; i < SHM_MAX_OBJECTS; i++) {
@@ -65,7 +101,9 @@ int shm_create(uint32_t size) {
          * This calls alloc_page() for every page, pulling frames from PMM.
          * The kernel will be able to read/write the buffer at kvaddr.
          */
-        kmap_memory(kvaddr, -1, size, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+        uint32_t huge_phys = (flags & SHM_HUGE) ? shm_alloc_huge(kvaddr) : 0;
+        if (huge_phys) size = SHM_SLOT_SIZE;
+        else kmap_memory(kvaddr, -1, size, PAGE_PRESENT | PAGE_RW | PAGE_USER);
 
         shm_table[i].id        = shm_next_id++;
         shm_table[i].slot      = i;
@@ -73,6 +111,7 @@ int shm_create(uint32_t size) {
         shm_table[i].size      = size;
         shm_table[i].ref_count = 0;
         shm_table[i].in_use    = 1;
+        shm_table[i].huge_phys = huge_phys;
 
         kprintf(DEBUG, "shm_create: id=%d slot=%d kvaddr=%x size=%d\n",
                 shm_table[i].id, i, kvaddr, size);
@@ -94,6 +133,17 @@ void *shm_map(int shm_id) {
     process_t  *proc      = get_current_process();
     uint32_t    user_base = SHM_USER_VBASE + (uint32_t)obj->slot * SHM_SLOT_SIZE;
 
+    /*
+     * A huge object becomes one directory entry.  If this process still has
+     * a page table over the slot (an earlier small object), use 4K pages.
+     */
+    if (obj->huge_phys && shm_map_huge(proc->root_page_table, user_base, obj->huge_phys)) {
+        obj->ref_count++;
+        kprintf(DEBUG, "shm_map: id=%d -> uva=%x as 4MB page (pid=%d, ref=%d)\n",
+                shm_id, user_base, proc->pid, obj->ref_count);
+        return (void *)user_base;
+    }
+
     /*
      * For every page in the SHM object, look up its physical frame via the
      * kernel mapping, then install the *same* frame into the user process's
@@ -120,10 +170,13 @@ void *shm_map(int shm_id) {
             continue;
         }
 
-        pte->frame   = phys >> 12;
-        pte->present = 1;
-        pte->rw      = 1;
-        pte->user    = 1;
+        /*
+         * Take a frame reference for this mapping so process teardown
+         * (free_page on every user PTE) stays balanced, and mark it shared
+         * so fork hands the child the same frame instead of a COW copy.
+         */
+        map_page_to_frame(pte, phys >> 12, PAGE_RW | PAGE_USER);
+        pte->shared = 1;
     }
 
     obj->ref_count++;
@@ -139,26 +192,30 @@ int shm_unmap(int shm_id) {
     process_t  *proc      = get_current_process();
     uint32_t    user_base = SHM_USER_VBASE + (uint32_t)obj->slot * SHM_SLOT_SIZE;
 
-    for (uint32_t off = 0; off < obj->size; off += PAGE_SIZE) {
+    /*
+     * Drop this mapping's frame references; the SHM object still holds its
+     * own, so no frame is freed here.  Only the range that was mapped is
+     * flushed: a few invlpg for a small object, one CR3 reload for a
+     * window-sized one.
+     */
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, proc->root_page_table);
+
+    /* A huge mapping drops all of its frame references at once */
+    bool huge = false;
+    for (uint32_t off = 0; off < SHM_SLOT_SIZE; off += LARGE_PAGE_SIZE) {
+        huge |= tlb_unmap_huge(&tlb, user_base + off);
+    }
+
+    for (uint32_t off = 0; !huge && off < obj->size; off += PAGE_SIZE) {
         page_table_entry_t *pte = get_page(user_base + off, 0,
                                            proc->root_page_table);
-        if (pte && pte->present) {
-            /*
-             * Clear the PTE but do NOT call free_page() – the physical frame
-             * is owned by the SHM object, not by this process.
-             */
-            pte->present = 0;
-            pte->rw      = 0;
-            pte->user    = 0;
-            pte->frame   = 0;
-        }
+        if (pte && pte->present) tlb_unmap_page(&tlb, user_base + off, pte);
     }
+    tlb_finish(&tlb);
 
     if (obj->ref_count > 0) obj->ref_count--;
 
-    /* Flush TLB by reloading CR3 */
-    asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3" ::: "eax", "memory");
-
     kprintf(DEBUG, "shm_unmap: id=%d (pid=%d, ref=%d)\n",
             shm_id, proc->pid, obj->ref_count);
     return 0;
@@ -174,13 +231,14 @@ int shm_destroy(int shm_id) {
         return -1;
     }
 
-    /* Free each physical frame via the kernel-side PTEs */
+    /* Free each physical frame via the kernel-side PTEs (global entries) */
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, kpage_dir);
     for (uint32_t off = 0; off < obj->size; off += PAGE_SIZE) {
         page_table_entry_t *pte = get_page(obj->kvaddr + off, 0, kpage_dir);
-        if (pte && pte->present) {
-            free_page(pte);  /* clears present, rw, user, frame and PMM bit */
-        }
+        if (pte && pte->present) tlb_unmap_page(&tlb, obj->kvaddr + off, pte);
     }
+    tlb_finish(&tlb);
 
     kprintf(DEBUG, "shm_destroy: id=%d freed %d bytes\n", shm_id, obj->size);
     memset(obj, 0, sizeof(*obj));
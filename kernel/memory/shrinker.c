@@ -0,0 +1,115 @@
+#include "kernel/shrinker.h"
+#include "kernel/pmm.h"
+#include "kernel/process.h"
+#include "kernel/locks.h"
+#include "kernel/printf.h"
+#include "drivers/pit.h"
+
+#define KRECLAIMD_BATCH 32      // frames asked for per round, so interrupts get a look in
+
+// Cheapest first.  Shrinkers register from early boot on, before anything
+// could be initialised, and are never freed: scans walk the list unlocked.
+static shrinker_t *shrinkers;
+static spinlock_t shrinker_lock;    // list changes only
+
+static reclaim_stats_t stats;
+static thread_t *kreclaimd;
+static volatile bool pressure;      // woken below the low watermark
+static uint32_t backoff_until;      // tick before which wakeups are ignored
+
+uint32_t shrink_memory(uint32_t frames, bool direct) {
+    uint32_t freed = 0;
+    for (shrinker_t *s = shrinkers; s && freed < frames; s = s->next) {
+        if (direct && !(s->flags & SHRINKER_DIRECT)) continue;
+        uint32_t n = s->scan(frames - freed);
+        s->freed += n;
+        freed += n;
+    }
+    return freed;
+}
+
+// The PMM's reclaim hook: an allocation found no free frame
+static uint32_t direct_reclaim(uint32_t frames) {
+    stats.direct++;
+    uint32_t freed = shrink_memory(frames, true);
+    stats.direct_reclaimed += freed;
+    return freed;
+}
+
+void register_shrinker(shrinker_t *shrinker) {
+    uint32_t flags;
+    spinlock_acquire_irq(&shrinker_lock, &flags);
+    shrinker_t **link = &shrinkers;
+    while (*link && (*link)->cost <= shrinker->cost) link = &(*link)->next;
+    shrinker->next = *link;
+    *link = shrinker;
+    spinlock_release_irq(&shrinker_lock, flags);
+
+    pmm_set_reclaim_hook(direct_reclaim);
+}
+
+void unregister_shrinker(shrinker_t *shrinker) {
+    uint32_t flags;
+    spinlock_acquire_irq(&shrinker_lock, &flags);
+    shrinker_t **link = &shrinkers;
+    while (*link && *link != shrinker) link = &(*link)->next;
+    // shrinker->next stays valid for a scan that is standing on it
+    if (*link) *link = shrinker->next;
+    spinlock_release_irq(&shrinker_lock, flags);
+}
+
+// The PMM's pressure hook; runs inside allocations, interrupts maybe off
+static void reclaim_wake(void) {
+    if (pit_get_ticks() < backoff_until) return;
+    pressure = true;
+    thread_wake_sleeper(kreclaimd);
+}
+
+// Bring free frames back up to the high watermark
+static void reclaim_to_high(void) {
+    uint32_t low, high;
+    pmm_get_watermarks(&low, &high);
+    stats.wakeups++;
+
+    uint32_t free;
+    while ((free = pmm_get_free_blocks()) < high) {
+        uint32_t want = high - free < KRECLAIMD_BATCH ? high - free : KRECLAIMD_BATCH;
+        uint32_t freed = shrink_memory(want, false);
+        stats.reclaimed += freed;
+        if (!freed) {
+            // Nothing left to give: stop being woken by every allocation
+            backoff_until = pit_get_ticks() + KRECLAIMD_BACKOFF;
+            return;
+        }
+    }
+}
+
+static void kreclaimd_main(void) {
+    for (;;) {
+        // The periodic check catches wakeups dropped during a backoff
+        if (pressure || (pmm_memory_low() && pit_get_ticks() >= backoff_until)) {
+            pressure = false;
+            reclaim_to_high();
+        }
+        thread_sleep(KRECLAIMD_INTERVAL);
+    }
+}
+
+void reclaim_init(void) {
+    process_t *proc = create_process("kreclaimd", kreclaimd_main, PROCESS_FLAG_KERNEL);
+    if (!proc) {
+        kprintf(ERROR, "reclaim: cannot start kreclaimd\n");
+        return;
+    }
+    kreclaimd = proc->main_thread;
+    schedule_process_threads(proc);
+    pmm_set_pressure_hook(reclaim_wake);
+
+    uint32_t low, high;
+    pmm_get_watermarks(&low, &high);
+    kprintf(INFO, "reclaim: kreclaimd keeps %d-%d frames free\n", low, high);
+}
+
+void reclaim_get_stats(reclaim_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,283 @@
+/*
+ * slab.c — Object caches layered on top of kmalloc.
+ *
+ * A cache owns a set of slabs.  Every slab is a slab_size-aligned chunk
+ * obtained from kmalloc_aligned(): the kmem_slab_t header sits at the start
+ * and the rest is cut into obj_size slots.  Free slots are chained through
+ * their first word, so the per-object overhead is zero.
+ *
+ * Slabs move between three lists (partial / full / empty).  Allocation pops
+ * from a partial slab first so that nearly-empty slabs drain and can be
+ * released; a single empty slab is kept around to absorb alloc/free
+ * ping-pong (fork/exit, lookup/close) without going back to the heap.
+ */
+
+#include <stdbool.h>
+#include "kernel/slab.h"
+#include "kernel/kheap.h"
+#include "kernel/paging.h"
+#include "kernel/printf.h"
+#include "libc/string.h"
+
+#define KMEM_MAX_SLAB_SIZE (16 * PAGE_SIZE)
+
+static kmem_cache_t *cache_list = NULL;
+static spinlock_t cache_list_lock;
+
+static inline size_t slab_header_size(kmem_cache_t *cache) {
+    return ALIGN_UP(sizeof(kmem_slab_t), cache->align);
+}
+
+static inline void *slab_first_obj(kmem_cache_t *cache, kmem_slab_t *slab) {
+    return (uint8_t *)slab + slab_header_size(cache);
+}
+
+static void slab_list_add(kmem_slab_t **head, kmem_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_remove(kmem_slab_t **head, kmem_slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+// Carve a fresh slab and thread every slot onto its free list
+static kmem_slab_t *slab_grow(kmem_cache_t *cache) {
+    kmem_slab_t *slab = (kmem_slab_t *)kmalloc_aligned(cache->slab_size, cache->slab_size);
+    if (!slab) {
+        kprintf(ERROR, "kmem_cache_alloc(%s): failed to allocate slab\n", cache->name);
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+
+    uint8_t *obj = (uint8_t *)slab_first_obj(cache, slab);
+    // Build the free list back to front so objects are handed out in address order
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+        void *slot = obj + (uint32_t)i * cache->obj_size;
+        *(void **)slot = slab->free_list;
+        slab->free_list = slot;
+    }
+
+    cache->num_slabs++;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t *cache, kmem_slab_t *slab) {
+    cache->num_slabs--;
+    kfree_aligned(slab);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *)) {
+    if (size == 0) return NULL;
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (align & (align - 1)) {
+        kprintf(ERROR, "kmem_cache_create(%s): alignment %d is not a power of two\n", name, align);
+        return NULL;
+    }
+
+    kmem_cache_t *cache = (kmem_cache_t *)kmalloc(sizeof(kmem_cache_t));
+    if (!cache) return NULL;
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+    cache->align = align;
+    cache->obj_size = ALIGN_UP(size < sizeof(void *) ? sizeof(void *) : size, align);
+    cache->ctor = ctor;
+
+    // Grow the slab until it holds a reasonable number of objects
+    size_t header = slab_header_size(cache);
+    cache->slab_size = PAGE_SIZE;
+    while ((cache->slab_size - header) / cache->obj_size < KMEM_MIN_OBJS_PER_SLAB &&
+           cache->slab_size < KMEM_MAX_SLAB_SIZE) {
+        cache->slab_size <<= 1;
+    }
+    cache->objs_per_slab = (cache->slab_size - header) / cache->obj_size;
+    if (cache->objs_per_slab == 0) {
+        kprintf(ERROR, "kmem_cache_create(%s): object size %d too large\n", name, size);
+        kfree(cache);
+        return NULL;
+    }
+
+    spinlock_init(&cache->lock);
+
+    uint32_t flags;
+    spinlock_acquire_irq(&cache_list_lock, &flags);
+    cache->next = cache_list;
+    cache_list = cache;
+    spinlock_release_irq(&cache_list_lock, flags);
+
+    kprintf(DEBUG, "kmem_cache_create: %s obj=%d slab=%d objs/slab=%d\n",
+            cache->name, cache->obj_size, cache->slab_size, cache->objs_per_slab);
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    if (!cache) return;
+
+    if (cache->objs_in_use) {
+        kprintf(WARNING, "kmem_cache_destroy(%s): %d objects still in use\n",
+                cache->name, cache->objs_in_use);
+        return;
+    }
+
+    uint32_t flags;
+    spinlock_acquire_irq(&cache_list_lock, &flags);
+    kmem_cache_t **pp = &cache_list;
+    while (*pp && *pp != cache) pp = &(*pp)->next;
+    if (*pp) *pp = cache->next;
+    spinlock_release_irq(&cache_list_lock, flags);
+
+    kmem_slab_t *slab;
+    while ((slab = cache->partial)) {
+        slab_list_remove(&cache->partial, slab);
+        slab_release(cache, slab);
+    }
+    while ((slab = cache->empty)) {
+        slab_list_remove(&cache->empty, slab);
+        slab_release(cache, slab);
+    }
+    kfree(cache);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) return NULL;
+
+    uint32_t flags;
+    spinlock_acquire_irq(&cache->lock, &flags);
+
+    kmem_slab_t *slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_remove(&cache->empty, slab);
+        } else {
+            slab = slab_grow(cache);
+            if (!slab) {
+                spinlock_release_irq(&cache->lock, flags);
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void *obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->in_use++;
+    cache->objs_in_use++;
+    cache->total_allocs++;
+
+    if (slab->in_use == cache->objs_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    spinlock_release_irq(&cache->lock, flags);
+
+    // The free list link lives in the object itself, so construct on every hand-out
+    if (cache->ctor) cache->ctor(obj);
+    return obj;
+}
+
+void *kmem_cache_zalloc(kmem_cache_t *cache) {
+    void *obj = kmem_cache_alloc(cache);
+    if (obj && !cache->ctor) memset(obj, 0, cache->obj_size);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj || !cache) return;
+
+    kmem_slab_t *slab = (kmem_slab_t *)((uintptr_t)obj & ~(cache->slab_size - 1));
+    if (slab->cache != cache) {
+        kprintf(ERROR, "kmem_cache_free(%s): object %x does not belong to this cache\n",
+                cache->name, obj);
+        return;
+    }
+
+    uint32_t flags;
+    spinlock_acquire_irq(&cache->lock, &flags);
+
+    bool was_full = (slab->in_use == cache->objs_per_slab);
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->objs_in_use--;
+
+    if (was_full) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty) {
+            // Keep just one empty slab cached; hand the rest back to the heap
+            slab_release(cache, slab);
+        } else {
+            slab_list_add(&cache->empty, slab);
+        }
+    }
+
+    spinlock_release_irq(&cache->lock, flags);
+}
+
+size_t kmem_cache_shrink(kmem_cache_t *cache) {
+    if (!cache) return 0;
+
+    size_t released = 0;
+    uint32_t flags;
+    spinlock_acquire_irq(&cache->lock, &flags);
+    kmem_slab_t *slab;
+    while ((slab = cache->empty)) {
+        slab_list_remove(&cache->empty, slab);
+        slab_release(cache, slab);
+        released += cache->slab_size;
+    }
+    spinlock_release_irq(&cache->lock, flags);
+    return released;
+}
+
+size_t kmem_cache_shrink_all(void) {
+    size_t released = 0;
+    uint32_t flags;
+    spinlock_acquire_irq(&cache_list_lock, &flags);
+    for (kmem_cache_t *cache = cache_list; cache; cache = cache->next) {
+        released += kmem_cache_shrink(cache);
+    }
+    spinlock_release_irq(&cache_list_lock, flags);
+    return released;
+}
+
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats) {
+    if (!cache || !stats) return;
+
+    uint32_t flags;
+    spinlock_acquire_irq(&cache->lock, &flags);
+    stats->name = cache->name;
+    stats->obj_size = cache->obj_size;
+    stats->objs_in_use = cache->objs_in_use;
+    stats->objs_total = cache->num_slabs * cache->objs_per_slab;
+    stats->num_slabs = cache->num_slabs;
+    stats->slab_size = cache->slab_size;
+    stats->waste = cache->num_slabs * cache->slab_size - cache->objs_in_use * cache->obj_size;
+    spinlock_release_irq(&cache->lock, flags);
+}
+
+void print_slab_info(void) {
+    printf("%s: %s %s %s %s %s\n", "cache", "objsize", "active", "total", "slabs", "waste");
+    for (kmem_cache_t *cache = cache_list; cache; cache = cache->next) {
+        kmem_cache_stats_t stats;
+        kmem_cache_get_stats(cache, &stats);
+        printf("%s: %d %d %d %d %d\n", stats.name, stats.obj_size, stats.objs_in_use,
+               stats.objs_total, stats.num_slabs, stats.waste);
+    }
+}
@@ -0,0 +1,356 @@
+#include "kernel/swap.h"
+#include "kernel/pmm.h"
+#include "kernel/vfs.h"
+#include "kernel/process.h"
+#include "kernel/zeropage.h"
+#include "kernel/shrinker.h"
+#include "kernel/locks.h"
+#include "kernel/printf.h"
+#include "kernel/system.h"
+#include "libc/string.h"
+
+extern process_t *process_list;
+extern page_directory_t *kpage_dir;
+
+typedef struct {
+    block_device_t *dev;
+    uint32_t nr_slots;                  // including the header slot 0
+    uint32_t hint;                      // where the next free-slot search starts
+    uint16_t refs[SWAP_MAX_SLOTS];      // swap entries pointing at each slot
+} swap_area_t;
+
+// Filled in the order they were added
+static swap_area_t areas[SWAP_MAX_AREAS];
+static uint32_t nr_areas;
+static swap_stats_t stats;
+// Serialises slot I/O with the PTE updates around it; held with interrupts
+// off, so no thread runs while a page is half way in or out
+static spinlock_t swap_lock;
+// swap_lock is held: an allocation made under it must not re-enter reclaim
+static bool swap_busy;
+
+// Last resort: eviction costs a write.  swap_busy makes it safe inside any
+// allocation.
+static shrinker_t swap_shrinker = {
+    .name = "swap",
+    .scan = swap_reclaim,
+    .cost = SHRINK_COST_IO,
+    .flags = SHRINKER_DIRECT,
+};
+
+// Clock hand: the process it points into and the next user address there
+static size_t hand_pid;
+static uint32_t hand_vaddr;
+
+static void swap_lock_acquire(uint32_t *flags) {
+    spinlock_acquire_irq(&swap_lock, flags);
+    swap_busy = true;
+}
+
+static void swap_lock_release(uint32_t flags) {
+    swap_busy = false;
+    spinlock_release_irq(&swap_lock, flags);
+}
+
+// A swap entry (the frame field of a swap PTE) names an area and a slot in it
+static inline uint32_t make_entry(uint32_t area, uint32_t slot) {
+    return area * SWAP_MAX_SLOTS + slot;
+}
+
+static swap_area_t *entry_area(uint32_t entry, uint32_t *slot) {
+    uint32_t area = entry / SWAP_MAX_SLOTS;
+    *slot = entry % SWAP_MAX_SLOTS;
+    if (area >= nr_areas || *slot == 0 || *slot >= areas[area].nr_slots) return NULL;
+    return &areas[area];
+}
+
+static uint32_t slot_alloc(swap_area_t *area) {
+    for (uint32_t n = 1; n < area->nr_slots; n++) {
+        uint32_t slot = area->hint;
+        area->hint = area->hint + 1 < area->nr_slots ? area->hint + 1 : 1;
+        if (!area->refs[slot]) {
+            area->refs[slot] = 1;
+            stats.used++;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+static void entry_put(uint32_t entry) {
+    uint32_t slot;
+    swap_area_t *area = entry_area(entry, &slot);
+    if (!area || !area->refs[slot]) {
+        kprintf(WARNING, "swap: dropping unused entry %x\n", entry);
+        return;
+    }
+    if (--area->refs[slot]) return;
+
+    stats.used--;
+    // Lets zram give the memory back straight away
+    if (area->dev->discard) area->dev->discard(area->dev, slot * SWAP_PAGE_SECTORS, SWAP_PAGE_SECTORS);
+}
+
+static int dev_io(block_device_t *dev, uint32_t sector, uint8_t *buf, bool write) {
+    if (write && dev->write_blocks) return dev->write_blocks(dev, sector, SWAP_PAGE_SECTORS, buf);
+    if (!write && dev->read_blocks) return dev->read_blocks(dev, sector, SWAP_PAGE_SECTORS, buf);
+
+    for (uint32_t i = 0; i < SWAP_PAGE_SECTORS; i++, buf += SWAP_SECTOR_SIZE) {
+        int rc = write ? dev->write_block(dev, sector + i, buf)
+                       : dev->read_block(dev, sector + i, buf);
+        if (rc != 0) return -1;
+    }
+    return 0;
+}
+
+static int slot_io(swap_area_t *area, uint32_t slot, uint8_t *buf, bool write) {
+    return dev_io(area->dev, slot * SWAP_PAGE_SECTORS, buf, write) == 0 ? 0 : -1;
+}
+
+bool swap_format(const char *device) {
+    block_device_t *dev = get_block_device(device);
+    if (!dev) return false;
+
+    static uint8_t header[PAGE_SIZE];
+    uint32_t magic_len = sizeof(SWAP_MAGIC) - 1;
+    memset(header, 0, sizeof(header));
+    memcpy(header + PAGE_SIZE - magic_len, SWAP_MAGIC, magic_len);
+    return dev_io(dev, 0, header, true) == 0;
+}
+
+bool swap_on(const char *device) {
+    block_device_t *dev = get_block_device(device);
+    if (!dev) {
+        kprintf(INFO, "swap: no %s\n", device);
+        return false;
+    }
+    if (nr_areas == SWAP_MAX_AREAS) {
+        kprintf(WARNING, "swap: no room for %s, already %d areas\n", device, nr_areas);
+        return false;
+    }
+
+    // mkswap leaves its signature in the last bytes of the first page
+    static uint8_t sector[SWAP_SECTOR_SIZE];
+    uint32_t magic_len = sizeof(SWAP_MAGIC) - 1;
+    if (dev->read_block(dev, SWAP_PAGE_SECTORS - 1, sector) != 0 ||
+        memcmp(sector + SWAP_SECTOR_SIZE - magic_len, SWAP_MAGIC, magic_len) != 0) {
+        kprintf(WARNING, "swap: %s has no swap signature, not using it\n", device);
+        return false;
+    }
+
+    uint32_t nr_slots = dev->block_count / SWAP_PAGE_SECTORS;
+    if (nr_slots > SWAP_MAX_SLOTS) nr_slots = SWAP_MAX_SLOTS;
+    if (nr_slots < 2) {
+        kprintf(WARNING, "swap: %s is too small\n", device);
+        return false;
+    }
+
+    uint32_t flags;
+    swap_lock_acquire(&flags);
+    swap_area_t *area = &areas[nr_areas];
+    memset(area, 0, sizeof(*area));
+    area->dev = dev;
+    area->nr_slots = nr_slots;
+    area->hint = 1;
+    nr_areas++;
+    stats.slots += nr_slots - 1;
+    swap_lock_release(flags);
+
+    if (nr_areas == 1) register_shrinker(&swap_shrinker);
+    kprintf(INFO, "swap: %d KB on %s\n", (nr_slots - 1) * (PAGE_SIZE / 1024), device);
+    return true;
+}
+
+bool swap_enabled(void) {
+    return nr_areas != 0;
+}
+
+// Private, single-owner RAM: nothing but this PTE refers to the frame
+static bool evictable(uint32_t vaddr, page_table_entry_t *page) {
+    if (!page->present || !page->user || page->shared) return false;
+    // The signal trampoline's frame belongs to the signal code
+    if (vaddr == SIGRETURN_TRAMPOLINE_ADDR) return false;
+    uint32_t frame = page->frame;
+    return frame < pmm_get_total_blocks() && !is_zero_frame(frame) &&
+           pmm_get_refcount(frame) == 1;
+}
+
+// Write the page out and turn its PTE into a swap entry; swap_lock held
+static int evict(page_directory_t *dir, uint32_t vaddr, page_table_entry_t *page) {
+    uint32_t frame = page->frame;
+    uint8_t *data = kmap_frame(frame, SWAP_TMP);
+    uint32_t entry = 0;
+    // Earlier areas first; one that cannot take the page (full, or zram out
+    // of memory) passes it on to the next
+    for (uint32_t a = 0; a < nr_areas && !entry; a++) {
+        uint32_t slot = slot_alloc(&areas[a]);
+        if (!slot) continue;
+        if (slot_io(&areas[a], slot, data, true) == 0) entry = make_entry(a, slot);
+        else entry_put(make_entry(a, slot));
+    }
+    kunmap_frame(frame, SWAP_TMP);
+    if (!entry) return -1;
+
+    // rw, user and cow stay, so the page comes back with the same protection
+    page->present = 0;
+    page->accessed = 0;
+    page->dirty = 0;
+    page->lazy = 1;
+    page->frame = entry;
+    if (dir == get_active_page_directory()) invalidate_page(vaddr);
+    pmm_free_block(frame);
+    stats.swapped_out++;
+    return 0;
+}
+
+int swap_out(page_directory_t *dir, uint32_t vaddr) {
+    if (!nr_areas) return -1;
+    vaddr = PAGE_ALIGN(vaddr);
+    page_table_entry_t *page = get_page(vaddr, 0, dir);
+    if (!page || !evictable(vaddr, page)) return -1;
+
+    uint32_t flags;
+    swap_lock_acquire(&flags);
+    int rc = evict(dir, vaddr, page);
+    swap_lock_release(flags);
+    return rc;
+}
+
+static bool swappable(process_t *proc) {
+    return !proc->is_kernel_process && proc->status != ZOMBIE &&
+           proc->root_page_table && proc->root_page_table != kpage_dir;
+}
+
+// Move the hand through proc's user PTEs until 'target' pages are freed or
+// it reaches the kernel half.  *full is set when no more can be written.
+static uint32_t scan_process(process_t *proc, uint32_t target, bool *full) {
+    page_directory_t *dir = proc->root_page_table;
+    bool current = dir == get_active_page_directory();
+    uint32_t freed = 0;
+
+    while (hand_vaddr < LOAD_MEMORY_ADDRESS && freed < target) {
+        uint32_t pd = PDE_INDEX(hand_vaddr);
+        page_table_t *table = dir->ref_tables[pd];
+        if (!dir->tables[pd].present || dir->tables[pd].page_size || !table) {
+            hand_vaddr = (pd + 1) << PDE_SHIFT;
+            continue;
+        }
+
+        uint32_t vaddr = hand_vaddr;
+        page_table_entry_t *page = &table->pages[PTE_INDEX(vaddr)];
+        hand_vaddr += PAGE_SIZE;
+        stats.scanned++;
+        if (!evictable(vaddr, page)) continue;
+
+        if (page->accessed) {
+            // Second chance.  Drop the cached entry, or the next use would
+            // not set the bit again.
+            page->accessed = 0;
+            if (current) invalidate_page(vaddr);
+            continue;
+        }
+
+        if (evict(dir, vaddr, page) < 0) {
+            *full = true;
+            break;
+        }
+        freed++;
+    }
+    return freed;
+}
+
+uint32_t swap_reclaim(uint32_t frames) {
+    if (!nr_areas || swap_busy) return 0;
+    uint32_t target = frames > SWAP_CLUSTER ? frames : SWAP_CLUSTER;
+
+    uint32_t flags;
+    swap_lock_acquire(&flags);
+
+    process_t *proc = process_list;
+    while (proc && proc->pid != hand_pid) proc = proc->next;
+    if (!proc) {
+        proc = process_list;
+        hand_vaddr = 0;
+    }
+
+    // At most two turns of the clock: the first may only clear accessed bits
+    uint32_t freed = 0;
+    uint32_t turns = 0;
+    bool full = false;
+    while (proc) {
+        if (swappable(proc)) freed += scan_process(proc, target - freed, &full);
+        if (freed >= target || full) break;
+
+        hand_vaddr = 0;
+        proc = proc->next;
+        if (!proc && ++turns < 2) proc = process_list;
+    }
+    hand_pid = proc ? proc->pid : 0;
+
+    swap_lock_release(flags);
+
+    if (full && stats.used == stats.slots) kprintf(WARNING, "swap: swap space is full\n");
+    return freed;
+}
+
+int swap_in(uint32_t vaddr, page_table_entry_t *page) {
+    if (!pte_is_swap(page)) return -1;
+
+    // Allocate before taking the lock: this may have to reclaim first
+    uint32_t frame = pmm_alloc_highmem_block();
+    if (!frame) {
+        kprintf(ERROR, "swap_in: out of memory at %x\n", vaddr);
+        return -1;
+    }
+
+    uint32_t flags;
+    swap_lock_acquire(&flags);
+    // Another thread may have faulted it in while we were allocating
+    if (!pte_is_swap(page)) {
+        swap_lock_release(flags);
+        pmm_free_block(frame);
+        return 0;
+    }
+
+    uint32_t entry = page->frame;
+    uint32_t slot;
+    swap_area_t *area = entry_area(entry, &slot);
+    int rc = area ? slot_io(area, slot, kmap_frame(frame, SWAP_TMP), false) : -1;
+    if (area) kunmap_frame(frame, SWAP_TMP);
+    if (rc < 0) {
+        swap_lock_release(flags);
+        kprintf(ERROR, "swap_in: cannot read entry %x at %x\n", entry, vaddr);
+        pmm_free_block(frame);
+        return -1;
+    }
+
+    entry_put(entry);
+    page->frame = frame;
+    page->lazy = 0;
+    page->present = 1;
+    stats.swapped_in++;
+    swap_lock_release(flags);
+
+    invalidate_page(PAGE_ALIGN(vaddr));
+    return 0;
+}
+
+void swap_dup(page_table_entry_t *page) {
+    uint32_t flags;
+    swap_lock_acquire(&flags);
+    uint32_t slot;
+    swap_area_t *area = entry_area(page->frame, &slot);
+    if (area && area->refs[slot]) area->refs[slot]++;
+    swap_lock_release(flags);
+}
+
+void swap_free(page_table_entry_t *page) {
+    uint32_t flags;
+    swap_lock_acquire(&flags);
+    entry_put(page->frame);
+    swap_lock_release(flags);
+}
+
+void swap_get_stats(swap_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,110 @@
+#include "kernel/tlb.h"
+#include "kernel/pmm.h"
+#include "kernel/swap.h"
+#include "kernel/system.h"
+#include "libc/string.h"
+
+static tlb_stats_t stats;
+
+void flush_tlb(void) {
+    uint32_t cr3;
+    get_cr3(&cr3);
+    asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
+void flush_tlb_global(void) {
+    uint32_t cr4 = read_cr4();
+    if (!(cr4 & CR4_PGE)) {
+        flush_tlb();
+        return;
+    }
+    // Toggling CR4.PGE drops global entries too
+    write_cr4(cr4 & ~CR4_PGE);
+    write_cr4(cr4);
+}
+
+void tlb_gather_init(tlb_gather_t *tlb, page_directory_t *dir) {
+    tlb->dir = dir;
+    tlb->global = false;
+    tlb->flush_all = false;
+    tlb->nr_pages = 0;
+    tlb->nr_frames = 0;
+    tlb->nr_huge = 0;
+}
+
+void tlb_gather_page(tlb_gather_t *tlb, uint32_t vaddr) {
+    if (vaddr >= LOAD_MEMORY_ADDRESS) tlb->global = true;
+    if (tlb->flush_all) return;
+    if (tlb->nr_pages == TLB_GATHER_PAGES) {
+        tlb->flush_all = true;
+        return;
+    }
+    tlb->pages[tlb->nr_pages++] = PAGE_ALIGN(vaddr);
+}
+
+void tlb_gather_frame(tlb_gather_t *tlb, uint32_t frame) {
+    if (!frame) return;
+    // Out of room: flush now so the held frames can go
+    if (tlb->nr_frames == TLB_GATHER_FRAMES) tlb_finish(tlb);
+    tlb->frames[tlb->nr_frames++] = frame;
+}
+
+static void tlb_flush(tlb_gather_t *tlb) {
+    if (!tlb->nr_pages && !tlb->flush_all) return;
+
+    // User entries of another address space are not in the TLB
+    if (!tlb->global && tlb->dir != get_active_page_directory()) {
+        stats.skipped++;
+    } else if (tlb->flush_all) {
+        if (tlb->global) flush_tlb_global();
+        else flush_tlb();
+        stats.full_flushes++;
+    } else {
+        for (uint32_t i = 0; i < tlb->nr_pages; i++) invalidate_page(tlb->pages[i]);
+        stats.page_flushes += tlb->nr_pages;
+    }
+
+    tlb->nr_pages = 0;
+    tlb->flush_all = false;
+    tlb->global = false;
+}
+
+void tlb_finish(tlb_gather_t *tlb) {
+    tlb_flush(tlb);
+
+    for (uint32_t i = 0; i < tlb->nr_frames; i++) pmm_free_block(tlb->frames[i]);
+    tlb->nr_frames = 0;
+
+    // Each frame of a large page holds its own reference
+    for (uint32_t i = 0; i < tlb->nr_huge; i++) {
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) pmm_deref_frame(tlb->huge[i] + j);
+    }
+    tlb->nr_huge = 0;
+}
+
+void tlb_unmap_page(tlb_gather_t *tlb, uint32_t vaddr, page_table_entry_t *page) {
+    if (!page) return;
+    if (page->present) {
+        tlb_gather_frame(tlb, page->frame);
+        tlb_gather_page(tlb, vaddr);
+    } else if (pte_is_swap(page)) {
+        swap_free(page);
+    }
+    // A reservation that was never touched or swapped out has nothing cached
+    memset(page, 0, sizeof(page_table_entry_t));
+}
+
+bool tlb_unmap_huge(tlb_gather_t *tlb, uint32_t virt) {
+    page_directory_entry_t *pde = &tlb->dir->tables[PDE_INDEX(virt)];
+    if (virt >= LOAD_MEMORY_ADDRESS || !pde->present || !pde->page_size) return false;
+
+    if (tlb->nr_huge == TLB_GATHER_HUGE) tlb_finish(tlb);
+    tlb->huge[tlb->nr_huge++] = pde->frame;
+    memset(pde, 0, sizeof(*pde));
+    tlb_gather_page(tlb, virt & ~(LARGE_PAGE_SIZE - 1));
+    return true;
+}
+
+void tlb_get_stats(tlb_stats_t *out) {
+    *out = stats;
+}
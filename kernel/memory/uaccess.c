@@ -0,0 +1,100 @@
+#include "kernel/uaccess.h"
+#include "kernel/paging.h"
+#include "libc/string.h"
+
+// Bounds of the __ex_table section, from the linker script
+extern const exception_table_entry_t __ex_table_start[];
+extern const exception_table_entry_t __ex_table_end[];
+
+uint32_t search_exception_table(uint32_t eip) {
+    // Only consulted on a faulting access, and the table is tiny
+    for (const exception_table_entry_t *e = __ex_table_start; e < __ex_table_end; e++) {
+        if (e->insn == eip) return e->fixup;
+    }
+    return 0;
+}
+
+// Copy with string moves; returns the number of bytes NOT copied
+static size_t raw_copy(void *dst, const void *src, size_t size) {
+    size_t left;
+    asm volatile("1: rep movsl\n"
+                 "   movl %[tail], %%ecx\n"
+                 "4: rep movsb\n"
+                 "2:\n"
+                 ".section .fixup, \"ax\"\n"
+                 // Faulted in the dword loop: the tail is still outstanding too
+                 "3: leal (%[tail], %%ecx, 4), %%ecx\n"
+                 "   jmp 2b\n"
+                 ".previous\n"
+                 ".section __ex_table, \"a\"\n"
+                 "   .long 1b, 3b\n"
+                 "   .long 4b, 2b\n"
+                 ".previous\n"
+                 : "+D"(dst), "+S"(src), "=c"(left)
+                 : "2"(size / 4), [tail] "r"(size & 3)
+                 : "memory");
+    return left;
+}
+
+int __copy_to_user(void *udst, const void *src, size_t size) {
+    if (!access_ok(udst, size)) return -EFAULT;
+    return raw_copy(udst, src, size) ? -EFAULT : 0;
+}
+
+int __copy_from_user(void *dst, const void *usrc, size_t size) {
+    if (!access_ok(usrc, size)) {
+        memset(dst, 0, size);
+        return -EFAULT;
+    }
+
+    size_t left = raw_copy(dst, usrc, size);
+    if (left) {
+        // Never hand back stale kernel data in the part that was not read
+        memset((uint8_t *)dst + size - left, 0, left);
+        return -EFAULT;
+    }
+    return 0;
+}
+
+int __clear_user(void *udst, size_t size) {
+    if (!access_ok(udst, size)) return -EFAULT;
+
+    size_t left = size;
+    asm volatile("1: rep stosb\n"
+                 "2:\n"
+                 ".section __ex_table, \"a\"\n"
+                 "   .long 1b, 2b\n"
+                 ".previous\n"
+                 : "+D"(udst), "+c"(left)
+                 : "a"(0)
+                 : "memory");
+    return left ? -EFAULT : 0;
+}
+
+int __strncpy_from_user(char *dst, const char *usrc, size_t max) {
+    if (!max) return 0;
+
+    for (size_t i = 0; i < max; i++) {
+        if ((uint32_t)(usrc + i) >= LOAD_MEMORY_ADDRESS) return -EFAULT;
+        if (__get_user(dst[i], usrc + i)) return -EFAULT;
+        if (dst[i] == '\0') return (int)i;
+    }
+    dst[max - 1] = '\0';
+    return (int)max - 1;
+}
+
+int fault_in_user(void *uptr, size_t size, bool write) {
+    if (!size) return 0;
+    if (!access_ok(uptr, size)) return -EFAULT;
+
+    uint32_t start = PAGE_ALIGN((uint32_t)uptr);
+    uint32_t end = (uint32_t)uptr + size;
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        // Probe the first byte of the buffer within this page
+        uint8_t *p = (uint8_t *)(addr < (uint32_t)uptr ? (uint32_t)uptr : addr);
+        uint8_t val;
+        if (__get_user(val, p)) return -EFAULT;
+        if (write && __put_user(val, p)) return -EFAULT;
+    }
+    return 0;
+}
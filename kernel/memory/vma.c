@@ -0,0 +1,305 @@
+/*
+ * vma.c — Per-process virtual memory areas.
+ *
+ * Areas never overlap, so moving an area's start or end inside the gap
+ * next to it keeps the tree ordered: splits and merges adjust the existing
+ * nodes in place and only insert or remove the piece that appears or goes.
+ */
+
+#include "kernel/vma.h"
+#include "kernel/slab.h"
+#include "kernel/printf.h"
+#include "common/syscall.h"
+#include "libc/stdio.h"
+#include "libc/string.h"
+
+static kmem_cache_t *vma_cache;
+
+static inline int height(vma_t *n) {
+    return n ? n->height : 0;
+}
+
+static inline void update_height(vma_t *n) {
+    int l = height(n->left), r = height(n->right);
+    n->height = 1 + (l > r ? l : r);
+}
+
+static vma_t *rotate_right(vma_t *y) {
+    vma_t *x = y->left;
+    y->left = x->right;
+    x->right = y;
+    update_height(y);
+    update_height(x);
+    return x;
+}
+
+static vma_t *rotate_left(vma_t *x) {
+    vma_t *y = x->right;
+    x->right = y->left;
+    y->left = x;
+    update_height(x);
+    update_height(y);
+    return y;
+}
+
+static vma_t *rebalance(vma_t *n) {
+    update_height(n);
+    int balance = height(n->left) - height(n->right);
+    if (balance > 1) {
+        if (height(n->left->left) < height(n->left->right)) n->left = rotate_left(n->left);
+        return rotate_right(n);
+    }
+    if (balance < -1) {
+        if (height(n->right->right) < height(n->right->left)) n->right = rotate_right(n->right);
+        return rotate_left(n);
+    }
+    return n;
+}
+
+static vma_t *avl_insert(vma_t *root, vma_t *node) {
+    if (!root) return node;
+    if (node->start < root->start) root->left = avl_insert(root->left, node);
+    else root->right = avl_insert(root->right, node);
+    return rebalance(root);
+}
+
+static vma_t *avl_remove_min(vma_t *n, vma_t **min) {
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+    n->left = avl_remove_min(n->left, min);
+    return rebalance(n);
+}
+
+static vma_t *avl_remove(vma_t *root, vma_t *node) {
+    if (!root) return NULL;
+    if (node->start < root->start) {
+        root->left = avl_remove(root->left, node);
+    } else if (node->start > root->start) {
+        root->right = avl_remove(root->right, node);
+    } else {
+        vma_t *l = root->left, *r = root->right;
+        if (!r) return l;
+        vma_t *min;
+        r = avl_remove_min(r, &min);
+        min->left = l;
+        min->right = r;
+        return rebalance(min);
+    }
+    return rebalance(root);
+}
+
+// Last area starting at or below addr, or NULL
+static vma_t *floor_vma(vma_tree_t *tree, uint32_t addr) {
+    vma_t *best = NULL;
+    for (vma_t *n = tree->root; n; ) {
+        if (n->start <= addr) {
+            best = n;
+            n = n->right;
+        } else {
+            n = n->left;
+        }
+    }
+    return best;
+}
+
+static vma_t *vma_alloc(uint32_t start, uint32_t end, uint32_t prot, uint32_t flags,
+                        vfs_file_t *file, uint32_t offset) {
+    if (!vma_cache) vma_cache = kmem_cache_create("vma_t", sizeof(vma_t), 0, NULL);
+    vma_t *v = (vma_t *)kmem_cache_zalloc(vma_cache);
+    if (!v) {
+        kprintf(ERROR, "vma: out of memory\n");
+        return NULL;
+    }
+    v->start = start;
+    v->end = end;
+    v->prot = prot;
+    v->flags = flags;
+    v->file = file;
+    v->offset = offset;
+    v->height = 1;
+    if (file) file->ref_count++;
+    return v;
+}
+
+// Insert 'node' right after 'prev' (NULL: at the front)
+static void link_vma(vma_tree_t *tree, vma_t *node, vma_t *prev) {
+    node->prev = prev;
+    node->next = prev ? prev->next : tree->first;
+    if (node->next) node->next->prev = node;
+    if (prev) prev->next = node;
+    else tree->first = node;
+
+    tree->root = avl_insert(tree->root, node);
+    tree->count++;
+}
+
+static void free_vma(vma_t *v) {
+    if (v->file) vfs_close(v->file);
+    kmem_cache_free(vma_cache, v);
+}
+
+static void unlink_vma(vma_tree_t *tree, vma_t *node) {
+    tree->root = avl_remove(tree->root, node);
+    if (node->prev) node->prev->next = node->next;
+    else tree->first = node->next;
+    if (node->next) node->next->prev = node->prev;
+    tree->count--;
+    free_vma(node);
+}
+
+// Cut v at addr (strictly inside it); returns the upper half
+static vma_t *split_vma(vma_tree_t *tree, vma_t *v, uint32_t addr) {
+    vma_t *upper = vma_alloc(addr, v->end, v->prot, v->flags,
+                             v->file, v->offset + (addr - v->start));
+    if (!upper) return NULL;
+    v->end = addr;
+    link_vma(tree, upper, v);
+    return upper;
+}
+
+static inline bool can_merge(vma_t *a, vma_t *b) {
+    return a->end == b->start && a->prot == b->prot && a->flags == b->flags &&
+           a->file == b->file && (!a->file || a->offset + (a->end - a->start) == b->offset);
+}
+
+// Merge compatible neighbours among the areas touching [from, to]
+static void merge_range(vma_tree_t *tree, vma_t *from, uint32_t to) {
+    if (from && from->prev) from = from->prev;
+    for (vma_t *v = from; v && v->start <= to; ) {
+        vma_t *next = v->next;
+        if (next && can_merge(v, next)) {
+            v->end = next->end;
+            unlink_vma(tree, next);
+        } else {
+            v = next;
+        }
+    }
+}
+
+void vma_init(vma_tree_t *tree) {
+    memset(tree, 0, sizeof(*tree));
+}
+
+void vma_destroy(vma_tree_t *tree) {
+    for (vma_t *v = tree->first; v; ) {
+        vma_t *next = v->next;
+        free_vma(v);
+        v = next;
+    }
+    vma_init(tree);
+}
+
+int vma_copy(vma_tree_t *dst, const vma_tree_t *src) {
+    vma_init(dst);
+    vma_t *last = NULL;
+    for (vma_t *v = src->first; v; v = v->next) {
+        vma_t *copy = vma_alloc(v->start, v->end, v->prot, v->flags, v->file, v->offset);
+        if (!copy) {
+            vma_destroy(dst);
+            return -1;
+        }
+        link_vma(dst, copy, last);
+        last = copy;
+    }
+    return 0;
+}
+
+vma_t *vma_find(vma_tree_t *tree, uint32_t addr) {
+    vma_t *v = floor_vma(tree, addr);
+    return (v && addr < v->end) ? v : NULL;
+}
+
+bool vma_range_free(vma_tree_t *tree, uint32_t start, uint32_t end) {
+    // Only the last area starting below 'end' can reach into the range
+    vma_t *v = floor_vma(tree, end - 1);
+    return !v || v->end <= start;
+}
+
+int vma_map(vma_tree_t *tree, uint32_t start, uint32_t end, uint32_t prot, uint32_t flags) {
+    return vma_map_file(tree, start, end, prot, flags, NULL, 0);
+}
+
+int vma_map_file(vma_tree_t *tree, uint32_t start, uint32_t end, uint32_t prot,
+                 uint32_t flags, vfs_file_t *file, uint32_t offset) {
+    if (start >= end || !vma_range_free(tree, start, end)) return -1;
+
+    vma_t *v = vma_alloc(start, end, prot, flags, file, offset);
+    if (!v) return -1;
+    link_vma(tree, v, floor_vma(tree, start));
+    merge_range(tree, v, end);
+    return 0;
+}
+
+int vma_unmap(vma_tree_t *tree, uint32_t start, uint32_t end) {
+    vma_t *v = floor_vma(tree, start);
+    if (!v || v->end <= start) v = v ? v->next : tree->first;
+
+    while (v && v->start < end) {
+        if (v->start < start) {
+            // Keep the part below the range; the upper half is handled next
+            if (!split_vma(tree, v, start)) return -1;
+            v = v->next;
+            continue;
+        }
+        if (v->end > end && !split_vma(tree, v, end)) return -1;
+
+        vma_t *next = v->next;
+        unlink_vma(tree, v);
+        v = next;
+    }
+    return 0;
+}
+
+int vma_protect(vma_tree_t *tree, uint32_t start, uint32_t end, uint32_t prot) {
+    vma_t *v = vma_find(tree, start);
+    if (!v || start >= end) return -1;
+
+    // The whole range must be mapped, without holes
+    uint32_t covered = v->end;
+    for (vma_t *w = v->next; w && covered < end && w->start == covered; w = w->next) covered = w->end;
+    if (covered < end) return -1;
+
+    if (v->start < start && !(v = split_vma(tree, v, start))) return -1;
+    for (vma_t *w = v; w && w->start < end; w = w->next) {
+        if (w->end > end && !split_vma(tree, w, end)) return -1;
+        w->prot = prot;
+    }
+    merge_range(tree, v, end);
+    return 0;
+}
+
+uint32_t vma_find_gap(vma_tree_t *tree, uint32_t size, uint32_t align, uint32_t low, uint32_t high) {
+    uint32_t addr = (low + align - 1) & ~(align - 1);
+    vma_t *v = floor_vma(tree, addr);
+    if (!v) v = tree->first;
+
+    for (; v; v = v->next) {
+        if (v->end <= addr) continue;
+        if (addr + size <= v->start) break;     // the gap below v fits
+        addr = (v->end + align - 1) & ~(align - 1);
+        if (addr < v->end) return 0;            // wrapped
+    }
+
+    if (addr + size < addr || addr + size > high) return 0;
+    return addr;
+}
+
+int vma_format(vma_tree_t *tree, char *buf, size_t size) {
+    int len = 0;
+    for (vma_t *v = tree->first; v && (size_t)len < size; v = v->next) {
+        const char *name = v->file ? "[file]" :
+                           (v->flags & VMA_HEAP) ? "[heap]" :
+                           (v->flags & VMA_STACK) ? "[stack]" :
+                           (v->flags & VMA_HUGE) ? "[anon:huge]" : "[anon]";
+        len += snprintf(buf + len, size - len, "%08x-%08x %c%c%c%c %08x %s\n",
+                        v->start, v->end,
+                        (v->prot & PROT_READ) ? 'r' : '-',
+                        (v->prot & PROT_WRITE) ? 'w' : '-',
+                        (v->prot & PROT_EXEC) ? 'x' : '-',
+                        (v->flags & VMA_SHARED) ? 's' : 'p',
+                        v->offset, name);
+    }
+    return (size_t)len < size ? len : (int)size - 1;
+}
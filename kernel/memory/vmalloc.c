@@ -0,0 +1,165 @@
+/*
+ * vmalloc.c — Virtually contiguous kernel allocations.
+ *
+ * A bitmap tracks which pages of the window are handed out; each area
+ * claims its pages plus one trailing guard page that is never mapped.  No
+ * per-area record is kept: vfree finds the end of an area by walking its
+ * PTEs up to the guard.
+ */
+
+#include "kernel/vmalloc.h"
+#include "kernel/kheap.h"
+#include "kernel/pmm.h"
+#include "kernel/tlb.h"
+#include "kernel/printf.h"
+#include "kernel/locks.h"
+#include "libc/string.h"
+
+extern page_directory_t *kpage_dir;
+
+static uint32_t page_bitmap[VMALLOC_PAGES / 32];
+static spinlock_t vmalloc_lock;
+static vmalloc_stats_t stats;
+
+#define PAGE_USED(i) (page_bitmap[(i) / 32] & (1u << ((i) % 32)))
+
+// First fit for 'count' free pages; marks them used
+static int32_t range_alloc(uint32_t count) {
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < VMALLOC_PAGES; i++) {
+        if (i % 32 == 0 && page_bitmap[i / 32] == 0xFFFFFFFF) {
+            run = 0;
+            i += 31;
+            continue;
+        }
+        if (PAGE_USED(i)) {
+            run = 0;
+            continue;
+        }
+        if (++run < count) continue;
+
+        uint32_t first = i + 1 - count;
+        for (uint32_t j = first; j <= i; j++) page_bitmap[j / 32] |= 1u << (j % 32);
+        return first;
+    }
+    return -1;
+}
+
+static void range_free(uint32_t first, uint32_t count) {
+    for (uint32_t j = first; j < first + count; j++) page_bitmap[j / 32] &= ~(1u << (j % 32));
+}
+
+static inline uint32_t page_vaddr(uint32_t index) {
+    return VMALLOC_START + index * PAGE_SIZE;
+}
+
+static void unmap_pages(uint32_t first, uint32_t count) {
+    // Global entries: a large area costs one global flush, not an invlpg per page
+    tlb_gather_t tlb;
+    tlb_gather_init(&tlb, kpage_dir);
+    for (uint32_t i = first; i < first + count; i++) {
+        tlb_unmap_page(&tlb, page_vaddr(i), get_page(page_vaddr(i), 0, kpage_dir));
+    }
+    tlb_finish(&tlb);
+}
+
+void vmalloc_init(page_directory_t *kdir) {
+    memset(page_bitmap, 0, sizeof(page_bitmap));
+    memset(&stats, 0, sizeof(stats));
+    spinlock_init(&vmalloc_lock);
+
+    // Never hand out the first page, so the first area has a guard below it too
+    page_bitmap[0] = 1;
+
+    for (uint32_t va = VMALLOC_START; va < VMALLOC_START + VMALLOC_SIZE; va += PAGE_ENTRIES * PAGE_SIZE) {
+        get_page(va, 1, kdir);
+    }
+}
+
+void *vmalloc(size_t size) {
+    if (!size || size > VMALLOC_SIZE) return NULL;
+    uint32_t pages = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+
+    uint32_t flags;
+    spinlock_acquire_irq(&vmalloc_lock, &flags);
+    int32_t first = range_alloc(pages + 1);
+    if (first < 0) stats.failures++;
+    spinlock_release_irq(&vmalloc_lock, flags);
+
+    if (first < 0) {
+        kprintf(ERROR, "vmalloc: no room for %d pages\n", pages);
+        return NULL;
+    }
+
+    // The range is ours now; map it without holding the lock
+    for (uint32_t i = 0; i < pages; i++) {
+        page_table_entry_t *page = get_page(page_vaddr(first + i), 0, kpage_dir);
+        if (!page || !alloc_page(page, PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL)) {
+            kprintf(ERROR, "vmalloc: out of frames after %d of %d pages\n", i, pages);
+            unmap_pages(first, i);
+            spinlock_acquire_irq(&vmalloc_lock, &flags);
+            range_free(first, pages + 1);
+            stats.failures++;
+            spinlock_release_irq(&vmalloc_lock, flags);
+            return NULL;
+        }
+        memset((void *)page_vaddr(first + i), 0, PAGE_SIZE);
+    }
+
+    spinlock_acquire_irq(&vmalloc_lock, &flags);
+    stats.areas++;
+    stats.pages_mapped += pages;
+    spinlock_release_irq(&vmalloc_lock, flags);
+    return (void *)page_vaddr(first);
+}
+
+void vfree(void *addr) {
+    if (!addr) return;
+
+    uint32_t first = ((uint32_t)addr - VMALLOC_START) / PAGE_SIZE;
+    page_table_entry_t *below = get_page((uint32_t)addr - PAGE_SIZE, 0, kpage_dir);
+    if (!is_vmalloc_addr(addr) || !IS_ALIGN(addr) || (below && below->present)) {
+        kprintf(WARNING, "vfree: %x is not the start of a vmalloc area (caller=%x)\n",
+                addr, (uint32_t)__builtin_return_address(0));
+        return;
+    }
+
+    uint32_t pages = 0;
+    for (uint32_t i = first; i < VMALLOC_PAGES; i++) {
+        page_table_entry_t *page = get_page(page_vaddr(i), 0, kpage_dir);
+        if (!page || !page->present) break;
+        pages++;
+    }
+    if (!pages) {
+        kprintf(WARNING, "vfree: double free of %x\n", addr);
+        return;
+    }
+    unmap_pages(first, pages);
+
+    uint32_t flags;
+    spinlock_acquire_irq(&vmalloc_lock, &flags);
+    range_free(first, pages + 1);
+    stats.areas--;
+    stats.pages_mapped -= pages;
+    spinlock_release_irq(&vmalloc_lock, flags);
+}
+
+void *kvmalloc(size_t size) {
+    if (size > KVMALLOC_THRESHOLD) {
+        void *addr = vmalloc(size);
+        if (addr) return addr;
+    }
+    return kmalloc(size);
+}
+
+void kvfree(void *addr) {
+    if (is_vmalloc_addr(addr)) vfree(addr);
+    else kfree(addr);
+}
+
+void vmalloc_get_stats(vmalloc_stats_t *out) {
+    uint32_t flags;
+    spinlock_acquire_irq(&vmalloc_lock, &flags);
+    *out = stats;
+    spinlock_release_irq(&vmalloc_lock, flags);
+}
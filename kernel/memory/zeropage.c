@@ -0,0 +1,109 @@
+#include "kernel/zeropage.h"
+#include "kernel/paging.h"
+#include "kernel/pmm.h"
+#include "kernel/printf.h"
+#include "kernel/locks.h"
+#include "kernel/shrinker.h"
+#include "libc/string.h"
+
+uint32_t zero_frame;
+
+static uint32_t pool[ZERO_POOL_MAX];
+static zero_pool_stats_t stats;
+static spinlock_t pool_lock;
+// ZERO_TMP is used by faulting threads and the idle loop alike
+static spinlock_t window_lock;
+
+// Zero a frame from any zone; the window is held for one memset, interrupts off
+static void zero_frame_contents(uint32_t frame) {
+    uint32_t flags;
+    spinlock_acquire_irq(&window_lock, &flags);
+    memset(kmap_frame(frame, ZERO_TMP), 0, PAGE_SIZE);
+    kunmap_frame(frame, ZERO_TMP);
+    spinlock_release_irq(&window_lock, flags);
+}
+
+// Pre-zeroed frames are only a head start: hand them back under pressure
+static uint32_t zero_pool_shrink(uint32_t frames) {
+    uint32_t freed = 0;
+    while (freed < frames) {
+        uint32_t flags;
+        spinlock_acquire_irq(&pool_lock, &flags);
+        uint32_t frame = stats.pooled ? pool[--stats.pooled] : 0;
+        spinlock_release_irq(&pool_lock, flags);
+        if (!frame) break;
+        pmm_free_block(frame);
+        freed++;
+    }
+    return freed;
+}
+
+static shrinker_t zero_pool_shrinker = {
+    .name = "zero pool",
+    .scan = zero_pool_shrink,
+    .cost = SHRINK_COST_FREE,
+    .flags = SHRINKER_DIRECT,
+};
+
+void zero_page_init(void) {
+    spinlock_init(&pool_lock);
+    spinlock_init(&window_lock);
+    memset(&stats, 0, sizeof(stats));
+
+    zero_frame = pmm_alloc_low_block();
+    void *addr = phys_to_virt(zero_frame * PAGE_SIZE);
+    if (!zero_frame || !addr) {
+        kprintf(ERROR, "zero_page_init: no directly mapped frame for the zero page\n");
+        return;
+    }
+    memset(addr, 0, PAGE_SIZE);
+    // Shared by every untouched anonymous page; never freed or recounted
+    pmm_pin_frame(zero_frame);
+    register_shrinker(&zero_pool_shrinker);
+}
+
+uint32_t alloc_zeroed_frame(void) {
+    uint32_t flags;
+    spinlock_acquire_irq(&pool_lock, &flags);
+    if (stats.pooled) {
+        uint32_t frame = pool[--stats.pooled];
+        stats.hits++;
+        spinlock_release_irq(&pool_lock, flags);
+        return frame;
+    }
+    stats.misses++;
+    spinlock_release_irq(&pool_lock, flags);
+
+    uint32_t frame = pmm_alloc_highmem_block();
+    if (!frame) return 0;
+    zero_frame_contents(frame);
+    return frame;
+}
+
+void zero_pool_refill(void) {
+    for (uint32_t i = 0; i < ZERO_POOL_BATCH; i++) {
+        // Below the low watermark the pool is being shrunk, not filled
+        if (stats.pooled >= ZERO_POOL_MAX || pmm_memory_low()) return;
+
+        uint32_t frame = pmm_try_alloc_pages(PMM_ZONE_HIGHMEM, 0);
+        if (!frame) return;
+        zero_frame_contents(frame);
+
+        uint32_t flags;
+        spinlock_acquire_irq(&pool_lock, &flags);
+        if (stats.pooled < ZERO_POOL_MAX) {
+            pool[stats.pooled++] = frame;
+            stats.refilled++;
+            frame = 0;
+        }
+        spinlock_release_irq(&pool_lock, flags);
+        if (frame) pmm_free_block(frame);
+    }
+}
+
+void zero_pool_get_stats(zero_pool_stats_t *out) {
+    uint32_t flags;
+    spinlock_acquire_irq(&pool_lock, &flags);
+    *out = stats;
+    spinlock_release_irq(&pool_lock, flags);
+}
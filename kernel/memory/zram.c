@@ -0,0 +1,225 @@
+#include "kernel/zram.h"
+#include "kernel/zsmalloc.h"
+#include "kernel/lz4.h"
+#include "kernel/vfs.h"
+#include "kernel/pmm.h"
+#include "kernel/vmalloc.h"
+#include "kernel/locks.h"
+#include "kernel/printf.h"
+#include "libc/string.h"
+
+#define SECTOR_SIZE      512
+#define SECTORS_PER_PAGE (PAGE_SIZE / SECTOR_SIZE)
+
+#define ZRAM_SAME 0x1       // value is the repeated word
+#define ZRAM_HUGE 0x2       // value is a frame holding the page as is
+
+typedef struct {
+    uint32_t value;         // zsmalloc handle, or see the flags
+    uint16_t size;          // compressed bytes
+    uint16_t flags;
+} zram_entry_t;
+
+static zram_entry_t *table;     // one entry per page of the disk
+static uint32_t nr_pages;
+static zs_pool_t *pool;
+static zram_stats_t stats;
+static spinlock_t zram_lock;
+
+// Scratch space, used under zram_lock
+static uint8_t page_buf[PAGE_SIZE];
+static uint8_t compress_buf[ZS_MAX_SIZE];
+static uint8_t lz4_wrkmem[LZ4_WORKMEM_SIZE];
+
+static bool entry_used(zram_entry_t *e) {
+    return e->value || e->flags;
+}
+
+static void zram_free_page(uint32_t index) {
+    zram_entry_t *e = &table[index];
+    if (!entry_used(e)) return;
+
+    if (e->flags & ZRAM_SAME) {
+        stats.same_pages--;
+    } else if (e->flags & ZRAM_HUGE) {
+        pmm_free_block(e->value);
+        stats.huge_pages--;
+    } else {
+        zs_free(pool, e->value);
+        stats.compr_bytes -= e->size;
+    }
+    stats.pages_stored--;
+    memset(e, 0, sizeof(*e));
+}
+
+static bool same_filled(const uint8_t *page, uint32_t *value) {
+    const uint32_t *words = (const uint32_t *)page;
+    for (uint32_t i = 1; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != words[0]) return false;
+    }
+    *value = words[0];
+    return true;
+}
+
+static int zram_read_page(uint32_t index, uint8_t *dst) {
+    zram_entry_t *e = &table[index];
+    if (!entry_used(e)) {
+        // Never written: reads as zero
+        memset(dst, 0, PAGE_SIZE);
+    } else if (e->flags & ZRAM_SAME) {
+        uint32_t *words = (uint32_t *)dst;
+        for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) words[i] = e->value;
+    } else if (e->flags & ZRAM_HUGE) {
+        memcpy(dst, phys_to_virt(e->value * PAGE_SIZE), PAGE_SIZE);
+    } else if (lz4_decompress(zs_map(e->value), e->size, dst, PAGE_SIZE) != PAGE_SIZE) {
+        kprintf(ERROR, "zram: page %d is corrupt\n", index);
+        return -1;
+    }
+    return 0;
+}
+
+// Store a page; the old contents are only dropped once the new ones are in
+static int zram_write_page(uint32_t index, const uint8_t *src) {
+    zram_entry_t entry = { 0 };
+    uint32_t size = 0;
+
+    if (same_filled(src, &entry.value)) {
+        entry.flags = ZRAM_SAME;
+    } else if ((size = lz4_compress(src, PAGE_SIZE, compress_buf, ZS_MAX_SIZE, lz4_wrkmem))) {
+        zs_handle_t handle = zs_malloc(pool, size);
+        if (!handle) return -1;
+        memcpy(zs_map(handle), compress_buf, size);
+        entry.value = handle;
+        entry.size = size;
+    } else {
+        // Does not compress enough to be worth packing
+        uint32_t frame = pmm_alloc_low_block();
+        if (!frame) return -1;
+        memcpy(phys_to_virt(frame * PAGE_SIZE), src, PAGE_SIZE);
+        entry.value = frame;
+        entry.flags = ZRAM_HUGE;
+    }
+
+    zram_free_page(index);
+    table[index] = entry;
+    if (entry.flags & ZRAM_SAME) stats.same_pages++;
+    else if (entry.flags & ZRAM_HUGE) stats.huge_pages++;
+    else stats.compr_bytes += size;
+    stats.pages_stored++;
+    return 0;
+}
+
+// Transfer [block, block + count): whole pages directly, partial ones
+// through page_buf.  zram_lock held.
+static int zram_io(uint32_t block, uint32_t count, uint8_t *buf, bool write) {
+    if (block + count < block || block + count > nr_pages * SECTORS_PER_PAGE) return -1;
+
+    while (count) {
+        uint32_t index = block / SECTORS_PER_PAGE;
+        uint32_t first = block % SECTORS_PER_PAGE;
+        uint32_t n = SECTORS_PER_PAGE - first;
+        if (n > count) n = count;
+
+        if (n == SECTORS_PER_PAGE) {
+            if ((write ? zram_write_page(index, buf) : zram_read_page(index, buf)) < 0) return -1;
+        } else {
+            if (zram_read_page(index, page_buf) < 0) return -1;
+            uint8_t *part = page_buf + first * SECTOR_SIZE;
+            if (!write) {
+                memcpy(buf, part, n * SECTOR_SIZE);
+            } else {
+                memcpy(part, buf, n * SECTOR_SIZE);
+                if (zram_write_page(index, page_buf) < 0) return -1;
+            }
+        }
+
+        block += n;
+        count -= n;
+        buf += n * SECTOR_SIZE;
+    }
+    return 0;
+}
+
+static int zram_read_blocks(block_device_t *dev, uint32_t block, uint32_t count, void *buf) {
+    (void)dev;
+    uint32_t flags;
+    spinlock_acquire_irq(&zram_lock, &flags);
+    int rc = zram_io(block, count, buf, false);
+    spinlock_release_irq(&zram_lock, flags);
+    return rc;
+}
+
+static int zram_write_blocks(block_device_t *dev, uint32_t block, uint32_t count, const void *buf) {
+    (void)dev;
+    uint32_t flags;
+    spinlock_acquire_irq(&zram_lock, &flags);
+    int rc = zram_io(block, count, (uint8_t *)buf, true);
+    spinlock_release_irq(&zram_lock, flags);
+    return rc;
+}
+
+static int zram_read_block(block_device_t *dev, uint32_t block, void *buf) {
+    return zram_read_blocks(dev, block, 1, buf);
+}
+
+static int zram_write_block(block_device_t *dev, uint32_t block, const void *buf) {
+    return zram_write_blocks(dev, block, 1, buf);
+}
+
+// Only pages covered in full are dropped
+static void zram_discard(block_device_t *dev, uint32_t block, uint32_t count) {
+    (void)dev;
+    uint32_t first = (block + SECTORS_PER_PAGE - 1) / SECTORS_PER_PAGE;
+    uint32_t end = (block + count) / SECTORS_PER_PAGE;
+    if (end > nr_pages) end = nr_pages;
+
+    uint32_t flags;
+    spinlock_acquire_irq(&zram_lock, &flags);
+    for (uint32_t index = first; index < end; index++) zram_free_page(index);
+    spinlock_release_irq(&zram_lock, flags);
+}
+
+static block_device_t zram_dev = {
+    .name = ZRAM_DEVICE,
+    .read_block = zram_read_block,
+    .write_block = zram_write_block,
+    .read_blocks = zram_read_blocks,
+    .write_blocks = zram_write_blocks,
+    .discard = zram_discard,
+};
+
+bool zram_init(uint32_t pages) {
+    spinlock_init(&zram_lock);
+    memset(&stats, 0, sizeof(stats));
+    if (!pages) return false;
+
+    // vmalloc memory comes back zeroed: every page starts out unwritten
+    table = vmalloc(pages * sizeof(zram_entry_t));
+    pool = zs_create_pool();
+    if (!table || !pool) {
+        kprintf(ERROR, "zram: out of memory for a %d page device\n", pages);
+        if (table) vfree(table);
+        table = NULL;
+        return false;
+    }
+
+    nr_pages = pages;
+    stats.disk_pages = pages;
+    zram_dev.block_count = pages * SECTORS_PER_PAGE;
+    register_block_device(&zram_dev);
+    kprintf(INFO, "zram: %s, %d KB\n", ZRAM_DEVICE, pages * (PAGE_SIZE / 1024));
+    return true;
+}
+
+void zram_get_stats(zram_stats_t *out) {
+    uint32_t flags;
+    spinlock_acquire_irq(&zram_lock, &flags);
+    *out = stats;
+    if (pool) {
+        zs_stats_t zs;
+        zs_get_stats(pool, &zs);
+        out->pool_frames = zs.frames;
+    }
+    out->mem_used_frames = out->pool_frames + out->huge_pages;
+    spinlock_release_irq(&zram_lock, flags);
+}
@@ -0,0 +1,169 @@
+#include "kernel/zsmalloc.h"
+#include "kernel/pmm.h"
+#include "kernel/kheap.h"
+#include "kernel/locks.h"
+#include "kernel/printf.h"
+#include "libc/string.h"
+
+#define ZS_NO_OBJ 0xFFFF
+
+// Header at the start of every zspage, in place of its first slot
+typedef struct zspage {
+    struct zspage *next;        // class list of zspages with free objects
+    struct zspage *prev;
+    uint16_t class_idx;
+    uint16_t order;
+    uint16_t objs;              // objects the zspage holds
+    uint16_t inuse;
+    uint16_t free_head;         // first free object; each free one holds the next index
+} zspage_t;
+
+_Static_assert(sizeof(zspage_t) <= ZS_ALIGN, "zspage header must fit in one slot");
+
+typedef struct {
+    uint32_t size;              // object size of this class
+    uint32_t order;             // zspage order with the least slack
+    zspage_t *partial;          // zspages with at least one free object
+} size_class_t;
+
+struct zs_pool {
+    size_class_t classes[ZS_CLASSES];
+    zs_stats_t stats;
+    spinlock_t lock;
+};
+
+static uint32_t zspage_objs(uint32_t size, uint32_t order) {
+    return ((PAGE_SIZE << order) - ZS_ALIGN) / size;
+}
+
+static uint8_t *obj_addr(zspage_t *zp, size_class_t *c, uint32_t idx) {
+    return (uint8_t *)zp + ZS_ALIGN + idx * c->size;
+}
+
+zs_pool_t *zs_create_pool(void) {
+    zs_pool_t *pool = kmalloc(sizeof(zs_pool_t));
+    if (!pool) return NULL;
+    memset(pool, 0, sizeof(*pool));
+    spinlock_init(&pool->lock);
+
+    for (uint32_t i = 0; i < ZS_CLASSES; i++) {
+        size_class_t *c = &pool->classes[i];
+        c->size = (i + 1) * ZS_ALIGN;
+
+        // Highest fraction of the zspage in use; ties keep the smaller zspage
+        uint32_t best_used = 0, best_bytes = 1;
+        for (uint32_t order = 0; order <= ZS_MAX_ZSPAGE_ORDER; order++) {
+            uint32_t bytes = PAGE_SIZE << order;
+            uint32_t used = zspage_objs(c->size, order) * c->size;
+            if (used * best_bytes > best_used * bytes) {
+                best_used = used;
+                best_bytes = bytes;
+                c->order = order;
+            }
+        }
+    }
+    return pool;
+}
+
+static void list_add(size_class_t *c, zspage_t *zp) {
+    zp->prev = NULL;
+    zp->next = c->partial;
+    if (c->partial) c->partial->prev = zp;
+    c->partial = zp;
+}
+
+static void list_remove(size_class_t *c, zspage_t *zp) {
+    if (zp->prev) zp->prev->next = zp->next;
+    else c->partial = zp->next;
+    if (zp->next) zp->next->prev = zp->prev;
+    zp->next = zp->prev = NULL;
+}
+
+// A new zspage for class c, falling back to shorter ones when memory is fragmented
+static zspage_t *zspage_create(zs_pool_t *pool, uint32_t class_idx) {
+    size_class_t *c = &pool->classes[class_idx];
+    for (int order = c->order; order >= 0; order--) {
+        uint32_t objs = zspage_objs(c->size, order);
+        if (!objs) break;
+        uint32_t frame = order ? pmm_try_alloc_pages(PMM_ZONE_LOW, order) : pmm_alloc_low_pages(0);
+        if (!frame) continue;
+
+        zspage_t *zp = phys_to_virt(frame * PAGE_SIZE);
+        zp->class_idx = class_idx;
+        zp->order = order;
+        zp->objs = objs;
+        zp->inuse = 0;
+        zp->free_head = 0;
+        for (uint32_t i = 0; i < objs; i++) {
+            *(uint16_t *)obj_addr(zp, c, i) = i + 1 < objs ? i + 1 : ZS_NO_OBJ;
+        }
+        list_add(c, zp);
+
+        pool->stats.zspages++;
+        pool->stats.frames += 1u << order;
+        return zp;
+    }
+    return NULL;
+}
+
+zs_handle_t zs_malloc(zs_pool_t *pool, uint32_t size) {
+    if (!size || size > ZS_MAX_SIZE) return 0;
+    uint32_t class_idx = (size - 1) / ZS_ALIGN;
+    size_class_t *c = &pool->classes[class_idx];
+
+    uint32_t flags;
+    spinlock_acquire_irq(&pool->lock, &flags);
+    zspage_t *zp = c->partial ? c->partial : zspage_create(pool, class_idx);
+    if (!zp) {
+        spinlock_release_irq(&pool->lock, flags);
+        return 0;
+    }
+
+    uint8_t *obj = obj_addr(zp, c, zp->free_head);
+    zp->free_head = *(uint16_t *)obj;
+    zp->inuse++;
+    if (zp->free_head == ZS_NO_OBJ) list_remove(c, zp);
+    pool->stats.objects++;
+    spinlock_release_irq(&pool->lock, flags);
+
+    return ((uint32_t)obj - PHYS_MAP_BASE) | zp->order;
+}
+
+void *zs_map(zs_handle_t handle) {
+    return phys_to_virt(handle & ~(ZS_ALIGN - 1));
+}
+
+void zs_free(zs_pool_t *pool, zs_handle_t handle) {
+    uint32_t order = handle & (ZS_ALIGN - 1);
+    uint32_t phys = handle & ~(ZS_ALIGN - 1);
+    if (!handle || order > ZS_MAX_ZSPAGE_ORDER) {
+        kprintf(WARNING, "zs_free: bad handle %x\n", handle);
+        return;
+    }
+
+    // zspages are buddy blocks, so naturally aligned to their size
+    uint32_t base = phys & ~((PAGE_SIZE << order) - 1);
+    zspage_t *zp = phys_to_virt(base);
+    size_class_t *c = &pool->classes[zp->class_idx];
+    uint32_t idx = (phys - base - ZS_ALIGN) / c->size;
+
+    uint32_t flags;
+    spinlock_acquire_irq(&pool->lock, &flags);
+    *(uint16_t *)obj_addr(zp, c, idx) = zp->free_head;
+    if (zp->free_head == ZS_NO_OBJ) list_add(c, zp);
+    zp->free_head = idx;
+    zp->inuse--;
+    pool->stats.objects--;
+
+    if (!zp->inuse) {
+        list_remove(c, zp);
+        pool->stats.zspages--;
+        pool->stats.frames -= 1u << order;
+        pmm_free_pages(base / PAGE_SIZE, order);
+    }
+    spinlock_release_irq(&pool->lock, flags);
+}
+
+void zs_get_stats(zs_pool_t *pool, zs_stats_t *stats) {
+    *stats = pool->stats;
+}
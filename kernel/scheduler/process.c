@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include "kernel/process.h"
 #include "kernel/kheap.h"
+#include "kernel/slab.h"
 #include "kernel/paging.h"
 #include "kernel/printf.h"
 #include "libc/string.h"
@@ -9,6 +10,9 @@
 #include "kernel/signals.h"
 #include "kernel/gdt.h"
 #include "kernel/system.h"
+#include "common/syscall.h"
+#include "kernel/filemap.h"
+#include "kernel/tlb.h"
 
 #define PUSH(stack, type, value) \
     stack -= sizeof(type); \
@@ -29,8 +33,16 @@ extern vfs_file_t* console_fds[3];
 
 process_t *process_list = NULL;
 
+static kmem_cache_t *process_cache = NULL;
+static kmem_cache_t *thread_cache = NULL;
+
 static uint32_t pid_counter = 1;
 static uint32_t tid_counter = 1;
+void process_init() {
+    process_cache = kmem_cache_create("process_t", sizeof(process_t), 0, NULL);
+    thread_cache = kmem_cache_create("thread_t", sizeof(thread_t), 0, NULL);
+}
+
 static uint32_t allocate_pid() {
     return pid_counter++;
 }
@@ -75,10 +87,14 @@ static void * alloc_user_stack(thread_t *thread) {
         thread_count++;
     }
     
-    void *stack_top = (void *)USER_STACK_TOP - thread_count * PROCESS_STACK_SIZE;
-    void *stack_bottom = (void *)(stack_top - PROCESS_STACK_SIZE);
-
-    map_memory(proc->root_page_table, (uint32_t)stack_bottom, -1, PROCESS_STACK_SIZE, 0x7);
+    void *stack_top = (void *)USER_STACK_TOP - thread_count * USER_STACK_SIZE;
+    void *stack_bottom = (void *)(stack_top - USER_STACK_SIZE);
+
+    // The stack grows on demand; the unreserved bottom page catches overflows
+    reserve_memory(proc->root_page_table, (uint32_t)stack_bottom + PAGE_SIZE,
+                   USER_STACK_SIZE - PAGE_SIZE, PAGE_RW | PAGE_USER);
+    vma_map(&proc->vmas, (uint32_t)stack_bottom + PAGE_SIZE, (uint32_t)stack_top,
+            PROT_READ | PROT_WRITE, VMA_STACK);
     thread->user_stack = stack_bottom;
     return stack_top;
 }
@@ -148,18 +164,27 @@ void* sbrk(process_t *proc, int increment) {
     void *new_brk = proc->brk + increment;
 
     if (increment > 0) {
-        // Expand heap by allocating pages
+        if (vma_map(&proc->vmas, (uint32_t)old_brk, PAGE_ALIGN_UP((uint32_t)new_brk),
+                    PROT_READ | PROT_WRITE, VMA_HEAP) != 0) {
+            return (void *)-1;  // something else is mapped there
+        }
+        // Expand heap by reserving demand-zero pages
         while (proc->brk < new_brk) {
-            alloc_page(get_page((uintptr_t)proc->brk, 1, proc->root_page_table), 0x7);
+            reserve_memory(proc->root_page_table, (uint32_t)proc->brk, PAGE_SIZE, PAGE_RW | PAGE_USER);
             proc->brk += PAGE_SIZE;
         }
     } 
     else if (increment < 0) {
         // Shrink heap (optional)
+        tlb_gather_t tlb;
+        tlb_gather_init(&tlb, proc->root_page_table);
         while (proc->brk > new_brk) {
-            free_page(get_page((uintptr_t)proc->brk - PAGE_SIZE, 0, proc->root_page_table));
+            uint32_t va = (uintptr_t)proc->brk - PAGE_SIZE;
+            tlb_unmap_page(&tlb, va, get_page(va, 0, proc->root_page_table));
             proc->brk -= PAGE_SIZE;
         }
+        tlb_finish(&tlb);
+        vma_unmap(&proc->vmas, (uint32_t)proc->brk, (uint32_t)old_brk);
     }
 
     // proc->brk = new_brk;
@@ -167,7 +192,7 @@ void* sbrk(process_t *proc, int increment) {
 }
 
 thread_t* create_thread(process_t *proc, void (*entry_point)(), const char *thread_name) {
-    thread_t *thread = (thread_t *)kmalloc(sizeof(thread_t));
+    thread_t *thread = (thread_t *)kmem_cache_alloc(thread_cache);
     if (!thread) {
         printf("Error: Failed to allocate memory for thread %s\n", thread_name);
         return NULL;
@@ -214,7 +239,7 @@ thread_t* create_thread(process_t *proc, void (*entry_point)(), const char *thre
 }
 
 process_t* create_process(char *process_name, void (*entry_point)(), uint32_t flags) {
-    process_t *proc = (process_t *)kmalloc(sizeof(process_t));
+    process_t *proc = (process_t *)kmem_cache_alloc(process_cache);
     if (!proc) {
         printf("Error: Failed to allocate memory for process %s\n", process_name);
         return NULL;
@@ -226,10 +251,10 @@ process_t* create_process(char *process_name, void (*entry_point)(), uint32_t fl
 
     proc->is_kernel_process = (flags & PROCESS_FLAG_KERNEL) != 0;
     proc->root_page_table = proc->is_kernel_process ? kpage_dir : clone_page_directory(kpage_dir);
-    proc->mmap_base = (void *)MMAP_BASE; 
+    vma_init(&proc->vmas);
     if (!proc->root_page_table) {
         printf("Error: Failed to create page directory for process %s\n", process_name);
-        kfree(proc);
+        kmem_cache_free(process_cache, proc);
         return NULL;
     }
 
@@ -252,7 +277,7 @@ process_t* create_process(char *process_name, void (*entry_point)(), uint32_t fl
     if (!main_thread) {
         printf("Error: Failed to create main thread for process %s\n", process_name);
         free_page_directory(proc->root_page_table);
-        kfree(proc);
+        kmem_cache_free(process_cache, proc);
         return NULL;
     }
 
@@ -276,16 +301,20 @@ void kill_thread(thread_t *thread) {
 
     if (thread->user_stack) {
         uint32_t stack_bottom = (uint32_t)thread->user_stack;
-        uint32_t stack_top = stack_bottom + PROCESS_STACK_SIZE;
+        uint32_t stack_top = stack_bottom + USER_STACK_SIZE;
+        tlb_gather_t tlb;
+        tlb_gather_init(&tlb, thread->owner->root_page_table);
         for (uint32_t addr = stack_bottom; addr < stack_top; addr += PAGE_SIZE) {
-            free_page(get_page(addr, 0, thread->owner->root_page_table));
+            tlb_unmap_page(&tlb, addr, get_page(addr, 0, thread->owner->root_page_table));
         }
+        tlb_finish(&tlb);
+        vma_unmap(&thread->owner->vmas, stack_bottom, stack_top);
     }
 
     if (thread == current_thread) return;
     if (thread->kernel_stack) {
         kfree_aligned((void *)thread->kernel_stack);
-        kfree(thread);
+        kmem_cache_free(thread_cache, thread);
     }
 }
 
@@ -341,9 +370,11 @@ void cleanup_process(process_t *proc) {
 
     // // Free the process stack and process structure
     // // TODO: unmap all pages and heap
+    filemap_sync(proc->root_page_table, &proc->vmas, 0, LOAD_MEMORY_ADDRESS);
     free_page_directory(proc->root_page_table);
+    vma_destroy(&proc->vmas);
     remove_process(proc);
-    kfree(proc);
+    kmem_cache_free(process_cache, proc);
 }
 
 extern void fork_trampoline(void);
@@ -354,7 +385,7 @@ int fork(registers_t *regs) {
     thread_t *parent_thread = parent->main_thread;
 
     // Allocate and initialize child process
-    process_t *child = (process_t *)kmalloc(sizeof(process_t));
+    process_t *child = (process_t *)kmem_cache_alloc(process_cache);
     if (!child) {
         printf("Error: Failed to allocate memory for child process\n");
         return -1;
@@ -366,7 +397,6 @@ int fork(registers_t *regs) {
     child->status = READY;
     child->heap_start = parent->heap_start;
     child->brk = parent->brk;
-    child->mmap_base = parent->mmap_base;
     child->is_kernel_process = parent->is_kernel_process;
     child->pending_signals = 0;
     child->signal_mask = 0;
@@ -379,7 +409,13 @@ int fork(registers_t *regs) {
     child->root_page_table = clone_page_directory(parent->root_page_table);
     if (!child->root_page_table) {
         kprintf(ERROR, "fork: failed to clone page directory\n");
-        kfree(child);
+        kmem_cache_free(process_cache, child);
+        return -1;
+    }
+    if (vma_copy(&child->vmas, &parent->vmas) != 0) {
+        kprintf(ERROR, "fork: failed to copy memory areas\n");
+        free_page_directory(child->root_page_table);
+        kmem_cache_free(process_cache, child);
         return -1;
     }
 
@@ -397,11 +433,12 @@ int fork(registers_t *regs) {
     add_process(child);
 
     // Step 9: Allocate child thread
-    thread_t *child_thread = (thread_t *)kmalloc(sizeof(thread_t));
+    thread_t *child_thread = (thread_t *)kmem_cache_alloc(thread_cache);
     if (!child_thread) {
         kprintf(ERROR, "fork: failed to allocate child thread\n");
         free_page_directory(child->root_page_table);
-        kfree(child);
+        vma_destroy(&child->vmas);
+        kmem_cache_free(process_cache, child);
         return -1;
     }
 
@@ -420,9 +457,10 @@ int fork(registers_t *regs) {
     void *child_kernel_stack = alloc_kernel_stack(child_thread);
     if (!child_kernel_stack) {
         kprintf(ERROR, "fork: failed to allocate kernel stack for child thread\n");
-        kfree(child_thread);
+        kmem_cache_free(thread_cache, child_thread);
         free_page_directory(child->root_page_table);
-        kfree(child);
+        vma_destroy(&child->vmas);
+        kmem_cache_free(process_cache, child);
         return -1;
     }
 
@@ -558,7 +596,7 @@ static uint32_t build_user_stack(page_directory_t *dir, char **argv, int argc, c
     u_esp -= 4;
     copy_to_user(dir, u_esp, &argc, 4);
 
-    if (u_esp < (uint32_t)(USER_STACK_TOP - PROCESS_STACK_SIZE)) {
+    if (u_esp < (uint32_t)(USER_STACK_TOP - USER_STACK_SIZE + PAGE_SIZE)) {
         kprintf(ERROR, "build_user_stack: overflow\n");
         return 0;
     }
@@ -628,10 +666,15 @@ int exec(const char *path, char **argv, char **envp) {
     proc->signal_mask = 0;
     memset(proc->signal_handlers, 0, sizeof(proc->signal_handlers));
 
+    filemap_sync(proc->root_page_table, &proc->vmas, 0, LOAD_MEMORY_ADDRESS);
     free_page_directory(proc->root_page_table);
     proc->root_page_table   = new_page_dir;
     new_page_dir = NULL;
 
+    // The old heap, stacks and mappings went with the old directory
+    vma_destroy(&proc->vmas);
+    proc->brk = proc->heap_start;
+
     map_signal_trampoline(proc);
 
     // ── 6. Create new main thread (maps user stack too) ───────────────────────
@@ -672,7 +715,7 @@ int exec(const char *path, char **argv, char **envp) {
     switch_page_directory(proc->root_page_table);
 
     // Free old thread and kernel stack — last thing before iret
-    kfree(old_thread);
+    kmem_cache_free(thread_cache, old_thread);
     kfree_aligned(old_stack);
     switch_context(thread);   // iret — never returns
     return -1;
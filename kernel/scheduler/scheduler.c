@@ -2,6 +2,7 @@
 #include "kernel/isr.h"
 #include "kernel/gdt.h"
 #include "kernel/paging.h"
+#include "kernel/zeropage.h"
 #include "kernel/printf.h"
 #include "drivers/pit.h"
 
@@ -9,6 +10,7 @@
 
 extern void switch_task(uintptr_t* prev, uintptr_t next);
 extern struct tss_entry tss_entry;
+extern page_directory_t *kpage_dir;
 
 thread_t *thread_list = NULL;
 thread_t *current_thread = NULL;
@@ -23,6 +25,7 @@ void idle_process() {
 }
 
 void scheduler_init() {
+    process_init();
     pit_init(100);
 }
 
@@ -40,9 +43,12 @@ void schedule(registers_t* context) {
         current_thread = next_thread;
         current_thread->status = RUNNING;
 
-        // Restore context and switch page directory
-        if (prev_thread->owner->root_page_table != next_thread->owner->root_page_table) {
-            switch_page_directory(next_thread->owner->root_page_table);
+        // Restore context and switch page directory.  Kernel-only threads run on
+        // kpage_dir, whose mappings every directory shares: they borrow whatever
+        // is loaded instead of paying for a CR3 write (lazy TLB)
+        page_directory_t *next_dir = next_thread->owner->root_page_table;
+        if (next_dir != kpage_dir && next_dir != get_active_page_directory()) {
+            switch_page_directory(next_dir);
         }
 
         tss_entry.esp0 = (uint32_t)current_thread->kernel_stack + PROCESS_STACK_SIZE;
@@ -53,10 +59,31 @@ void schedule(registers_t* context) {
         // pick_next_thread() returned NULL, meaning every thread is WAITING or TERMINATED.
         // In this case, we can halt the cpu and wait for the next timer interrupt to wake us up. 
         // This can happen if all threads are waiting for some event (e.g. I/O) to complete.
+        // Use the idle time to pre-zero frames for upcoming page faults first.
+        zero_pool_refill();
         asm volatile ("sti; hlt");
     }
 }
 
+// Block the current (kernel) thread for 'ticks' timer ticks, or until
+// thread_wake_sleeper.  schedule() comes straight back when nothing else
+// can run, so go round again until the time is up.
+void thread_sleep(uint32_t ticks) {
+    thread_t *self = current_thread;
+    self->wakeup_tick = pit_get_ticks() + ticks;
+    do {
+        self->status = SLEEPING;
+        schedule(NULL);
+    } while (self->status == SLEEPING && pit_get_ticks() < self->wakeup_tick);
+    self->status = RUNNING;
+}
+
+// Cut a thread_sleep short; the thread runs at its next turn.  Safe with
+// interrupts off.
+void thread_wake_sleeper(thread_t *thread) {
+    if (thread && thread->status == SLEEPING) thread->wakeup_tick = 0;
+}
+
 __attribute__((naked))
 static void jmp_to_kernel_thread_context(thread_t *thread) {
     __asm__ volatile (
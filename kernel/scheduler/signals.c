@@ -44,7 +44,11 @@ void map_signal_trampoline(process_t *proc) {
     if (existing && existing->present) {
         existing->present = 0;
         existing->frame = 0;
-        invalidate_page(SIGRETURN_TRAMPOLINE_ADDR);
+        // Usually called for a directory that is not loaded yet (exec),
+        // which has no TLB entry to drop
+        if (proc->root_page_table == get_active_page_directory()) {
+            invalidate_page(SIGRETURN_TRAMPOLINE_ADDR);
+        }
     }
 
     map_memory(proc->root_page_table, SIGRETURN_TRAMPOLINE_ADDR, phys, PAGE_SIZE, PAGE_USER | PAGE_RW);
@@ -1,5 +1,17 @@
 #include "kernel/tests.h"
 #include "kernel/kheap.h"
+#include "kernel/slab.h"
+#include "kernel/pmm.h"
+#include "kernel/pgtable.h"
+#include "kernel/vmalloc.h"
+#include "kernel/tlb.h"
+#include "kernel/swap.h"
+#include "kernel/zram.h"
+#include "kernel/ksm.h"
+#include "kernel/shrinker.h"
+#include "kernel/framebuffer.h"
+#include "kernel/paging.h"
+#include "kernel/uaccess.h"
 #include "kernel/process.h"
 #include "kernel/locks.h"
 #include "kernel/printf.h"
@@ -10,6 +22,8 @@
 #include "common/syscall.h"
 #include <stdarg.h>
 
+extern page_directory_t *kpage_dir;
+
 void test_divide_by_zero() {
 	int x = 1;
 	int y = 0;
@@ -38,6 +52,561 @@ void test_heap() {
 	print_kheap();
 }
 
+#define HEAP_STRESS_SLOTS 512
+#define HEAP_STRESS_ROUNDS 200000
+
+// Fragment the heap with a long random alloc/free mix, then report kmalloc latency
+void test_heap_stress() {
+	static void *slots[HEAP_STRESS_SLOTS];
+	uint32_t seed = 12345;
+	uint32_t worst = 0;
+	uint32_t total = 0;
+	uint32_t allocs = 0;
+	size_t used_before = kheap_used();
+
+	memset(slots, 0, sizeof(slots));
+	for (uint32_t round = 0; round < HEAP_STRESS_ROUNDS; round++) {
+		seed = seed * 1103515245 + 12345;
+		uint32_t i = (seed >> 16) % HEAP_STRESS_SLOTS;
+		if (slots[i]) {
+			kfree(slots[i]);
+			slots[i] = NULL;
+			continue;
+		}
+
+		// Mostly small objects with the occasional large buffer
+		size_t size = (seed & 0x7) ? (seed >> 8) % 256 + 1 : (seed >> 8) % 16384 + 1;
+		uint64_t start = rdtsc();
+		slots[i] = kmalloc(size);
+		uint32_t cycles = (uint32_t)(rdtsc() - start);
+
+		if (!slots[i]) {
+			printf("heap stress: allocation of %d bytes failed at round %d\n", size, round);
+			break;
+		}
+		total += cycles;
+		allocs++;
+		if (cycles > worst) worst = cycles;
+	}
+
+	for (uint32_t i = 0; i < HEAP_STRESS_SLOTS; i++) {
+		kfree(slots[i]);
+	}
+
+	printf("heap stress: %d allocs, avg %d cycles, worst %d cycles\n",
+		allocs, allocs ? total / allocs : 0, worst);
+	printf("heap stress: used before %x, after %x (should match)\n", used_before, kheap_used());
+}
+
+void test_slab() {
+	kmem_cache_t *cache = kmem_cache_create("test_obj", 48, 0, NULL);
+	void *objs[64];
+
+	for (int i = 0; i < 64; i++) {
+		objs[i] = kmem_cache_alloc(cache);
+	}
+	printf("First two objects: %x %x (should be 48 bytes apart)\n", objs[0], objs[1]);
+
+	kmem_cache_free(cache, objs[10]);
+	void *reused = kmem_cache_alloc(cache);
+	printf("Reallocated: %x (should reuse %x)\n", reused, objs[10]);
+	objs[10] = reused;
+
+	print_slab_info();
+	for (int i = 0; i < 64; i++) {
+		kmem_cache_free(cache, objs[i]);
+	}
+	kmem_cache_shrink(cache);
+	kmem_cache_destroy(cache);
+}
+
+void test_buddy() {
+	uint32_t free_before = pmm_get_free_blocks();
+
+	uint32_t a = pmm_alloc_pages(4);
+	uint32_t b = pmm_alloc_pages(4);
+	uint32_t c = pmm_alloc_pages(0);
+	printf("order 4 blocks: %x %x (should be 16-frame aligned)\n", a, b);
+	printf("order 0 block: %x, free frames %d -> %d\n", c, free_before, pmm_get_free_blocks());
+
+	pmm_free_pages(a, 4);
+	pmm_free_pages(b, 4);
+	pmm_free_block(c);
+
+	// The freed buddies should have merged back into the same higher-order block
+	uint32_t d = pmm_alloc_pages(4);
+	printf("Reallocated order 4: %x (should reuse %x or %x)\n", d, a, b);
+	pmm_free_pages(d, 4);
+	printf("Free frames after: %d (should be %d)\n", pmm_get_free_blocks(), free_before);
+}
+
+void test_pmm_zones() {
+	uint32_t total = pmm_get_total_blocks();
+	uint32_t free_before = pmm_get_free_blocks();
+	printf("PMM manages %d frames (%d MB)\n", total, total / PMM_BLOCKS_PER_MB);
+
+	// Low allocations must always be reachable through the direct map
+	uint32_t low = pmm_alloc_low_pages(2);
+	uint32_t any = pmm_alloc_pages(2);
+	printf("low block %x mapped at %x, general block %x\n",
+		low, (uint32_t)phys_to_virt(low * PAGE_SIZE), any);
+	printf("low block direct mapped: %s\n", low && phys_to_virt(low * PAGE_SIZE) ? "ok" : "FAILED");
+
+	// With PAE and more than 4GB of RAM this comes from above 4GB
+	uint32_t high = pmm_alloc_highmem_block();
+	printf("highmem frame %x (%s 4GB)\n", high, high >= PMM_FRAMES_32BIT ? "above" : "below");
+
+	pmm_free_pages(low, 2);
+	pmm_free_pages(any, 2);
+	pmm_free_block(high);
+	printf("Free frames after: %d (should be %d)\n", pmm_get_free_blocks(), free_before);
+}
+
+void test_pgtable() {
+	pgtable_stats_t stats;
+	uint32_t free_before = pmm_get_free_blocks();
+
+	page_table_t *table = pgtable_alloc_table();
+	page_directory_t *dir = pgtable_alloc_dir();
+	printf("table %x dir %x, frames used: %d (should be 3 unless pooled)\n",
+		table, dir, free_before - pmm_get_free_blocks());
+
+	pgtable_free_table(table);
+	pgtable_free_dir(dir);
+	page_table_t *again = pgtable_alloc_table();
+	printf("Reallocated table: %x (should reuse %x)\n", again, table);
+	pgtable_free_table(again);
+
+	pgtable_get_stats(&stats);
+	printf("in use: %d tables %d dirs, pooled: %d tables %d dirs, %d frames mapped\n",
+		stats.tables_in_use, stats.dirs_in_use, stats.pooled_tables,
+		stats.pooled_dirs, stats.frames_mapped);
+}
+
+#define UACCESS_BENCH_VADDR 0x10000000
+#define UACCESS_BENCH_ROUNDS 1000
+
+// Cycle cost of the user-copy helpers against a scratch address space
+void test_uaccess_bench() {
+	static uint8_t buf[PAGE_SIZE];
+	page_directory_t *dir = clone_page_directory(kpage_dir);
+	if (!dir) return;
+	map_memory(dir, UACCESS_BENCH_VADDR, -1, 4 * PAGE_SIZE, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+	// Run against the live directory, like a syscall would
+	switch_page_directory(dir);
+
+	// A 128-byte argv-style string for strncpy_from_user
+	memset(buf, 'a', 127);
+	buf[127] = '\0';
+
+	uint64_t start = rdtsc();
+	for (int i = 0; i < UACCESS_BENCH_ROUNDS; i++) {
+		copy_to_user(dir, UACCESS_BENCH_VADDR, buf, PAGE_SIZE);
+	}
+	uint32_t to_user = (uint32_t)(rdtsc() - start) / UACCESS_BENCH_ROUNDS;
+
+	start = rdtsc();
+	for (int i = 0; i < UACCESS_BENCH_ROUNDS; i++) {
+		copy_from_user(dir, buf, UACCESS_BENCH_VADDR, PAGE_SIZE);
+	}
+	uint32_t from_user = (uint32_t)(rdtsc() - start) / UACCESS_BENCH_ROUNDS;
+
+	char str[256];
+	start = rdtsc();
+	for (int i = 0; i < UACCESS_BENCH_ROUNDS; i++) {
+		strncpy_from_user(dir, str, UACCESS_BENCH_VADDR, sizeof(str));
+	}
+	uint32_t str_user = (uint32_t)(rdtsc() - start) / UACCESS_BENCH_ROUNDS;
+
+	printf("uaccess: copy_to_user 4K %d cycles, copy_from_user 4K %d cycles, strncpy_from_user 128B %d cycles\n",
+		to_user, from_user, str_user);
+
+	// Accesses past the mapping must come back through the fixup table
+	uint32_t val = 1;
+	int get_err = __get_user(val, (uint32_t *)(UACCESS_BENCH_VADDR + 4 * PAGE_SIZE));
+	int copy_err = __copy_to_user((void *)(UACCESS_BENCH_VADDR + 3 * PAGE_SIZE + 8), buf, PAGE_SIZE);
+	printf("uaccess: unmapped get_user %d (val %d), straddling copy %d (should be -14)\n",
+		get_err, val, copy_err);
+
+	switch_page_directory(kpage_dir);
+	free_page_directory(dir);
+}
+
+#define TLB_BENCH_PAGES 64
+#define TLB_BENCH_ROUNDS 1000
+
+// Cycles for a CR3 reload followed by one read from each of 'pages' kernel pages
+static uint32_t tlb_round_cycles(volatile uint8_t *base) {
+	uint32_t cr3;
+	get_cr3(&cr3);
+
+	uint64_t start = rdtsc();
+	for (int r = 0; r < TLB_BENCH_ROUNDS; r++) {
+		asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+		for (int p = 0; p < TLB_BENCH_PAGES; p++) {
+			(void)base[p * PAGE_SIZE];
+		}
+	}
+	return (uint32_t)(rdtsc() - start) / TLB_BENCH_ROUNDS;
+}
+
+// Cost of an address-space switch for kernel code, with and without global pages
+void test_tlb_bench() {
+	uint8_t *buf = kmalloc(TLB_BENCH_PAGES * PAGE_SIZE);
+	if (!buf) return;
+
+	uint32_t cr4 = read_cr4();
+	write_cr4(cr4 & ~CR4_PGE);	// clearing PGE also drops every global entry
+	uint32_t local = tlb_round_cycles(buf);
+	write_cr4(cr4);
+	uint32_t global = tlb_round_cycles(buf);
+
+	printf("tlb: CR3 reload + %d kernel page reads: %d cycles without PGE, %d with%s\n",
+		TLB_BENCH_PAGES, local, global, (cr4 & CR4_PGE) ? "" : " (PGE unsupported)");
+	kfree(buf);
+}
+
+// Small unmaps invalidate page by page, large ones flush once; frames come back
+void test_tlb_gather() {
+	tlb_stats_t before, mid, after;
+	uint32_t free_before = pmm_get_free_blocks();
+
+	tlb_get_stats(&before);
+	void *small = vmalloc(4 * PAGE_SIZE);
+	vfree(small);
+	tlb_get_stats(&mid);
+	void *large = vmalloc(4 * 0x100000);
+	uint64_t start = rdtsc();
+	vfree(large);
+	uint32_t cycles = (uint32_t)(rdtsc() - start);
+	tlb_get_stats(&after);
+
+	bool ok = small && large && mid.page_flushes - before.page_flushes == 4 &&
+		mid.full_flushes == before.full_flushes && after.full_flushes > mid.full_flushes;
+	printf("tlb gather: 4-page vfree %d invlpg, 4MB vfree %d full flushes in %d cycles, %d frames leaked, %s\n",
+		mid.page_flushes - before.page_flushes, after.full_flushes - mid.full_flushes, cycles,
+		free_before - pmm_get_free_blocks(), ok ? "ok" : "FAILED");
+}
+
+// How much of the kernel half is mapped with 4MB pages, and that lookups still agree
+void test_large_pages() {
+	uint32_t large = 0, tables = 0;
+	for (uint32_t i = KERNEL_PDE_START; i < PDE_ENTRIES; i++) {
+		if (!kpage_dir->tables[i].present) continue;
+		if (kpage_dir->tables[i].page_size) large++;
+		else tables++;
+	}
+
+	// The heap (4MB pages) and the direct map must reach the same frame
+	uint32_t *buf = kmalloc(64);
+	bool ok = false;
+	if (buf) {
+		*buf = 0x5A5AA5A5;
+		uint32_t *alias = phys_to_virt((uint32_t)virtual2physical(kpage_dir, buf));
+		ok = alias && *alias == 0x5A5AA5A5;
+	}
+	printf("large pages: %d 4MB PDEs (%d KB of page tables saved), %d page tables, heap lookup %s\n",
+		large, large * 4, tables, ok ? "ok" : "MISMATCH");
+	kfree(buf);
+}
+
+// A request larger than anything free must map more heap instead of failing
+void test_kheap_grow() {
+	size_t before = kheap_size();
+	size_t big = before + KHEAP_GROW_SIZE;
+	uint8_t *buf = kmalloc(big);
+	if (!buf) {
+		printf("kheap grow: kmalloc(%x) failed with %x mapped\n", big, before);
+		return;
+	}
+	buf[0] = 0xA5;
+	buf[big - 1] = 0x5A;
+	bool ok = buf[0] == 0xA5 && buf[big - 1] == 0x5A && kheap_size() > before;
+	printf("kheap grow: %x -> %x bytes mapped, %s\n", before, kheap_size(), ok ? "ok" : "FAILED");
+	kfree(buf);
+}
+
+// Multi-megabyte buffers come from the vmalloc window and leave the heap alone
+void test_vmalloc() {
+	size_t heap_before = kheap_used();
+	uint32_t size = 8 * 0x100000;
+	uint8_t *a = vmalloc(size);
+	uint8_t *b = vmalloc(PAGE_SIZE);
+	if (!a || !b) {
+		printf("vmalloc: allocation failed\n");
+		vfree(a);
+		vfree(b);
+		return;
+	}
+
+	bool zeroed = a[0] == 0 && a[size / 2] == 0 && a[size - 1] == 0;
+	a[size - 1] = 0x77;
+	vmalloc_stats_t st;
+	vmalloc_get_stats(&st);
+	// b must sit past a's guard page
+	bool guarded = (uint32_t)b >= (uint32_t)a + size + PAGE_SIZE || (uint32_t)b + 2 * PAGE_SIZE <= (uint32_t)a;
+	printf("vmalloc: %d areas, %d pages, zeroed %s, guard %s, heap grew %x bytes\n",
+		st.areas, st.pages_mapped, zeroed ? "ok" : "FAILED", guarded ? "ok" : "FAILED",
+		kheap_used() - heap_before);
+
+	vfree(a);
+	vfree(b);
+	vmalloc_get_stats(&st);
+	printf("vmalloc: after vfree %d areas, %d pages\n", st.areas, st.pages_mapped);
+}
+
+// The framebuffer is mapped write-combining and a full-frame copy is timed
+void test_fb_wc() {
+	framebuffer_t *fb = get_framebuffer();
+	if (!fb || !fb->addr) {
+		printf("fb wc: no framebuffer\n");
+		return;
+	}
+
+	uint32_t pat_wc = pat_supported() && ((rdmsr(MSR_IA32_PAT) >> 8) & 0xFF) == 0x01;
+	page_directory_entry_t *pde = &kpage_dir->tables[PDE_INDEX(fb->addr)];
+	page_table_entry_t *pte = pde->page_size ? NULL : get_page(fb->addr, 0, kpage_dir);
+	uint32_t pwt = pde->page_size ? pde->write_through : (pte && pte->write_through);
+
+	uint32_t size = fb->pitch * fb->height;
+	uint32_t *src = vmalloc(size);
+	if (!src) {
+		printf("fb wc: no buffer for the copy\n");
+		return;
+	}
+	memcpy(src, (void *)fb->addr, size);	// keep what is on screen
+	uint64_t start = rdtsc();
+	uint32_t *dst = (uint32_t *)fb->addr;
+	for (uint32_t i = 0; i < size / 4; i++) dst[i] = src[i];
+	uint32_t cycles = (uint32_t)(rdtsc() - start);
+	vfree(src);
+
+	printf("fb wc: PAT %s, mapping %s, full-frame store %d cycles (%d KB)\n",
+		pat_wc ? "WC" : "unavailable", pwt ? "WC" : "default", cycles, size / 1024);
+}
+
+#define SWAP_TEST_VADDR 0x10000000
+
+// A page written out comes back intact, and a fork shares its slot until both let go
+void test_swap() {
+	if (!swap_enabled()) {
+		printf("swap: no swap device\n");
+		return;
+	}
+	swap_stats_t before, st;
+	swap_get_stats(&before);
+
+	page_directory_t *dir = clone_page_directory(kpage_dir);
+	if (!dir) return;
+	uint32_t pattern[4] = { 0xDEADBEEF, 0x12345678, 0xCAFEBABE, 0x0BADF00D };
+	reserve_memory(dir, SWAP_TEST_VADDR, PAGE_SIZE, PAGE_RW | PAGE_USER);
+	copy_to_user(dir, SWAP_TEST_VADDR + 100, pattern, sizeof(pattern));
+
+	int out = swap_out(dir, SWAP_TEST_VADDR);
+	page_table_entry_t *page = get_page(SWAP_TEST_VADDR, 0, dir);
+	bool entry = page && pte_is_swap(page);
+
+	// The child inherits the swap entry; each side reads its own copy back
+	page_directory_t *child = clone_page_directory(dir);
+	uint32_t got[4] = { 0 }, child_got[4] = { 0 };
+	copy_from_user(dir, got, SWAP_TEST_VADDR + 100, sizeof(got));
+	if (child) copy_from_user(child, child_got, SWAP_TEST_VADDR + 100, sizeof(child_got));
+	bool ok = memcmp(got, pattern, sizeof(got)) == 0 && memcmp(child_got, pattern, sizeof(child_got)) == 0;
+
+	swap_get_stats(&st);
+	printf("swap: swap_out %d, swap entry %s, data %s, %d out %d in\n",
+		out, entry ? "yes" : "no", ok ? "ok" : "CORRUPT",
+		st.swapped_out - before.swapped_out, st.swapped_in - before.swapped_in);
+
+	if (child) free_page_directory(child);
+	free_page_directory(dir);
+	swap_get_stats(&st);
+	printf("swap: %d of %d slots used after teardown (should be %d)\n", st.used, st.slots, before.used);
+}
+
+// A parent page left COW by a fork whose child has exited, then swapped
+// out, must come back and take the store instead of killing the writer
+void test_swap_cow() {
+	if (!swap_enabled()) {
+		printf("swap cow: no swap device\n");
+		return;
+	}
+	page_directory_t *dir = clone_page_directory(kpage_dir);
+	if (!dir) return;
+	uint32_t word = 0xDEADBEEF;
+	reserve_memory(dir, SWAP_TEST_VADDR, PAGE_SIZE, PAGE_RW | PAGE_USER);
+	copy_to_user(dir, SWAP_TEST_VADDR, &word, sizeof(word));
+
+	page_directory_t *child = clone_page_directory(dir);
+	if (child) free_page_directory(child);
+	page_table_entry_t *page = get_page(SWAP_TEST_VADDR, 0, dir);
+	bool cow = page && page->cow && !page->rw;
+	int out = swap_out(dir, SWAP_TEST_VADDR);
+
+	// Store through the live directory, like a syscall's put_user would
+	switch_page_directory(dir);
+	word = 0x12345678;
+	int err = __copy_to_user((void *)SWAP_TEST_VADDR, &word, sizeof(word));
+	uint32_t got = 0;
+	__copy_from_user(&got, (const void *)SWAP_TEST_VADDR, sizeof(got));
+	switch_page_directory(kpage_dir);
+
+	printf("swap cow: cow %s, swap_out %d, write %d, read %x (should be 12345678)\n",
+		cow ? "yes" : "no", out, err, got);
+	free_page_directory(dir);
+}
+
+#define ZRAM_TEST_PAGES 12
+
+// Swap out solid-colour, text-like and random pages and see what they cost in zram
+void test_zram() {
+	zram_stats_t before, st;
+	zram_get_stats(&before);
+	if (!before.disk_pages || !swap_enabled()) {
+		printf("zram: not in use\n");
+		return;
+	}
+
+	page_directory_t *dir = clone_page_directory(kpage_dir);
+	if (!dir) return;
+	reserve_memory(dir, SWAP_TEST_VADDR, ZRAM_TEST_PAGES * PAGE_SIZE, PAGE_RW | PAGE_USER);
+
+	static uint32_t page[PAGE_SIZE / 4];
+	uint32_t seed = 12345;
+	for (uint32_t p = 0; p < ZRAM_TEST_PAGES; p++) {
+		for (uint32_t i = 0; i < PAGE_SIZE / 4; i++) {
+			if (p % 3 == 0) page[i] = 0xFF336699;				// solid colour
+			else if (p % 3 == 1) page[i] = 0x20202020 + (i % 40) * 0x01010101;	// repetitive text
+			else page[i] = seed = seed * 1103515245 + 12345;		// noise
+		}
+		copy_to_user(dir, SWAP_TEST_VADDR + p * PAGE_SIZE, page, PAGE_SIZE);
+	}
+
+	uint32_t out = 0;
+	for (uint32_t p = 0; p < ZRAM_TEST_PAGES; p++) {
+		if (swap_out(dir, SWAP_TEST_VADDR + p * PAGE_SIZE) == 0) out++;
+	}
+	zram_get_stats(&st);
+	uint32_t stored = st.pages_stored - before.pages_stored;
+	uint32_t frames = st.mem_used_frames - before.mem_used_frames;
+	printf("zram: %d of %d pages out, %d same, %d huge, %d compressed bytes, %d frames used (ratio %d.%d)\n",
+		out, ZRAM_TEST_PAGES, st.same_pages - before.same_pages, st.huge_pages - before.huge_pages,
+		st.compr_bytes - before.compr_bytes, frames,
+		frames ? stored / frames : stored, frames ? (stored * 10 / frames) % 10 : 0);
+
+	// Read back the first of each kind
+	bool ok = true;
+	seed = 12345;
+	for (uint32_t p = 0; p < 3; p++) {
+		copy_from_user(dir, page, SWAP_TEST_VADDR + p * PAGE_SIZE, PAGE_SIZE);
+		uint32_t expect = p == 0 ? 0xFF336699 : p == 1 ? 0x20202020 : (seed = seed * 1103515245 + 12345);
+		if (page[0] != expect) ok = false;
+	}
+	free_page_directory(dir);
+	zram_get_stats(&st);
+	printf("zram: data %s, %d pages stored after teardown (should be %d)\n",
+		ok ? "ok" : "CORRUPT", st.pages_stored, before.pages_stored);
+}
+
+#define KSM_TEST_VADDR 0x10000000
+#define KSM_TEST_PAGES 8
+
+// Four copies of one page, two of another, a zeroed page and a unique one
+void test_ksm() {
+	ksm_stats_t before, st;
+	ksm_get_stats(&before);
+
+	page_directory_t *dir = clone_page_directory(kpage_dir);
+	if (!dir) return;
+	reserve_memory(dir, KSM_TEST_VADDR, KSM_TEST_PAGES * PAGE_SIZE, PAGE_RW | PAGE_USER);
+
+	static uint32_t page[PAGE_SIZE / 4];
+	for (uint32_t p = 0; p < KSM_TEST_PAGES; p++) {
+		for (uint32_t i = 0; i < PAGE_SIZE / 4; i++) {
+			if (p < 4) page[i] = 0xFF336699;			// solid colour
+			else if (p < 6) page[i] = i * 0x01010101;		// a data segment
+			else if (p == 6) page[i] = 0;				// a touched, zeroed heap page
+			else page[i] = i ^ 0xA5A5A5A5;				// unique
+		}
+		copy_to_user(dir, KSM_TEST_VADDR + p * PAGE_SIZE, page, PAGE_SIZE);
+	}
+
+	uint32_t freed = ksm_merge_range(dir, KSM_TEST_VADDR, KSM_TEST_VADDR + KSM_TEST_PAGES * PAGE_SIZE);
+	page_table_entry_t *first = get_page(KSM_TEST_VADDR, 0, dir);
+	page_table_entry_t *copy = get_page(KSM_TEST_VADDR + 3 * PAGE_SIZE, 0, dir);
+	bool shared = first && copy && first->frame == copy->frame && !copy->rw && copy->cow;
+	ksm_get_stats(&st);
+	printf("ksm: %d frames freed (should be 5), copies %s, %d shared %d sharing %d zero\n",
+		freed, shared ? "share a frame" : "NOT MERGED", st.pages_shared - before.pages_shared,
+		st.pages_sharing - before.pages_sharing, st.zero_merges - before.zero_merges);
+
+	// A write breaks the share for that page alone
+	uint32_t word = 0x12345678, got = 0, other = 0;
+	copy_to_user(dir, KSM_TEST_VADDR + 2 * PAGE_SIZE, &word, sizeof(word));
+	copy_from_user(dir, &got, KSM_TEST_VADDR + 2 * PAGE_SIZE, sizeof(got));
+	copy_from_user(dir, &other, KSM_TEST_VADDR + 3 * PAGE_SIZE, sizeof(other));
+	printf("ksm: after a write %x and %x (should be 12345678 and ff336699)\n", got, other);
+
+	free_page_directory(dir);
+	ksm_get_stats(&st);
+	printf("ksm: %d pages shared after teardown (should be %d)\n", st.pages_shared, before.pages_shared);
+}
+
+#define RECLAIM_TEST_FRAMES 8
+
+static uint32_t reclaim_test_frames[RECLAIM_TEST_FRAMES];
+static uint32_t reclaim_test_held;
+
+static uint32_t reclaim_test_scan(uint32_t frames) {
+	uint32_t freed = 0;
+	while (reclaim_test_held && freed < frames) {
+		pmm_free_block(reclaim_test_frames[--reclaim_test_held]);
+		freed++;
+	}
+	return freed;
+}
+
+static shrinker_t reclaim_test_shrinker = {
+	.name = "test",
+	.scan = reclaim_test_scan,
+	.cost = SHRINK_COST_FREE,
+};
+
+void test_reclaim() {
+	uint32_t low, high;
+	pmm_get_watermarks(&low, &high);
+	printf("reclaim: watermarks %d/%d, %d frames free\n", low, high, pmm_get_free_blocks());
+
+	// Grow the heap past its boot mapping, free it, and trim it back
+	size_t size = kheap_size();
+	void *big = kmalloc(KHEAP_GROW_SIZE * 2);
+	size_t grown = kheap_size();
+	kfree(big);
+	uint32_t trimmed = kheap_trim(0xFFFFFFFF);
+	printf("reclaim: heap %dKB -> %dKB -> %dKB, %d frames trimmed\n",
+		size / 1024, grown / 1024, kheap_size() / 1024, trimmed);
+
+	// A cache of frames that only background reclaim may shrink
+	for (reclaim_test_held = 0; reclaim_test_held < RECLAIM_TEST_FRAMES; reclaim_test_held++) {
+		if (!(reclaim_test_frames[reclaim_test_held] = pmm_alloc_block())) break;
+	}
+	uint32_t held = reclaim_test_held;
+	register_shrinker(&reclaim_test_shrinker);
+	shrink_memory(1, true);
+	bool skipped = reclaim_test_held == held;
+	// Cheaper caches registered earlier go first
+	for (uint32_t i = 0; i < 32 && reclaim_test_held; i++) shrink_memory(RECLAIM_TEST_FRAMES, false);
+	unregister_shrinker(&reclaim_test_shrinker);
+	printf("reclaim: direct reclaim %s the test shrinker, which gave back %d of %d frames\n",
+		skipped ? "skipped" : "DID NOT SKIP", reclaim_test_shrinker.freed, held);
+	while (reclaim_test_held) pmm_free_block(reclaim_test_frames[--reclaim_test_held]);
+
+	reclaim_stats_t st;
+	reclaim_get_stats(&st);
+	printf("reclaim: kreclaimd woke %d times for %d frames, %d direct rounds for %d frames\n",
+		st.wakeups, st.reclaimed, st.direct, st.direct_reclaimed);
+}
+
 void test_printf() {
 	printf("Hello, %s!\n", "world");
 	printf("Number: %d\n", -42);
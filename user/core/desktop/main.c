@@ -27,9 +27,10 @@ int main(void) {
     fb_stride = fb_pitch / 4;
     printf("[compositor] FB: %dx%d pitch=%d\n", fb_width, fb_height, fb_pitch);
 
-    /* ---- Allocate backbuffer ---- */
+    /* ---- Allocate backbuffer (4MB pages: it is walked every frame) ---- */
     uint32_t bb_bytes = fb_width * fb_height * 4;
-    backbuffer = (uint32_t *)syscall_sbrk((int)bb_bytes);
+    backbuffer = (uint32_t *)syscall_mmap(NULL, bb_bytes, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
     printf("[compositor] backbuffer=%x bytes=%u\n", (uint32_t)backbuffer, bb_bytes);
     if (!backbuffer || (uintptr_t)backbuffer == (uintptr_t)-1) {
         printf("[compositor] ERROR: backbuffer alloc failed\n");
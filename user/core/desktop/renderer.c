@@ -38,11 +38,15 @@ static void blit_to_fb(int x, int y, int w, int h) {
     if ((uint32_t)(y + h) > fb_height) h = (int)fb_height - y;
     if (w <= 0 || h <= 0) return;
 
+    // One string move per row: sequential dword stores fill whole
+    // write-combining buffers before they go out to the framebuffer
     for (int row = 0; row < h; row++) {
         uint32_t *bb_row = backbuffer  + (y + row) * fb_width  + x;
         uint32_t *fb_row = framebuffer + (y + row) * fb_stride + x;
-        for (int col = 0; col < w; col++)
-            fb_row[col] = bb_row[col];
+        uint32_t count = (uint32_t)w;
+        asm volatile("rep movsl"
+                     : "+D"(fb_row), "+S"(bb_row), "+c"(count)
+                     :: "memory");
     }
 }
 
@@ -138,29 +138,22 @@ static void editor_load_file(const char *path) {
         return;
     }
 
-    char *buf = malloc(st.size + 1);
-    if (!buf) {
-        syscall_close(fd);
-        set_status("Out of memory", 1);
-        return;
-    }
-
-    int n = syscall_read(fd, buf, st.size);
+    // Map the file instead of copying it; pages are read in as they are parsed
+    char *buf = syscall_mmap(NULL, st.size, PROT_READ, MAP_PRIVATE, fd, 0);
     syscall_close(fd);
 
-    if (n < 0) {
-        free(buf);
+    if (buf == (void *)-1) {
         set_status("Read error", 1);
         return;
     }
-    buf[n] = '\0';
+    char *buf_end = buf + st.size;
 
     // Split into lines
     line_count = 0;
     char *p = buf;
-    while (*p && line_count < MAX_LINES) {
+    while (p < buf_end && *p && line_count < MAX_LINES) {
         char *end = p;
-        while (*end && *end != '\n' && *end != '\r') end++;
+        while (end < buf_end && *end && *end != '\n' && *end != '\r') end++;
 
         int len = end - p;
         if (len >= MAX_COLS) len = MAX_COLS - 1;
@@ -168,8 +161,8 @@ static void editor_load_file(const char *path) {
         text[line_count][len] = '\0';
         line_count++;
 
-        if (*end == '\r') end++;  // handle CRLF
-        if (*end == '\n') end++;
+        if (end < buf_end && *end == '\r') end++;  // handle CRLF
+        if (end < buf_end && *end == '\n') end++;
         p = end;
     }
 
@@ -178,7 +171,7 @@ static void editor_load_file(const char *path) {
         text[0][0] = '\0';
     }
 
-    free(buf);
+    syscall_munmap(buf, st.size);
     dirty = 0;
     set_status("File loaded", 0);
 }
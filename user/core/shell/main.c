@@ -192,7 +192,7 @@ void test_pipe_command(char **args) {
 }
 
 void test_shm_command(char **args) {
-    int shm_id = syscall_shm_create(4096); // Create a shared memory segment of 4KB
+    int shm_id = syscall_shm_create(4096, 0); // Create a shared memory segment of 4KB
     if (shm_id < 0) {
         printf("Error: Failed to create shared memory\n");
         return;
@@ -4,6 +4,7 @@
 #include "test_signals.h"
 #include "test_vfs.h"
 #include "test_proc.h"
+#include "test_mem.h"
 
 int main()
 {
@@ -19,6 +20,7 @@ int main()
     test_waitpid_any();
 
     test_session_pgrp();
+    bench_pingpong();
 
     test_vfs_basic();
     test_vfs_readwrite();
@@ -29,6 +31,16 @@ int main()
     test_tty_ioctl_basic();
     test_path_syscalls_basic();
 
+    test_cow_fork();
+    test_demand_zero();
+    test_zero_page();
+    bench_fault_burst();
+    bench_fork_latency();
+    test_huge_pages();
+    bench_huge_sweep();
+    test_vma_reuse();
+    test_file_mmap();
+
     test_print_summary();
     return test_get_failures() ? 1 : 0;
 }
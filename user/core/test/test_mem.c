@@ -0,0 +1,442 @@
+#include "user/syscall.h"
+#include "user/stdio.h"
+#include "test_framework.h"
+#include "test_utils.h"
+
+#define PAGE_SIZE 4096
+#define FORK_BENCH_ITERS 20
+#define HUGE_SWEEP_PASSES 20
+
+// Write one word into every page so the range is resident
+static void touch_pages(uint8_t *buf, uint32_t size, uint8_t value)
+{
+    for (uint32_t off = 0; off < size; off += PAGE_SIZE)
+        buf[off] = value;
+}
+
+void test_cow_fork(void)
+{
+    printf("\n[cow fork]\n");
+
+    uint32_t size = 4 * PAGE_SIZE;
+    uint8_t *buf = (uint8_t *)syscall_sbrk(size);
+    CHECK("sbrk for cow buffer", buf != (void *)-1, "sbrk failed");
+    if (buf == (void *)-1)
+        return;
+    touch_pages(buf, size, 0xAA);
+
+    int pid = syscall_fork();
+    if (pid == 0)
+    {
+        // Child sees the parent's data, then writes its own copy
+        int ok = buf[0] == 0xAA && buf[3 * PAGE_SIZE] == 0xAA;
+        touch_pages(buf, size, 0x55);
+        ok = ok && buf[PAGE_SIZE] == 0x55;
+        syscall_exit(ok ? 0 : 1);
+    }
+
+    int status = -1;
+    syscall_waitpid(pid, &status, 0);
+    CHECK("child reads inherited data and writes", status == 0, "child saw wrong data");
+    CHECK("parent unaffected by child writes",
+          buf[0] == 0xAA && buf[PAGE_SIZE] == 0xAA && buf[3 * PAGE_SIZE] == 0xAA,
+          "child write leaked into parent");
+
+    // The parent can still write after the child is gone
+    touch_pages(buf, size, 0x11);
+    CHECK("parent writes after child exit", buf[2 * PAGE_SIZE] == 0x11, "write lost");
+}
+
+void test_demand_zero(void)
+{
+    printf("\n[demand zero]\n");
+
+    // Large sparse reservations only cost the pages that are touched
+    uint32_t heap_size = 8 * 1024 * 1024;
+    uint8_t *heap = (uint8_t *)syscall_sbrk(heap_size);
+    CHECK("sbrk 8MB", heap != (void *)-1, "sbrk failed");
+    if (heap != (void *)-1)
+    {
+        int zero = heap[0] == 0 && heap[heap_size / 2] == 0 && heap[heap_size - 1] == 0;
+        CHECK("fresh heap pages read as zero", zero, "non-zero byte in new heap");
+        heap[heap_size / 2] = 0x5A;
+        CHECK("heap page writable after fault", heap[heap_size / 2] == 0x5A, "write lost");
+    }
+
+    uint32_t map_size = 16 * 1024 * 1024;
+    uint8_t *map = (uint8_t *)syscall_mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK("mmap 16MB anonymous", map != (void *)-1, "mmap failed");
+    if (map == (void *)-1)
+        return;
+
+    int zero = 1;
+    for (uint32_t off = 0; off < map_size; off += 1024 * 1024)
+    {
+        zero = zero && map[off] == 0;
+        map[off] = 0xC3;
+    }
+    CHECK("anonymous mmap reads as zero", zero, "non-zero byte in new mapping");
+    CHECK("anonymous mmap writable", map[map_size - 1024 * 1024] == 0xC3, "write lost");
+    syscall_munmap(map, map_size);
+
+    // Deep recursion-sized stack use grows the stack on demand
+    volatile uint8_t frame[64 * 1024];
+    frame[0] = 1;
+    frame[sizeof(frame) - 1] = 2;
+    CHECK("stack grows past initial pages", frame[0] == 1 && frame[sizeof(frame) - 1] == 2, "stack write lost");
+}
+
+void test_zero_page(void)
+{
+    printf("\n[zero page]\n");
+
+    uint32_t size = 64 * PAGE_SIZE;
+    uint8_t *map = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK("mmap 64 pages", map != (void *)-1, "mmap failed");
+    if (map == (void *)-1)
+        return;
+
+    // Reads of untouched pages all land on the shared zero frame
+    uint32_t sum = 0;
+    for (uint32_t off = 0; off < size; off += 512)
+        sum += map[off];
+    CHECK("untouched pages read as zero", sum == 0, "non-zero byte before any write");
+
+    // The first write gives that page a private frame and leaves the rest zero
+    map[5 * PAGE_SIZE + 7] = 0x42;
+    CHECK("write after read fault lands", map[5 * PAGE_SIZE + 7] == 0x42, "write lost");
+    CHECK("neighbours stay zero", map[4 * PAGE_SIZE + 7] == 0 && map[6 * PAGE_SIZE + 7] == 0,
+          "write leaked through the zero page");
+
+    int pid = syscall_fork();
+    if (pid == 0)
+    {
+        int ok = map[5 * PAGE_SIZE + 7] == 0x42 && map[9 * PAGE_SIZE] == 0;
+        map[9 * PAGE_SIZE] = 0x24;
+        ok = ok && map[9 * PAGE_SIZE] == 0x24;
+        syscall_exit(ok ? 0 : 1);
+    }
+
+    int status = -1;
+    syscall_waitpid(pid, &status, 0);
+    CHECK("child reads and breaks zero page", status == 0, "child saw wrong data");
+    CHECK("child write not visible in parent", map[9 * PAGE_SIZE] == 0, "zero page was written");
+    syscall_munmap(map, size);
+}
+
+void test_huge_pages(void)
+{
+    printf("\n[huge pages]\n");
+
+    uint32_t size = 2 * HUGE_PAGE_SIZE;
+    uint8_t *map = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    CHECK("mmap 8MB huge", map != (void *)-1, "mmap failed");
+    if (map == (void *)-1)
+        return;
+
+    CHECK("huge mapping is 4MB aligned", ((uint32_t)map & (HUGE_PAGE_SIZE - 1)) == 0,
+          "misaligned address");
+    CHECK("huge pages start zeroed", map[0] == 0 && map[size - 1] == 0, "non-zero byte");
+    touch_pages(map, size, 0x6B);
+    CHECK("huge pages writable", map[HUGE_PAGE_SIZE + PAGE_SIZE] == 0x6B, "write lost");
+
+    int pid = syscall_fork();
+    if (pid == 0)
+    {
+        int ok = map[3 * PAGE_SIZE] == 0x6B;
+        map[3 * PAGE_SIZE] = 0x11;
+        syscall_exit(ok && map[3 * PAGE_SIZE] == 0x11 ? 0 : 1);
+    }
+
+    int status = -1;
+    syscall_waitpid(pid, &status, 0);
+    CHECK("child inherits huge page contents", status == 0, "child saw wrong data");
+    CHECK("private huge page not shared with child", map[3 * PAGE_SIZE] == 0x6B,
+          "child write visible in parent");
+    syscall_munmap(map, size);
+
+    int id = syscall_shm_create(3 * 1024 * 1024, SHM_HUGE);
+    CHECK("shm_create huge", id >= 0, "shm_create failed");
+    if (id < 0)
+        return;
+    uint8_t *shm = (uint8_t *)syscall_shm_map(id);
+    CHECK("shm_map huge", shm != NULL, "shm_map failed");
+    if (shm)
+    {
+        shm[0] = 1;
+        shm[3 * 1024 * 1024 - 1] = 2;
+        CHECK("huge shm readable and writable", shm[0] == 1 && shm[3 * 1024 * 1024 - 1] == 2,
+              "write lost");
+        syscall_shm_unmap(id);
+    }
+    syscall_shm_destroy(id);
+}
+
+// Repeated sweeps over 8MB with 4K pages and with 4MB pages
+void bench_huge_sweep(void)
+{
+    static const int modes[] = {0, MAP_HUGETLB};
+    uint32_t size = 2 * HUGE_PAGE_SIZE;
+
+    printf("\n[huge page sweep]\n");
+    for (int m = 0; m < 2; m++)
+    {
+        uint8_t *map = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS | modes[m], -1, 0);
+        if (map == (void *)-1)
+        {
+            printf("  mmap failed\n");
+            return;
+        }
+        touch_pages(map, size, 1);
+
+        uint32_t start = syscall_get_ticks();
+        for (int pass = 0; pass < HUGE_SWEEP_PASSES; pass++)
+            touch_pages(map, size, (uint8_t)pass);
+        uint32_t elapsed = syscall_get_ticks() - start;
+        printf("  %s pages: %d sweeps of %d pages in %d ms\n", modes[m] ? "4MB" : "4KB",
+               HUGE_SWEEP_PASSES, size / PAGE_SIZE, elapsed);
+        syscall_munmap(map, size);
+    }
+}
+
+// Write-fault burst on fresh memory; after an idle period the frames come pre-zeroed
+void bench_fault_burst(void)
+{
+    uint32_t size = 4 * 1024 * 1024;
+
+    printf("\n[fault burst]\n");
+    t_sleep(100);   // let the idle loop refill the zero pool
+
+    uint8_t *map = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == (void *)-1)
+    {
+        printf("  mmap failed\n");
+        return;
+    }
+
+    uint32_t start = syscall_get_ticks();
+    touch_pages(map, size, 1);
+    uint32_t elapsed = syscall_get_ticks() - start;
+    printf("  %d write faults in %d ms\n", size / PAGE_SIZE, elapsed);
+    syscall_munmap(map, size);
+}
+
+// Fork latency as the resident set grows; COW should keep it nearly flat
+void bench_fork_latency(void)
+{
+    static const uint32_t sizes[] = {0, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+    uint32_t resident = 0;
+
+    printf("\n[fork latency]\n");
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        if (sizes[s] > resident)
+        {
+            uint8_t *buf = (uint8_t *)syscall_sbrk(sizes[s] - resident);
+            if (buf == (void *)-1)
+            {
+                printf("  sbrk of %d bytes failed\n", sizes[s] - resident);
+                return;
+            }
+            touch_pages(buf, sizes[s] - resident, 1);
+            resident = sizes[s];
+        }
+
+        uint32_t start = syscall_get_ticks();
+        for (int i = 0; i < FORK_BENCH_ITERS; i++)
+        {
+            int pid = syscall_fork();
+            if (pid == 0)
+                syscall_exit(0);
+            syscall_waitpid(pid, NULL, 0);
+        }
+        uint32_t elapsed = syscall_get_ticks() - start;
+        printf("  rss +%d KB: %d forks in %d ms\n", resident / 1024, FORK_BENCH_ITERS, elapsed);
+    }
+}
+
+// Append the decimal or zero-padded hex form of val to buf
+static char *append_num(char *buf, uint32_t val, int hex)
+{
+    char tmp[12];
+    int len = 0;
+    uint32_t base = hex ? 16 : 10;
+    do
+    {
+        tmp[len++] = "0123456789abcdef"[val % base];
+        val /= base;
+    } while (val || (hex && len < 8));
+    while (len)
+        *buf++ = tmp[--len];
+    *buf = '\0';
+    return buf;
+}
+
+static char *append_str(char *buf, const char *str)
+{
+    while (*str)
+        *buf++ = *str++;
+    *buf = '\0';
+    return buf;
+}
+
+static int contains(const char *text, const char *needle)
+{
+    for (; *text; text++)
+    {
+        const char *a = text, *b = needle;
+        while (*b && *a == *b)
+            a++, b++;
+        if (!*b)
+            return 1;
+    }
+    return 0;
+}
+
+void test_vma_reuse(void)
+{
+    printf("\n[vma reuse]\n");
+
+    uint32_t size = 16 * PAGE_SIZE;
+    uint8_t *a = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint8_t *b = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK("mmap two regions", a != (void *)-1 && b != (void *)-1, "mmap failed");
+    if (a == (void *)-1 || b == (void *)-1)
+        return;
+
+    // A freed range is handed out again instead of growing the address space
+    syscall_munmap(a, size);
+    uint8_t *c = (uint8_t *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK("munmap'd range reused", c == a, "mmap did not reuse the hole");
+    CHECK("reused range reads as zero", c[0] == 0 && c[size - 1] == 0, "stale data");
+
+    touch_pages(c, size, 0x5A);
+    CHECK("mprotect read-only", syscall_mprotect(c, size, PROT_READ) == 0, "mprotect failed");
+    CHECK("read-only pages keep data", c[PAGE_SIZE] == 0x5A, "data lost");
+
+    int pid = syscall_fork();
+    if (pid == 0)
+    {
+        c[0] = 1; // must fault
+        syscall_exit(0);
+    }
+    int status = 0;
+    syscall_waitpid(pid, &status, 0);
+    CHECK("write to read-only page faults", status != 0, "write went through");
+
+    CHECK("mprotect back to read-write", syscall_mprotect(c, size, PROT_READ | PROT_WRITE) == 0,
+          "mprotect failed");
+    c[0] = 0x77;
+    CHECK("write after restoring write access", c[0] == 0x77 && c[PAGE_SIZE] == 0x5A, "write lost");
+
+    // The mapping shows up in /PROC/<pid>/MAPS
+    char path[32], line[16];
+    char *p = append_str(path, "/PROC/");
+    p = append_num(p, syscall_getpid(), 0);
+    append_str(p, "/MAPS");
+    append_str(append_num(line, (uint32_t)c, 1), "-");
+
+    static char maps[2048];
+    int fd = syscall_open(path, O_RDONLY);
+    CHECK("open /PROC/<pid>/MAPS", fd >= 0, "open failed");
+    if (fd >= 0)
+    {
+        read_file_contents(fd, maps, sizeof(maps));
+        syscall_close(fd);
+        CHECK("MAPS lists the mapping", contains(maps, line), "mapping missing");
+        CHECK("MAPS lists the stack", contains(maps, "[stack]"), "stack missing");
+    }
+
+    syscall_munmap(c, size);
+    CHECK("mprotect of unmapped range fails", syscall_mprotect(c, size, PROT_READ) != 0,
+          "mprotect accepted a hole");
+    syscall_munmap(b, size);
+}
+
+// Bytes of the test file are a function of their offset
+static char file_byte(uint32_t off)
+{
+    return 'A' + (off * 7 + off / PAGE_SIZE) % 26;
+}
+
+void test_file_mmap(void)
+{
+    printf("\n[file mmap]\n");
+
+    const char *path = "/home/MAP.TXT";
+    static char data[2 * PAGE_SIZE + 100];
+    uint32_t size = sizeof(data);
+    for (uint32_t i = 0; i < size; i++)
+        data[i] = file_byte(i);
+
+    int fd = syscall_open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    CHECK("create mapped file", fd >= 0, "open failed");
+    if (fd < 0)
+        return;
+    syscall_write(fd, data, size);
+    syscall_close(fd);
+
+    // Private: the file is read in page by page, writes stay in the process
+    fd = syscall_open(path, O_RDONLY);
+    char *map = (char *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    CHECK("mmap file private", map != (void *)-1, "mmap failed");
+    CHECK("mmap shared writable on read-only fd fails",
+          syscall_mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) == (void *)-1,
+          "mapping accepted");
+    syscall_close(fd);
+    if (map == (void *)-1)
+        return;
+
+    CHECK("mapped bytes match the file",
+          map[0] == file_byte(0) && map[PAGE_SIZE + 5] == file_byte(PAGE_SIZE + 5) &&
+              map[size - 1] == file_byte(size - 1),
+          "wrong data");
+    CHECK("tail past end of file is zero", map[size] == 0 && map[3 * PAGE_SIZE - 1] == 0,
+          "non-zero tail");
+    map[0] = '#';
+    syscall_munmap(map, size);
+
+    fd = syscall_open(path, O_RDONLY);
+    char first = 0;
+    syscall_read(fd, &first, 1);
+    syscall_close(fd);
+    CHECK("private writes do not reach the file", first == file_byte(0), "file modified");
+
+    // Shared: dirty pages go back on msync and on munmap
+    fd = syscall_open(path, O_RDWR);
+    map = (char *)syscall_mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PAGE_SIZE);
+    CHECK("mmap file shared at an offset", map != (void *)-1, "mmap failed");
+    if (map == (void *)-1)
+    {
+        syscall_close(fd);
+        return;
+    }
+    CHECK("offset mapping starts at the offset", map[0] == file_byte(PAGE_SIZE), "wrong data");
+
+    map[1] = '1';
+    CHECK("msync", syscall_msync(map, PAGE_SIZE, MS_SYNC) == 0, "msync failed");
+    map[PAGE_SIZE + 2] = '2';
+    syscall_munmap(map, size - PAGE_SIZE);
+    syscall_close(fd);
+
+    static char check[sizeof(data)];
+    fd = syscall_open(path, O_RDONLY);
+    int n = syscall_read(fd, check, size);
+    syscall_close(fd);
+    CHECK("file keeps its size", n == (int)size, "size changed");
+    CHECK("msync wrote the page back", check[PAGE_SIZE + 1] == '1', "write lost");
+    CHECK("munmap wrote the last page back", check[2 * PAGE_SIZE + 2] == '2', "write lost");
+    CHECK("untouched bytes unchanged",
+          check[PAGE_SIZE] == file_byte(PAGE_SIZE) && check[size - 1] == file_byte(size - 1),
+          "file corrupted");
+
+    syscall_unlink(path);
+}
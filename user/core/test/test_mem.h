@@ -0,0 +1,11 @@
+#pragma once
+
+void test_cow_fork(void);
+void test_demand_zero(void);
+void test_zero_page(void);
+void bench_fault_burst(void);
+void bench_fork_latency(void);
+void test_huge_pages(void);
+void bench_huge_sweep(void);
+void test_vma_reuse(void);
+void test_file_mmap(void);
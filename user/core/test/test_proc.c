@@ -16,3 +16,51 @@ void test_session_pgrp(void)
     // pgrp = syscall_getpgrp();
     // CHECK("getpgrp after setsid", pgrp == pid, "pgrp changed unexpectedly");
 }
+
+#define PINGPONG_ROUNDS 500
+
+// Round trips between two processes over a pipe pair: each one costs two
+// context switches and two address-space switches
+void bench_pingpong(void)
+{
+    int to_child[2], to_parent[2];
+
+    printf("\n[ping-pong]\n");
+    if (syscall_pipe(to_child) < 0 || syscall_pipe(to_parent) < 0)
+    {
+        printf("  pipe failed\n");
+        return;
+    }
+
+    int pid = syscall_fork();
+    if (pid == 0)
+    {
+        char c;
+        for (int i = 0; i < PINGPONG_ROUNDS; i++)
+        {
+            if (syscall_read(to_child[0], &c, 1) != 1)
+                syscall_exit(1);
+            syscall_write(to_parent[1], &c, 1);
+        }
+        syscall_exit(0);
+    }
+
+    char c = 'x';
+    uint32_t start = syscall_get_ticks();
+    for (int i = 0; i < PINGPONG_ROUNDS; i++)
+    {
+        syscall_write(to_child[1], &c, 1);
+        if (syscall_read(to_parent[0], &c, 1) != 1)
+            break;
+    }
+    uint32_t elapsed = syscall_get_ticks() - start;
+
+    int status = -1;
+    syscall_waitpid(pid, &status, 0);
+    printf("  %d round trips in %d ms (child status %d)\n", PINGPONG_ROUNDS, elapsed, status);
+
+    syscall_close(to_child[0]);
+    syscall_close(to_child[1]);
+    syscall_close(to_parent[0]);
+    syscall_close(to_parent[1]);
+}
@@ -1,3 +1,4 @@
 #pragma once
 
 void test_session_pgrp(void);
+void bench_pingpong(void);
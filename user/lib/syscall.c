@@ -116,8 +116,8 @@ int syscall_ioctl(int fd, int request, void *arg) {
  * Shared-memory & framebuffer syscall wrappers
  * --------------------------------------------------------------------- */
 
-int syscall_shm_create(uint32_t size) {
-    return syscall(SYSCALL_SHM_CREATE, (int)size, 0, 0);
+int syscall_shm_create(uint32_t size, uint32_t flags) {
+    return syscall(SYSCALL_SHM_CREATE, (int)size, (int)flags, 0);
 }
 
 void *syscall_shm_map(int shm_id) {
@@ -189,13 +189,23 @@ int syscall_nanosleep(const timespec_t *req, timespec_t *rem) {
 }
 
 void *syscall_mmap(void *addr, uint32_t length, int prot, int flags, int fd, uint32_t offset) {
-    return (void *)syscall6(SYSCALL_MMAP2, (int)addr, length, prot, flags, fd, offset);
+    // mmap2 takes the file offset in 4K pages
+    if (offset & 0xFFF) return (void *)-1;
+    return (void *)syscall6(SYSCALL_MMAP2, (int)addr, length, prot, flags, fd, offset >> 12);
 }
 
 void *syscall_munmap(void *addr, size_t length) {
     return (void *)syscall(SYSCALL_MUNMAP, (int)addr, length, 0);
 }
 
+int syscall_mprotect(void *addr, size_t length, int prot) {
+    return syscall(SYSCALL_MPROTECT, (int)addr, length, prot);
+}
+
+int syscall_msync(void *addr, size_t length, int flags) {
+    return syscall(SYSCALL_MSYNC, (int)addr, length, flags);
+}
+
 void t_sleep(uint32_t seconds) {
     timespec_t req = { .tv_sec = seconds, .tv_nsec = 0 };
     syscall_nanosleep(&req, NULL);